@@ -18,12 +18,44 @@
 #include "realm-command.h"
 #include "realm-daemon.h"
 #include "realm-diagnostics.h"
+#include "realm-disco-score.h"
 #include "realm-dn-util.h"
 #include "realm-errors.h"
 #include "realm-ini-config.h"
 #include "realm-options.h"
 #include "realm-settings.h"
 
+static gchar *
+domain_controller_arg (RealmDisco *disco,
+                       GDBusMethodInvocation *invocation)
+{
+	GInetAddress *address;
+	gchar *best;
+
+	/* The server discovery chose, unless it has failed since */
+	if (G_IS_INET_SOCKET_ADDRESS (disco->server_address) &&
+	    (disco->explicit_server || !realm_disco_score_is_failing (disco->server_address))) {
+		address = g_inet_socket_address_get_address (G_INET_SOCKET_ADDRESS (disco->server_address));
+		return g_inet_address_to_string (address);
+	}
+
+	/* Otherwise the best healthy server seen recently, unless one was asked for */
+	if (disco->explicit_server == NULL) {
+		best = realm_disco_score_best (disco->domain_name);
+		if (best != NULL) {
+			realm_diagnostics_info (invocation, "Using domain controller: %s", best);
+			return best;
+		}
+	}
+
+	if (G_IS_INET_SOCKET_ADDRESS (disco->server_address)) {
+		address = g_inet_socket_address_get_address (G_INET_SOCKET_ADDRESS (disco->server_address));
+		return g_inet_address_to_string (address);
+	}
+
+	return g_strdup (disco->explicit_server);
+}
+
 static void
 on_join_process (GObject *source,
                  GAsyncResult *result,
@@ -73,7 +105,6 @@ realm_adcli_enroll_join_async (RealmDisco *disco,
                                gpointer user_data)
 {
 	gchar *environ[] = { "LANG=C", NULL };
-	GInetAddress *address;
 	const gchar *computer_ou;
 	GTask *task;
 	GBytes *input = NULL;
@@ -102,17 +133,10 @@ realm_adcli_enroll_join_async (RealmDisco *disco,
 	g_ptr_array_add (args, "--domain-realm");
 	g_ptr_array_add (args, (gpointer)disco->kerberos_realm);
 
-	if (G_IS_INET_SOCKET_ADDRESS (disco->server_address)) {
-		address = g_inet_socket_address_get_address (G_INET_SOCKET_ADDRESS (disco->server_address));
-		server_arg = g_inet_address_to_string (address);
-		if (server_arg) {
-			g_ptr_array_add (args, "--domain-controller");
-			g_ptr_array_add (args, server_arg);
-		}
-
-	} else if (disco->explicit_server) {
+	server_arg = domain_controller_arg (disco, invocation);
+	if (server_arg) {
 		g_ptr_array_add (args, "--domain-controller");
-		g_ptr_array_add (args, (gpointer)disco->explicit_server);
+		g_ptr_array_add (args, server_arg);
 	}
 
 		/* Pass manually configured or truncated computer name to adcli */
@@ -202,7 +226,7 @@ realm_adcli_enroll_join_async (RealmDisco *disco,
 		g_bytes_unref (input);
 	free (ccache_arg);
 	free (upn_arg);
-	free (server_arg);
+	g_free (server_arg);
 	free (ou_arg);
 }
 
@@ -223,7 +247,6 @@ realm_adcli_enroll_delete_async (RealmDisco *disco,
                                  gpointer user_data)
 {
 	gchar *environ[] = { "LANG=C", NULL };
-	GInetAddress *address;
 	GTask *task;
 	GBytes *input = NULL;
 	GPtrArray *args;
@@ -246,17 +269,10 @@ realm_adcli_enroll_delete_async (RealmDisco *disco,
 	g_ptr_array_add (args, "--domain-realm");
 	g_ptr_array_add (args, (gpointer)disco->kerberos_realm);
 
-	if (G_IS_INET_SOCKET_ADDRESS (disco->server_address)) {
-		address = g_inet_socket_address_get_address (G_INET_SOCKET_ADDRESS (disco->server_address));
-		server_arg = g_inet_address_to_string (address);
-		if (server_arg) {
-			g_ptr_array_add (args, "--domain-controller");
-			g_ptr_array_add (args, server_arg);
-		}
-
-	} else if (disco->explicit_server) {
+	server_arg = domain_controller_arg (disco, invocation);
+	if (server_arg) {
 		g_ptr_array_add (args, "--domain-controller");
-		g_ptr_array_add (args, (gpointer)disco->explicit_server);
+		g_ptr_array_add (args, server_arg);
 	}
 
 	switch (cred->type) {
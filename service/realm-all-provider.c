@@ -117,7 +117,7 @@ discover_closure_free (gpointer data)
 {
 	DiscoverClosure *discover = data;
 	g_free (discover->operation_id);
-	g_object_unref (discover->invocation);
+	g_clear_object (&discover->invocation);
 	while (!g_queue_is_empty (&discover->results))
 		discover_result_free (g_queue_pop_head (&discover->results));
 	while (!g_queue_is_empty (&discover->failures))
@@ -221,7 +221,7 @@ realm_all_provider_discover_async (RealmProvider *provider,
 	                                 realm_all_provider_discover_async);
 	discover = g_new0 (DiscoverClosure, 1);
 	g_queue_init (&discover->results);
-	discover->invocation = g_object_ref (invocation);
+	discover->invocation = invocation ? g_object_ref (invocation) : NULL;
 	g_simple_async_result_set_op_res_gpointer (res, discover, discover_closure_free);
 
 	for (l = self->providers; l != NULL; l = g_list_next (l)) {
@@ -19,13 +19,24 @@
 #include "realm-diagnostics.h"
 #include "realm-invocation.h"
 #include "realm-settings.h"
+#include "realm-trace.h"
 
 #include <glib/gi18n-lib.h>
+#include <glib-unix.h>
 
+#include <sys/resource.h>
+#include <sys/syscall.h>
 #include <sys/wait.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <signal.h>
 #include <string.h>
+#include <unistd.h>
+
+#if HAVE_DECL_POSIX_SPAWN_SETSID && defined (HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCLOSEFROM_NP)
+#define USE_POSIX_SPAWN 1
+#include <spawn.h>
+#endif
 
 enum {
 	FD_INPUT,
@@ -36,23 +47,69 @@ enum {
 
 #define DEBUG_VERBOSE 0
 
+/* Reads start with this much, and grow while the child keeps the pipe full */
+#define READ_MIN      4096
+#define READ_MAX      65536
+
+/* Most reads from one pipe before returning to the main loop */
+#define READ_BURST    4
+
+/* Partial lines longer than this are passed on to diagnostics anyway */
+#define LINE_MAX_LEN  65536
+
+/* Seconds between asking a command to terminate, and killing it */
+#define KILL_DELAY    5
+
 typedef struct {
 	GBytes *input;
 	gsize input_offset;
 	GString *output;
+	gsize output_limit;
+	gsize output_start;
+	gsize output_dropped;
+	gchar *block;
+	gsize block_size;
+	GString *partial[NUM_FDS];
 	guint source_sig;
 	gint exit_code;
 	gboolean cancelled;
+	gboolean timed_out;
+	gchar *name;
+	gint64 started;
 	GDBusMethodInvocation *invocation;
+	RealmTraceSpan *span;
 } CommandClosure;
 
+/* Totals for each command run since the daemon started */
+typedef struct {
+	guint runs;
+	guint failures;
+	gint64 wall;
+	gint64 user;
+	gint64 system;
+	glong max_rss;
+} CommandMetrics;
+
+static GHashTable *command_metrics = NULL;
+
+/* Command lines from the [commands] section, parsed once */
+typedef struct {
+	gchar *command_line;
+	gchar **argv;
+} KnownCommand;
+
 typedef struct {
 	GSource source;
 	GPollFD polls[NUM_FDS];         /* The various fd's we're listening to */
 
 	GPid child_pid;
+	GPid child_group;
+	gint child_fd;
 	guint child_sig;
 
+	guint timeout_id;
+	guint kill_id;
+
 	GSimpleAsyncResult *res;
 	CommandClosure *command;
 
@@ -64,24 +121,128 @@ static void
 command_closure_free (gpointer data)
 {
 	CommandClosure *command = data;
+	guint i;
+
 	if (command->input)
 		g_bytes_unref (command->input);
 	if (command->invocation)
 		g_object_unref (command->invocation);
-	g_string_free (command->output, TRUE);
+	realm_trace_end (command->span, NULL);
+	if (command->output)
+		g_string_free (command->output, TRUE);
+	for (i = 0; i < NUM_FDS; i++) {
+		if (command->partial[i])
+			g_string_free (command->partial[i], TRUE);
+	}
+	g_free (command->block);
+	g_free (command->name);
 	g_assert (command->source_sig == 0);
 	g_free (command);
 }
 
+/*
+ * Only the last output_limit bytes of output are kept. Callers look at the
+ * output for error messages, which come at the end. Once full the buffer
+ * is used as a ring, and put back in order when the command completes.
+ */
+static void
+output_append (CommandClosure *command,
+               const gchar *data,
+               gsize length)
+{
+	GString *output = command->output;
+	gsize limit = command->output_limit;
+	gsize n;
+
+	if (limit == 0 || output->len + length <= limit) {
+		g_string_append_len (output, data, length);
+		return;
+	}
+
+	/* Fill up to the limit, before starting to overwrite */
+	if (output->len < limit) {
+		n = limit - output->len;
+		g_string_append_len (output, data, n);
+		data += n;
+		length -= n;
+	}
+
+	/* Only the tail of a large block would survive anyway */
+	if (length > limit) {
+		command->output_dropped += length - limit;
+		data += length - limit;
+		length = limit;
+	}
+
+	while (length > 0) {
+		n = MIN (length, limit - command->output_start);
+		memcpy (output->str + command->output_start, data, n);
+		command->output_start = (command->output_start + n) % limit;
+		command->output_dropped += n;
+		data += n;
+		length -= n;
+	}
+}
+
+static void
+output_finish (CommandClosure *command)
+{
+	GString *output = command->output;
+	GString *ordered;
+
+	if (command->output_dropped == 0)
+		return;
+
+	g_debug ("dropped %" G_GSIZE_FORMAT " bytes of command output", command->output_dropped);
+
+	ordered = g_string_sized_new (output->len + 8);
+	g_string_append (ordered, "...\n");
+	g_string_append_len (ordered, output->str + command->output_start,
+	                     output->len - command->output_start);
+	g_string_append_len (ordered, output->str, command->output_start);
+
+	g_string_free (output, TRUE);
+	command->output = ordered;
+	command->output_start = 0;
+	command->output_dropped = 0;
+}
+
 static void
 complete_source_is_done (ProcessSource *process_source)
 {
+	CommandClosure *command = process_source->command;
+	GError *error = NULL;
+
 #if DEBUG_VERBOSE
 	g_debug ("all fds closed and process exited, completing");
 #endif
 
 	g_assert (process_source->child_sig == 0);
 
+	output_finish (command);
+
+	if (process_source->timeout_id) {
+		g_source_remove (process_source->timeout_id);
+		process_source->timeout_id = 0;
+	}
+	if (process_source->kill_id) {
+		g_source_remove (process_source->kill_id);
+		process_source->kill_id = 0;
+	}
+
+	if (command->span) {
+		if (command->timed_out)
+			g_set_error (&error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT, "Process timed out");
+		else if (command->cancelled)
+			g_set_error (&error, G_IO_ERROR, G_IO_ERROR_CANCELLED, "Process was cancelled");
+		else if (command->exit_code != 0)
+			g_set_error (&error, G_SPAWN_ERROR, G_SPAWN_ERROR_FAILED,
+			             "Process exited with code: %d", command->exit_code);
+		realm_trace_end (command->span, error);
+		command->span = NULL;
+		g_clear_error (&error);
+	}
+
 	if (process_source->cancel_sig) {
 		g_signal_handler_disconnect (process_source->cancellable, process_source->cancel_sig);
 		process_source->cancel_sig = 0;
@@ -162,32 +323,103 @@ on_process_source_finalize (GSource *source)
 
 	for (i = 0; i < NUM_FDS; ++i)
 		close_fd (&process_source->polls[i].fd);
+	close_fd (&process_source->child_fd);
 
 	g_assert (!process_source->child_pid);
 	g_assert (!process_source->child_sig);
+	g_assert (!process_source->timeout_id);
+	g_assert (!process_source->kill_id);
+}
+
+static void
+forward_partial (CommandClosure *command,
+                 gint stream)
+{
+	GString *partial = command->partial[stream];
+
+	if (partial == NULL || partial->len == 0)
+		return;
+
+	if (partial->str[partial->len - 1] != '\n')
+		g_string_append_c (partial, '\n');
+	realm_diagnostics_info_data (command->invocation, partial->str, partial->len);
+	g_string_set_size (partial, 0);
+}
+
+/*
+ * Diagnostics are passed on a batch of whole lines at a time, rather than
+ * for every read, each stream keeping its own incomplete last line.
+ */
+static void
+forward_lines (CommandClosure *command,
+               gint stream,
+               const gchar *data,
+               gsize length)
+{
+	GString *partial;
+	gsize end;
+
+	for (end = length; end > 0; end--) {
+		if (data[end - 1] == '\n')
+			break;
+	}
+
+	if (command->partial[stream] == NULL)
+		command->partial[stream] = g_string_new ("");
+	partial = command->partial[stream];
+
+	if (end > 0) {
+		if (partial->len > 0) {
+			g_string_append_len (partial, data, end);
+			forward_partial (command, stream);
+		} else {
+			realm_diagnostics_info_data (command->invocation, data, end);
+		}
+	}
+
+	g_string_append_len (partial, data + end, length - end);
+	if (partial->len >= LINE_MAX_LEN)
+		forward_partial (command, stream);
 }
 
 static gboolean
-read_output (int fd,
-             GString *buffer,
-             GDBusMethodInvocation *invocation)
+read_output (CommandClosure *command,
+             gint stream,
+             int fd)
 {
-	gchar block[1024];
 	gssize result;
+	guint reads;
 
 	g_return_val_if_fail (fd >= 0, FALSE);
 
-	do {
-		result = read (fd, block, sizeof (block));
+	if (command->block == NULL) {
+		command->block_size = READ_MIN;
+		command->block = g_malloc (command->block_size);
+	}
+
+	/* The pipe is non-blocking, and other sources get a turn after a few reads */
+	for (reads = 0; reads < READ_BURST; reads++) {
+		result = read (fd, command->block, command->block_size);
 		if (result < 0) {
-			if (errno == EINTR || errno == EAGAIN)
+			if (errno == EINTR)
 				continue;
+			if (errno == EAGAIN)
+				break;
 			return FALSE;
 		} else if (result > 0) {
-			realm_diagnostics_info_data (invocation, block, result);
-			g_string_append_len (buffer, block, result);
+			forward_lines (command, stream, command->block, result);
+			output_append (command, command->block, result);
 		}
-	} while (result == sizeof (block));
+
+		if ((gsize)result < command->block_size)
+			break;
+
+		/* A chatty command, read more at a time */
+		if (command->block_size < READ_MAX) {
+			command->block_size *= 2;
+			command->block = g_realloc (command->block, command->block_size);
+		}
+	}
 
 	return TRUE;
 }
@@ -235,7 +467,7 @@ on_process_source_output (CommandClosure *command,
                           ProcessSource *process_source,
                           gint fd)
 {
-	if (!read_output (fd, command->output, command->invocation)) {
+	if (!read_output (command, FD_OUTPUT, fd)) {
 		g_warning ("couldn't read output data from process");
 		return FALSE;
 	}
@@ -248,7 +480,7 @@ on_process_source_error (CommandClosure *command,
                          ProcessSource *process_source,
                          gint fd)
 {
-	if (!read_output (fd, command->output, command->invocation)) {
+	if (!read_output (command, FD_ERROR, fd)) {
 		g_warning ("couldn't read error data from process");
 		return FALSE;
 	}
@@ -283,8 +515,10 @@ on_process_source_dispatch (GSource *source,
 		if (poll->revents & G_IO_IN)
 			if (!on_process_source_output (command, process_source, poll->fd))
 				poll->revents |= G_IO_HUP;
-		if (poll->revents & G_IO_HUP)
+		if (poll->revents & G_IO_HUP) {
 			close_poll (source, poll);
+			forward_partial (command, FD_OUTPUT);
+		}
 		poll->revents = 0;
 	}
 
@@ -294,8 +528,10 @@ on_process_source_dispatch (GSource *source,
 		if (poll->revents & G_IO_IN)
 			if (!on_process_source_error (command, process_source, poll->fd))
 				poll->revents |= G_IO_HUP;
-		if (poll->revents & G_IO_HUP)
+		if (poll->revents & G_IO_HUP) {
 			close_poll (source, poll);
+			forward_partial (command, FD_ERROR);
+		}
 		poll->revents = 0;
 	}
 
@@ -320,17 +556,97 @@ static GSourceFuncs process_source_funcs = {
 	on_process_source_finalize,
 };
 
+static gint64
+timeval_to_usec (const struct timeval *tv)
+{
+	return (gint64)tv->tv_sec * G_USEC_PER_SEC + tv->tv_usec;
+}
+
 static void
-on_unix_process_child_exited (GPid pid,
-                              gint status,
-                              gpointer user_data)
+record_metrics (CommandClosure *command,
+                gboolean failed,
+                const struct rusage *usage)
+{
+	CommandMetrics *metrics;
+	gint64 wall;
+
+	wall = g_get_monotonic_time () - command->started;
+
+	if (command_metrics == NULL)
+		command_metrics = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+	metrics = g_hash_table_lookup (command_metrics, command->name);
+	if (metrics == NULL) {
+		metrics = g_new0 (CommandMetrics, 1);
+		g_hash_table_insert (command_metrics, g_strdup (command->name), metrics);
+	}
+
+	metrics->runs++;
+	if (failed)
+		metrics->failures++;
+	metrics->wall += wall;
+
+	/* Not available when the kernel can't tell us when the child exits */
+	if (usage == NULL) {
+		realm_diagnostics_info (command->invocation, "%s took %.3f seconds",
+		                        command->name, (gdouble)wall / G_USEC_PER_SEC);
+		return;
+	}
+
+	metrics->user += timeval_to_usec (&usage->ru_utime);
+	metrics->system += timeval_to_usec (&usage->ru_stime);
+	metrics->max_rss = MAX (metrics->max_rss, usage->ru_maxrss);
+
+	realm_diagnostics_info (command->invocation,
+	                        "%s took %.3f seconds (user %.3f, system %.3f, max RSS %ld KiB)",
+	                        command->name, (gdouble)wall / G_USEC_PER_SEC,
+	                        (gdouble)timeval_to_usec (&usage->ru_utime) / G_USEC_PER_SEC,
+	                        (gdouble)timeval_to_usec (&usage->ru_stime) / G_USEC_PER_SEC,
+	                        usage->ru_maxrss);
+}
+
+GVariant *
+realm_command_metrics_dump (void)
+{
+	GVariantBuilder builder;
+	CommandMetrics *metrics;
+	GHashTableIter iter;
+	const gchar *name;
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(suuxxxx)"));
+
+	if (command_metrics) {
+		g_hash_table_iter_init (&iter, command_metrics);
+		while (g_hash_table_iter_next (&iter, (gpointer *)&name, (gpointer *)&metrics)) {
+			g_variant_builder_add (&builder, "(suuxxxx)", name,
+			                       metrics->runs, metrics->failures,
+			                       metrics->wall, metrics->user, metrics->system,
+			                       (gint64)metrics->max_rss);
+		}
+	}
+
+	return g_variant_builder_end (&builder);
+}
+
+void
+realm_command_metrics_uninit (void)
+{
+	if (command_metrics)
+		g_hash_table_destroy (command_metrics);
+	command_metrics = NULL;
+}
+
+static void
+process_child_exited (ProcessSource *process_source,
+                      gint status,
+                      const struct rusage *usage)
 {
-	ProcessSource *process_source = user_data;
 	CommandClosure *command = process_source->command;
+	gboolean failed = TRUE;
 	gint code;
 	guint i;
 
-	g_debug ("process exited: %d", (int)pid);
+	g_debug ("process exited: %d", (int)process_source->child_pid);
 
 	g_spawn_close_pid (process_source->child_pid);
 	process_source->child_pid = 0;
@@ -338,15 +654,18 @@ on_unix_process_child_exited (GPid pid,
 
 	if (WIFEXITED (status)) {
 		command->exit_code = WEXITSTATUS (status);
+		failed = (command->exit_code != 0);
 
 	} else if (WIFSIGNALED (status)) {
 		code = WTERMSIG (status);
 		/* Ignore cases where we've signaled the process because we were cancelled */
-		if (!command->cancelled)
+		if (!command->cancelled && !command->timed_out)
 			g_simple_async_result_set_error (process_source->res, G_SPAWN_ERROR, G_SPAWN_ERROR_FAILED,
 			                                 _("Process was terminated with signal: %d"), code);
 	}
 
+	record_metrics (command, failed || command->timed_out || command->cancelled, usage);
+
 	for (i = 0; i < NUM_FDS; ++i) {
 		if (process_source->polls[i].fd >= 0)
 			return;
@@ -355,6 +674,67 @@ on_unix_process_child_exited (GPid pid,
 	complete_source_is_done (process_source);
 }
 
+static void
+on_unix_process_child_exited (GPid pid,
+                              gint status,
+                              gpointer user_data)
+{
+	process_child_exited (user_data, status, NULL);
+}
+
+static gboolean
+on_unix_process_child_fd (gint fd,
+                          GIOCondition condition,
+                          gpointer user_data)
+{
+	ProcessSource *process_source = user_data;
+	struct rusage usage;
+	int status = 0;
+	pid_t ret;
+
+	/* Reap the child ourselves, since GLib can't give us its resource usage */
+	ret = wait4 (process_source->child_pid, &status, WNOHANG, &usage);
+	if (ret == 0 || (ret < 0 && errno == EINTR))
+		return TRUE;
+
+	close_fd (&process_source->child_fd);
+
+	if (ret < 0) {
+		g_warning ("couldn't wait for process: %s", g_strerror (errno));
+		g_simple_async_result_set_error (process_source->res, G_SPAWN_ERROR, G_SPAWN_ERROR_FAILED,
+		                                 _("Couldn't wait for process: %s"), g_strerror (errno));
+		process_child_exited (process_source, status, NULL);
+	} else {
+		process_child_exited (process_source, status, &usage);
+	}
+
+	return FALSE;
+}
+
+static guint
+watch_child (ProcessSource *process_source)
+{
+	GSource *source = (GSource *)process_source;
+
+#ifdef SYS_pidfd_open
+	/* A pidfd becomes readable when the child exits */
+	process_source->child_fd = syscall (SYS_pidfd_open, process_source->child_pid, 0);
+	if (process_source->child_fd >= 0) {
+		return g_unix_fd_add_full (G_PRIORITY_DEFAULT, process_source->child_fd, G_IO_IN,
+		                           on_unix_process_child_fd,
+		                           g_source_ref (source),
+		                           (GDestroyNotify)g_source_unref);
+	}
+#endif
+
+	return g_child_watch_add_full (G_PRIORITY_DEFAULT, process_source->child_pid,
+	                               on_unix_process_child_exited,
+	                               g_source_ref (source),
+	                               (GDestroyNotify)g_source_unref);
+}
+
+#ifndef USE_POSIX_SPAWN
+
 static void
 on_unix_process_child_setup (gpointer user_data)
 {
@@ -387,6 +767,65 @@ on_unix_process_child_setup (gpointer user_data)
 	}
 }
 
+#endif /* !USE_POSIX_SPAWN */
+
+static gboolean
+on_process_kill (gpointer user_data)
+{
+	ProcessSource *process_source = user_data;
+
+	process_source->kill_id = 0;
+
+	/* Still around, so forcibly kill the command and anything it started */
+	g_message ("killing process group that didn't terminate: %d",
+	           (int)process_source->child_group);
+	kill (-process_source->child_group, SIGKILL);
+
+	return FALSE;
+}
+
+static void
+terminate_process (ProcessSource *process_source)
+{
+	/*
+	 * The child is a session leader, so signal its whole process group.
+	 * Anything it left running would otherwise keep the output pipes
+	 * open, and we'd wait forever.
+	 */
+	g_debug ("sending term signal to process group: %d",
+	         (int)process_source->child_group);
+	kill (-process_source->child_group, SIGTERM);
+
+	if (process_source->kill_id == 0) {
+		process_source->kill_id = g_timeout_add_seconds_full (G_PRIORITY_DEFAULT, KILL_DELAY,
+		                                                      on_process_kill,
+		                                                      g_source_ref ((GSource *)process_source),
+		                                                      (GDestroyNotify)g_source_unref);
+	}
+}
+
+static gboolean
+on_process_timeout (gpointer user_data)
+{
+	ProcessSource *process_source = user_data;
+	CommandClosure *command = process_source->command;
+
+	process_source->timeout_id = 0;
+
+	g_message ("process timed out: %d", (int)process_source->child_group);
+
+	/* Set an error, which is respected when this actually completes. */
+	if (!command->cancelled) {
+		g_simple_async_result_set_error (process_source->res, G_IO_ERROR, G_IO_ERROR_TIMED_OUT,
+		                                 _("The command took too long and was stopped"));
+		command->timed_out = TRUE;
+		realm_diagnostics_info (command->invocation, "Command timed out, stopping it");
+	}
+
+	terminate_process (process_source);
+	return FALSE;
+}
+
 static void
 on_cancellable_cancelled (GCancellable *cancellable,
                           gpointer user_data)
@@ -395,72 +834,205 @@ on_cancellable_cancelled (GCancellable *cancellable,
 
 	g_debug ("process cancelled: %d", process_source->child_pid);
 
+	if (process_source->command->timed_out)
+		return;
+
 	/* Set an error, which is respected when this actually completes. */
 	g_simple_async_result_set_error (process_source->res, G_IO_ERROR, G_IO_ERROR_CANCELLED,
 	                                 _("The operation was cancelled"));
 	process_source->command->cancelled = TRUE;
 
 	/* Try and kill the child process */
-	if (process_source->child_pid) {
-		g_debug ("sending term signal to process: %d",
-		            (int)process_source->child_pid);
-		kill (process_source->child_pid, SIGTERM);
+	terminate_process (process_source);
+}
+
+#ifdef USE_POSIX_SPAWN
+
+static void
+close_pipes (int pipes[NUM_FDS][2])
+{
+	guint i;
+
+	for (i = 0; i < NUM_FDS; i++) {
+		close_fd (&pipes[i][0]);
+		close_fd (&pipes[i][1]);
 	}
 }
 
-void
-realm_command_runv_async (gchar **argv,
-                          gchar **environ,
-                          GBytes *input,
-                          GDBusMethodInvocation *invocation,
-                          GAsyncReadyCallback callback,
-                          gpointer user_data)
+/*
+ * posix_spawn() doesn't copy the daemon's address space the way fork()
+ * does, which is slow for a large process on a small machine. But it
+ * can only be used when it can make the child a session leader, and
+ * close the file descriptors we don't want the child to inherit.
+ */
+static gboolean
+spawn_with_pipes (gchar **argv,
+                  gchar **env,
+                  GPid *pid,
+                  int *input_fd,
+                  int *output_fd,
+                  int *error_fd,
+                  GError **error)
+{
+	posix_spawn_file_actions_t actions;
+	posix_spawnattr_t attr;
+	int pipes[NUM_FDS][2];
+	sigset_t mask;
+	pid_t child;
+	int ret;
+	guint i;
+
+	for (i = 0; i < NUM_FDS; i++)
+		pipes[i][0] = pipes[i][1] = -1;
+
+	for (i = 0; i < NUM_FDS; i++) {
+		if (pipe2 (pipes[i], O_CLOEXEC) < 0) {
+			ret = errno;
+			g_set_error (error, G_SPAWN_ERROR, G_SPAWN_ERROR_FAILED,
+			             _("Failed to create pipe for communicating with child process (%s)"),
+			             g_strerror (ret));
+			close_pipes (pipes);
+			return FALSE;
+		}
+	}
+
+	posix_spawn_file_actions_init (&actions);
+	posix_spawn_file_actions_adddup2 (&actions, pipes[FD_INPUT][0], 0);
+	posix_spawn_file_actions_adddup2 (&actions, pipes[FD_OUTPUT][1], 1);
+	posix_spawn_file_actions_adddup2 (&actions, pipes[FD_ERROR][1], 2);
+	posix_spawn_file_actions_addclosefrom_np (&actions, NUM_FDS);
+
+	/* No controlling terminal, so commands read passwords from stdin */
+	sigemptyset (&mask);
+	posix_spawnattr_init (&attr);
+	posix_spawnattr_setflags (&attr, POSIX_SPAWN_SETSID | POSIX_SPAWN_SETSIGMASK);
+	posix_spawnattr_setsigmask (&attr, &mask);
+
+	ret = posix_spawn (&child, argv[0], &actions, &attr, argv, env);
+
+	posix_spawnattr_destroy (&attr);
+	posix_spawn_file_actions_destroy (&actions);
+
+	/* The child's ends of the pipes */
+	close_fd (&pipes[FD_INPUT][0]);
+	close_fd (&pipes[FD_OUTPUT][1]);
+	close_fd (&pipes[FD_ERROR][1]);
+
+	if (ret != 0) {
+		g_set_error (error, G_SPAWN_ERROR,
+		             ret == ENOENT ? G_SPAWN_ERROR_NOENT : G_SPAWN_ERROR_FAILED,
+		             _("Failed to execute child process \"%s\" (%s)"),
+		             argv[0], g_strerror (ret));
+		close_pipes (pipes);
+		return FALSE;
+	}
+
+	*pid = child;
+	*input_fd = pipes[FD_INPUT][1];
+	*output_fd = pipes[FD_OUTPUT][0];
+	*error_fd = pipes[FD_ERROR][0];
+	return TRUE;
+}
+
+#else /* !USE_POSIX_SPAWN */
+
+static gboolean
+spawn_with_pipes (gchar **argv,
+                  gchar **env,
+                  GPid *pid,
+                  int *input_fd,
+                  int *output_fd,
+                  int *error_fd,
+                  GError **error)
+{
+	int child_fds[NUM_FDS];
+
+	/* Spawn/child will close all other attributes, besides those in child_fds */
+	child_fds[FD_INPUT] = 0;
+	child_fds[FD_OUTPUT] = 1;
+	child_fds[FD_ERROR] = 2;
+
+	return g_spawn_async_with_pipes (NULL, argv, env,
+	                                 G_SPAWN_DO_NOT_REAP_CHILD,
+	                                 on_unix_process_child_setup, child_fds,
+	                                 pid, input_fd, output_fd, error_fd, error);
+}
+
+#endif /* !USE_POSIX_SPAWN */
+
+static gchar **
+build_environment (gchar **environ)
+{
+	gchar **env;
+	gchar **parts;
+	guint i;
+
+	/* Read each time, something may have changed the environment */
+	env = g_get_environ ();
+	for (i = 0; environ != NULL && environ[i] != NULL; i++) {
+		parts = g_strsplit (environ[i], "=", 2);
+		if (!parts[0] || !parts[1])
+			g_warning ("invalid environment variable: %s", environ[i]);
+		else
+			env = g_environ_setenv (env, parts[0], parts[1], TRUE);
+		g_strfreev (parts);
+	}
+
+	return env;
+}
+
+static gdouble
+lookup_timeout (const gchar *name)
+{
+	/* Configured commands by their name, others by the program name */
+	if (realm_settings_value ("command-timeouts", name) != NULL)
+		return realm_settings_double ("command-timeouts", name, 0);
+	return realm_settings_double ("command-timeouts", "default", 0);
+}
+
+static void
+set_nonblocking (int fd)
+{
+	int flags;
+
+	if (fd < 0)
+		return;
+	flags = fcntl (fd, F_GETFL);
+	if (flags < 0 || fcntl (fd, F_SETFL, flags | O_NONBLOCK) < 0)
+		g_warning ("couldn't make pipe to process non-blocking: %s", g_strerror (errno));
+}
+
+static void
+run_command (gchar **argv,
+             gchar **environ,
+             GBytes *input,
+             const gchar *name,
+             GDBusMethodInvocation *invocation,
+             GAsyncReadyCallback callback,
+             gpointer user_data)
 {
 	GSimpleAsyncResult *res;
 	CommandClosure *command;
 	GError *error = NULL;
-	int child_fds[NUM_FDS];
 	int output_fd = -1;
 	int error_fd = -1;
 	int input_fd = -1;
 	ProcessSource *process_source;
 	GCancellable *cancellable;
 	GSource *source;
+	RealmTraceSpan *span;
 	gchar *cmd_string;
 	gchar *env_string;
-	gchar **parts;
+	gchar *program;
 	gchar **env;
+	gdouble timeout;
 	GPid pid;
 	guint i;
 
-	g_return_if_fail (argv != NULL);
-	g_return_if_fail (invocation == NULL || G_IS_DBUS_METHOD_INVOCATION (invocation));
-
 	cancellable = realm_invocation_get_cancellable (invocation);
 
-	for (i = 0; i < NUM_FDS; i++)
-		child_fds[i] = -1;
-
-	/* TODO: Figure out if it's a name, and lookup the path */
-
-	/* Spawn/child will close all other attributes, besides thesthose in child_fds */
-	child_fds[FD_INPUT] = 0;
-	child_fds[FD_OUTPUT] = 1;
-	child_fds[FD_ERROR] = 2;
-
-	env = g_get_environ ();
-	env_string = NULL;
-	if (environ) {
-		env_string = g_strjoinv (" ", environ);
-		for (i = 0; environ != NULL && environ[i] != NULL; i++) {
-			parts = g_strsplit (environ[i], "=", 2);
-			if (!parts[0] || !parts[1])
-				g_warning ("invalid environment variable: %s", environ[i]);
-			else
-				env = g_environ_setenv (env, parts[0], parts[1], TRUE);
-			g_strfreev (parts);
-		}
-	}
+	env = build_environment (environ);
+	env_string = environ ? g_strjoinv (" ", environ) : NULL;
 
 	cmd_string = g_strjoinv (" ", argv);
 	realm_diagnostics_info (invocation, "%s%s%s",
@@ -470,21 +1042,26 @@ realm_command_runv_async (gchar **argv,
 	g_free (env_string);
 	g_free (cmd_string);
 
-	g_spawn_async_with_pipes (NULL, argv, env,
-	                          G_SPAWN_DO_NOT_REAP_CHILD,
-	                          on_unix_process_child_setup, child_fds,
-	                          &pid, &input_fd, &output_fd, &error_fd, &error);
+	/* Only the program name, arguments may be sensitive */
+	program = g_path_get_basename (argv[0]);
+	span = realm_trace_begin (invocation, "command", "%s", program);
+	timeout = lookup_timeout (name ? name : program);
 
+	spawn_with_pipes (argv, env, &pid, &input_fd, &output_fd, &error_fd, &error);
 	g_strfreev (env);
 
 	res = g_simple_async_result_new (NULL, callback, user_data, realm_command_runv_async);
 	command = g_new0 (CommandClosure, 1);
 	command->input = input ? g_bytes_ref (input) : NULL;
 	command->output = g_string_sized_new (128);
+	command->output_limit = MAX (realm_settings_double ("service", "command-output-limit", 65536), 0);
 	command->invocation = invocation ? g_object_ref (invocation) : NULL;
+	command->name = g_strdup (name ? name : program);
 	g_simple_async_result_set_op_res_gpointer (res, command, command_closure_free);
+	g_free (program);
 
 	if (error) {
+		realm_trace_end (span, error);
 		g_simple_async_result_take_error (res, error);
 		g_simple_async_result_complete_in_idle (res);
 		g_object_unref (res);
@@ -492,6 +1069,11 @@ realm_command_runv_async (gchar **argv,
 	}
 
 	g_debug ("process started: %d", (int)pid);
+	set_nonblocking (input_fd);
+	set_nonblocking (output_fd);
+	set_nonblocking (error_fd);
+	command->span = span;
+	command->started = g_get_monotonic_time ();
 
 	source = g_source_new (&process_source_funcs, sizeof (ProcessSource));
 
@@ -502,6 +1084,8 @@ realm_command_runv_async (gchar **argv,
 	process_source->res = g_object_ref (res);
 	process_source->command = command;
 	process_source->child_pid = pid;
+	process_source->child_group = pid;
+	process_source->child_fd = -1;
 
 	process_source->polls[FD_INPUT].fd = input_fd;
 	if (input_fd >= 0) {
@@ -533,14 +1117,32 @@ realm_command_runv_async (gchar **argv,
 
 	/* This assumes the outstanding reference to source */
 	g_assert (process_source->child_sig == 0);
-	process_source->child_sig = g_child_watch_add_full (G_PRIORITY_DEFAULT, pid,
-	                                                    on_unix_process_child_exited,
-	                                                    g_source_ref (source),
-	                                                    (GDestroyNotify)g_source_unref);
+	process_source->child_sig = watch_child (process_source);
+
+	if (timeout > 0) {
+		process_source->timeout_id = g_timeout_add_full (G_PRIORITY_DEFAULT, timeout * 1000,
+		                                                 on_process_timeout,
+		                                                 g_source_ref (source),
+		                                                 (GDestroyNotify)g_source_unref);
+	}
 
 	/* source is unreffed in complete_if_source_is_done() */
 }
 
+void
+realm_command_runv_async (gchar **argv,
+                          gchar **environ,
+                          GBytes *input,
+                          GDBusMethodInvocation *invocation,
+                          GAsyncReadyCallback callback,
+                          gpointer user_data)
+{
+	g_return_if_fail (argv != NULL);
+	g_return_if_fail (invocation == NULL || G_IS_DBUS_METHOD_INVOCATION (invocation));
+
+	run_command (argv, environ, input, NULL, invocation, callback, user_data);
+}
+
 static gboolean
 is_only_whitespace (const gchar *string)
 {
@@ -553,6 +1155,46 @@ is_only_whitespace (const gchar *string)
 	return TRUE;
 }
 
+static void
+known_command_free (gpointer data)
+{
+	KnownCommand *known = data;
+	g_free (known->command_line);
+	g_strfreev (known->argv);
+	g_free (known);
+}
+
+static gchar **
+parse_known_command (const gchar *known_command,
+                     const gchar *command_line,
+                     GError **error)
+{
+	static GHashTable *known_commands = NULL;
+	KnownCommand *known;
+	gchar **argv;
+	gint unused;
+
+	if (known_commands == NULL) {
+		known_commands = g_hash_table_new_full (g_str_hash, g_str_equal,
+		                                        g_free, known_command_free);
+	}
+
+	/* Parsed the last time this command was run */
+	known = g_hash_table_lookup (known_commands, known_command);
+	if (known && g_str_equal (known->command_line, command_line))
+		return known->argv;
+
+	if (!g_shell_parse_argv (command_line, &unused, &argv, error))
+		return NULL;
+
+	known = g_new0 (KnownCommand, 1);
+	known->command_line = g_strdup (command_line);
+	known->argv = argv;
+	g_hash_table_replace (known_commands, g_strdup (known_command), known);
+
+	return argv;
+}
+
 void
 realm_command_run_known_async (const gchar *known_command,
                                gchar **environ,
@@ -567,7 +1209,6 @@ realm_command_run_known_async (const gchar *known_command,
 	gchar *message = NULL;
 	gint exit_code = -1;
 	gchar **argv = NULL;
-	gint unused;
 
 	g_return_if_fail (known_command != NULL);
 	g_return_if_fail (invocation == NULL || G_IS_DBUS_METHOD_INVOCATION (invocation));
@@ -582,17 +1223,18 @@ realm_command_run_known_async (const gchar *known_command,
 		message = g_strdup_printf (_("Skipped command: %s"), known_command);
 		exit_code = 0;
 
-	} else if (!g_shell_parse_argv (command_line, &unused, &argv, &error)) {
-		g_warning ("Couldn't parse the command line: %s: %s", command_line, error->message);
-		g_error_free (error);
-		message = g_strdup_printf (_("Configured command invalid: %s"), command_line);
-		exit_code = 127;
-
+	} else {
+		argv = parse_known_command (known_command, command_line, &error);
+		if (argv == NULL) {
+			g_warning ("Couldn't parse the command line: %s: %s", command_line, error->message);
+			g_error_free (error);
+			message = g_strdup_printf (_("Configured command invalid: %s"), command_line);
+			exit_code = 127;
+		}
 	}
 
 	if (message == NULL) {
-		realm_command_runv_async (argv, environ, NULL, invocation, callback, user_data);
-		g_free (argv);
+		run_command (argv, environ, NULL, known_command, invocation, callback, user_data);
 
 	} else {
 		async = g_simple_async_result_new (NULL, callback, user_data, realm_command_runv_async);
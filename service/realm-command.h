@@ -38,6 +38,10 @@ gint                realm_command_run_finish                   (GAsyncResult *re
 
 GBytes *            realm_command_build_password_line          (GBytes *password);
 
+GVariant *          realm_command_metrics_dump                 (void);
+
+void                realm_command_metrics_uninit               (void);
+
 G_END_DECLS
 
 #endif /* REALM_COMMAND_H */
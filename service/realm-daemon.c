@@ -15,17 +15,24 @@
 #include "config.h"
 
 #include "realm-all-provider.h"
+#include "realm-command.h"
 #include "realm-daemon.h"
 #include "realm-dbus-constants.h"
 #include "realm-dbus-generated.h"
 #include "realm-diagnostics.h"
+#include "realm-disco-cache.h"
+#include "realm-disco-score.h"
 #include "realm-errors.h"
 #include "realm-example-provider.h"
 #include "realm-invocation.h"
 #include "realm-kerberos-provider.h"
+#include "realm-ldap.h"
+#include "realm-network.h"
+#include "realm-prewarm.h"
 #include "realm-samba-provider.h"
 #include "realm-settings.h"
 #include "realm-sssd-provider.h"
+#include "realm-trace.h"
 
 #include <glib.h>
 #include <glib-unix.h>
@@ -208,6 +215,9 @@ initialize_service (GDBusConnection *connection)
 
 	g_dbus_object_manager_server_set_connection (object_server, connection);
 
+	/* Discover the configured realms in the background, if enabled */
+	realm_prewarm_start (connection, all_provider);
+
 	/* Use this to control the life time of the providers */
 	g_object_set_data_full (G_OBJECT (object_server), "the-provider",
 	                        all_provider, g_object_unref);
@@ -552,6 +562,13 @@ main (int argc,
 	}
 
 	g_debug ("stopping service");
+	realm_prewarm_stop ();
+	realm_ldap_pool_flush ();
+	realm_network_uninit ();
+	realm_disco_cache_uninit ();
+	realm_disco_score_uninit ();
+	realm_command_metrics_uninit ();
+	realm_trace_uninit ();
 	realm_settings_uninit ();
 	realm_invocation_cleanup ();
 	g_main_loop_unref (main_loop);
@@ -0,0 +1,525 @@
+/* realmd -- Realm configuration service
+ *
+ * Copyright 2026 The realmd contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2 of the licence or (at
+ * your option) any later version.
+ *
+ * See the included COPYING file for more information.
+ */
+
+#include "config.h"
+
+#include "realm-dbus-constants.h"
+#include "realm-disco-cache.h"
+#include "realm-settings.h"
+
+#include <gio/gio.h>
+
+#include <string.h>
+
+/*
+ * Results of successful discovery, keyed by the normalized discovery
+ * input. Discovery of the same domain is expensive (SRV, host, rootDSE
+ * and NetLogon lookups) and the results rarely change, so we keep them
+ * around for the [discovery] cache-ttl setting, and optionally across
+ * restarts of the daemon.
+ *
+ * Names that don't exist in DNS are also remembered for a while, so that
+ * repeated discovery of them doesn't hammer the DNS servers. This is
+ * bounded by the SOA minimum of the zone, like a resolver would.
+ *
+ * The whole cache is thrown away when the network configuration changes.
+ */
+
+#define CACHE_FILE  CACHEDIR "/discovery-cache"
+
+typedef struct {
+	RealmDisco *disco;
+	gint64 expires;
+} CacheEntry;
+
+typedef struct {
+	gchar *key;
+	gchar *zone;
+} MissingLookup;
+
+static GHashTable *disco_cache = NULL;
+static GHashTable *missing_cache = NULL;
+static gulong network_sig = 0;
+
+static void
+cache_entry_free (gpointer data)
+{
+	CacheEntry *entry = data;
+	realm_disco_unref (entry->disco);
+	g_free (entry);
+}
+
+static gint64
+cache_ttl (void)
+{
+	gdouble ttl;
+
+	ttl = realm_settings_double ("discovery", "cache-ttl", 300);
+	if (ttl <= 0)
+		return 0;
+
+	return ttl * G_TIME_SPAN_SECOND;
+}
+
+static gint64
+negative_ttl (void)
+{
+	gdouble ttl;
+
+	ttl = realm_settings_double ("discovery", "negative-ttl", 60);
+	if (ttl <= 0)
+		return 0;
+
+	return ttl * G_TIME_SPAN_SECOND;
+}
+
+static gboolean
+cache_persist (void)
+{
+	/* Pre-warming is only any use if the results outlive the daemon */
+	return realm_settings_boolean ("discovery", "cache-persist", FALSE) ||
+	       realm_settings_boolean ("discovery", "prewarm", FALSE);
+}
+
+static const gchar *
+intern_server_software (const gchar *value)
+{
+	if (g_strcmp0 (value, REALM_DBUS_IDENTIFIER_ACTIVE_DIRECTORY) == 0)
+		return REALM_DBUS_IDENTIFIER_ACTIVE_DIRECTORY;
+	else if (g_strcmp0 (value, REALM_DBUS_IDENTIFIER_IPA) == 0)
+		return REALM_DBUS_IDENTIFIER_IPA;
+	else
+		return NULL;
+}
+
+static void
+set_string_if (GKeyFile *key_file,
+               const gchar *group,
+               const gchar *key,
+               const gchar *value)
+{
+	if (value != NULL)
+		g_key_file_set_string (key_file, group, key, value);
+}
+
+static void
+save_cache (void)
+{
+	GHashTableIter iter;
+	GKeyFile *key_file;
+	GError *error = NULL;
+	CacheEntry *entry;
+	GInetSocketAddress *inet;
+	const gchar *group;
+	gchar *address;
+	gchar *data;
+	gsize length;
+
+	if (!cache_persist ())
+		return;
+
+	key_file = g_key_file_new ();
+
+	g_hash_table_iter_init (&iter, disco_cache);
+	while (g_hash_table_iter_next (&iter, (gpointer *)&group, (gpointer *)&entry)) {
+		g_key_file_set_int64 (key_file, group, "expires", entry->expires);
+		set_string_if (key_file, group, "domain-name", entry->disco->domain_name);
+		set_string_if (key_file, group, "kerberos-realm", entry->disco->kerberos_realm);
+		set_string_if (key_file, group, "workgroup", entry->disco->workgroup);
+		set_string_if (key_file, group, "server-software", entry->disco->server_software);
+		set_string_if (key_file, group, "explicit-server", entry->disco->explicit_server);
+		set_string_if (key_file, group, "explicit-netbios", entry->disco->explicit_netbios);
+		set_string_if (key_file, group, "dns-fqdn", entry->disco->dns_fqdn);
+		set_string_if (key_file, group, "server-name", entry->disco->server_name);
+		set_string_if (key_file, group, "server-site", entry->disco->server_site);
+		set_string_if (key_file, group, "client-site", entry->disco->client_site);
+		g_key_file_set_uint64 (key_file, group, "server-flags", entry->disco->server_flags);
+
+		if (G_IS_INET_SOCKET_ADDRESS (entry->disco->server_address)) {
+			inet = G_INET_SOCKET_ADDRESS (entry->disco->server_address);
+			address = g_inet_address_to_string (g_inet_socket_address_get_address (inet));
+			g_key_file_set_string (key_file, group, "server-address", address);
+			g_key_file_set_integer (key_file, group, "server-port",
+			                        g_inet_socket_address_get_port (inet));
+			g_free (address);
+		}
+	}
+
+	data = g_key_file_to_data (key_file, &length, NULL);
+	g_key_file_free (key_file);
+
+	g_file_set_contents (CACHE_FILE, data, length, &error);
+	if (error != NULL) {
+		g_message ("couldn't write discovery cache: %s: %s", CACHE_FILE, error->message);
+		g_error_free (error);
+	}
+
+	g_free (data);
+}
+
+static RealmDisco *
+load_disco (GKeyFile *key_file,
+            const gchar *group)
+{
+	RealmDisco *disco;
+	GInetAddress *inet;
+	gchar *software;
+	gchar *address;
+	gint port;
+
+	disco = realm_disco_new (NULL);
+	disco->domain_name = g_key_file_get_string (key_file, group, "domain-name", NULL);
+	disco->kerberos_realm = g_key_file_get_string (key_file, group, "kerberos-realm", NULL);
+	disco->workgroup = g_key_file_get_string (key_file, group, "workgroup", NULL);
+	disco->explicit_server = g_key_file_get_string (key_file, group, "explicit-server", NULL);
+	disco->explicit_netbios = g_key_file_get_string (key_file, group, "explicit-netbios", NULL);
+	disco->dns_fqdn = g_key_file_get_string (key_file, group, "dns-fqdn", NULL);
+	disco->server_name = g_key_file_get_string (key_file, group, "server-name", NULL);
+	disco->server_site = g_key_file_get_string (key_file, group, "server-site", NULL);
+	disco->client_site = g_key_file_get_string (key_file, group, "client-site", NULL);
+	disco->server_flags = g_key_file_get_uint64 (key_file, group, "server-flags", NULL);
+
+	software = g_key_file_get_string (key_file, group, "server-software", NULL);
+	disco->server_software = intern_server_software (software);
+	g_free (software);
+
+	address = g_key_file_get_string (key_file, group, "server-address", NULL);
+	port = g_key_file_get_integer (key_file, group, "server-port", NULL);
+	inet = address ? g_inet_address_new_from_string (address) : NULL;
+	if (inet != NULL) {
+		disco->server_address = g_inet_socket_address_new (inet, port);
+		g_object_unref (inet);
+	}
+	g_free (address);
+
+	/* Incomplete data, don't use it */
+	if (disco->domain_name == NULL || disco->kerberos_realm == NULL) {
+		realm_disco_unref (disco);
+		return NULL;
+	}
+
+	return disco;
+}
+
+static void
+load_cache (void)
+{
+	GKeyFile *key_file;
+	GError *error = NULL;
+	CacheEntry *entry;
+	RealmDisco *disco;
+	gchar **groups;
+	gint64 expires;
+	gint64 now;
+	gint i;
+
+	if (!cache_persist ())
+		return;
+
+	key_file = g_key_file_new ();
+	if (!g_key_file_load_from_file (key_file, CACHE_FILE, G_KEY_FILE_NONE, &error)) {
+		if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+			g_message ("couldn't load discovery cache: %s: %s", CACHE_FILE, error->message);
+		g_error_free (error);
+		g_key_file_free (key_file);
+		return;
+	}
+
+	now = g_get_real_time ();
+	groups = g_key_file_get_groups (key_file, NULL);
+	for (i = 0; groups[i] != NULL; i++) {
+		expires = g_key_file_get_int64 (key_file, groups[i], "expires", NULL);
+		if (expires <= now)
+			continue;
+
+		/* Never trust an expiry further out than what is configured */
+		if (expires > now + cache_ttl ())
+			expires = now + cache_ttl ();
+
+		disco = load_disco (key_file, groups[i]);
+		if (disco == NULL)
+			continue;
+
+		entry = g_new0 (CacheEntry, 1);
+		entry->disco = disco;
+		entry->expires = expires;
+		g_hash_table_replace (disco_cache, g_strdup (groups[i]), entry);
+	}
+
+	g_debug ("Loaded %u cached discovery results", g_hash_table_size (disco_cache));
+
+	g_strfreev (groups);
+	g_key_file_free (key_file);
+}
+
+static void
+on_network_changed (GNetworkMonitor *monitor,
+                    gboolean available,
+                    gpointer user_data)
+{
+	if ((disco_cache == NULL || g_hash_table_size (disco_cache) == 0) &&
+	    (missing_cache == NULL || g_hash_table_size (missing_cache) == 0))
+		return;
+
+	g_debug ("Network changed, flushing discovery cache");
+	realm_disco_cache_flush ();
+}
+
+static void
+watch_network (void)
+{
+	if (network_sig == 0) {
+		network_sig = g_signal_connect (g_network_monitor_get_default (), "network-changed",
+		                                G_CALLBACK (on_network_changed), NULL);
+	}
+}
+
+static gboolean
+cache_prepare (void)
+{
+	if (cache_ttl () == 0)
+		return FALSE;
+
+	if (disco_cache == NULL) {
+		disco_cache = g_hash_table_new_full (g_str_hash, g_str_equal,
+		                                     g_free, cache_entry_free);
+		watch_network ();
+		load_cache ();
+	}
+
+	return TRUE;
+}
+
+static gboolean
+missing_prepare (void)
+{
+	if (negative_ttl () == 0)
+		return FALSE;
+
+	if (missing_cache == NULL) {
+		missing_cache = g_hash_table_new_full (g_str_hash, g_str_equal,
+		                                       g_free, g_free);
+		watch_network ();
+	}
+
+	return TRUE;
+}
+
+gchar *
+realm_disco_cache_key (const gchar *input)
+{
+	gchar *stripped;
+	gchar *ascii;
+	gchar *key;
+	gsize len;
+
+	g_return_val_if_fail (input != NULL, NULL);
+
+	stripped = g_strstrip (g_strdup (input));
+	ascii = g_hostname_to_ascii (stripped);
+	key = g_ascii_strdown (ascii ? ascii : stripped, -1);
+	g_free (stripped);
+	g_free (ascii);
+
+	/* A trailing dot is the same domain */
+	len = strlen (key);
+	if (len > 1 && key[len - 1] == '.')
+		key[len - 1] = '\0';
+
+	return key;
+}
+
+RealmDisco *
+realm_disco_cache_lookup (const gchar *input)
+{
+	RealmDisco *disco = NULL;
+	CacheEntry *entry;
+	gchar *key;
+
+	g_return_val_if_fail (input != NULL, NULL);
+
+	if (!cache_prepare ())
+		return NULL;
+
+	key = realm_disco_cache_key (input);
+	entry = g_hash_table_lookup (disco_cache, key);
+
+	if (entry != NULL) {
+		if (entry->expires > g_get_real_time ())
+			disco = realm_disco_copy (entry->disco);
+		else
+			g_hash_table_remove (disco_cache, key);
+	}
+
+	g_free (key);
+	return disco;
+}
+
+void
+realm_disco_cache_store (const gchar *input,
+                         RealmDisco *disco)
+{
+	CacheEntry *entry;
+
+	g_return_if_fail (input != NULL);
+	g_return_if_fail (disco != NULL);
+
+	if (!cache_prepare ())
+		return;
+
+	/* Joins fill in guesses, so callers never share the cached disco */
+	entry = g_new0 (CacheEntry, 1);
+	entry->disco = realm_disco_copy (disco);
+	entry->expires = g_get_real_time () + cache_ttl ();
+	g_hash_table_replace (disco_cache, realm_disco_cache_key (input), entry);
+
+	save_cache ();
+}
+
+gboolean
+realm_disco_cache_is_missing (const gchar *name)
+{
+	gint64 *expires;
+	gboolean ret = FALSE;
+	gchar *key;
+
+	g_return_val_if_fail (name != NULL, FALSE);
+
+	if (!missing_prepare ())
+		return FALSE;
+
+	key = realm_disco_cache_key (name);
+	expires = g_hash_table_lookup (missing_cache, key);
+
+	if (expires != NULL) {
+		if (*expires > g_get_monotonic_time ())
+			ret = TRUE;
+		else
+			g_hash_table_remove (missing_cache, key);
+	}
+
+	g_free (key);
+	return ret;
+}
+
+static void
+missing_lookup_free (MissingLookup *lookup)
+{
+	g_free (lookup->key);
+	g_free (lookup->zone);
+	g_free (lookup);
+}
+
+static void
+on_missing_soa (GObject *source,
+                GAsyncResult *result,
+                gpointer user_data)
+{
+	MissingLookup *lookup = user_data;
+	GResolver *resolver = G_RESOLVER (source);
+	GError *error = NULL;
+	GList *records;
+	guint32 minimum;
+	gint64 *expires;
+	gint64 ttl;
+	gchar *dot;
+	gchar *parent;
+
+	records = g_resolver_lookup_records_finish (resolver, result, &error);
+
+	if (records != NULL) {
+		g_variant_get (records->data, "(ssuuuuu)", NULL, NULL, NULL,
+		               NULL, NULL, NULL, &minimum);
+		g_list_free_full (records, (GDestroyNotify)g_variant_unref);
+
+		ttl = MIN (negative_ttl (), (gint64)minimum * G_TIME_SPAN_SECOND);
+		if (ttl > 0 && missing_prepare ()) {
+			g_debug ("Caching absence of %s for %d seconds",
+			         lookup->key, (gint)(ttl / G_TIME_SPAN_SECOND));
+			expires = g_new (gint64, 1);
+			*expires = g_get_monotonic_time () + ttl;
+			g_hash_table_replace (missing_cache, lookup->key, expires);
+			lookup->key = NULL;
+		}
+
+	/* Not the apex of a zone, try the parent, but never the root or a TLD */
+	} else if (g_error_matches (error, G_RESOLVER_ERROR, G_RESOLVER_ERROR_NOT_FOUND) &&
+	           (dot = strchr (lookup->zone, '.')) != NULL && strchr (dot + 1, '.') != NULL) {
+		parent = g_strdup (dot + 1);
+		g_free (lookup->zone);
+		lookup->zone = parent;
+		g_resolver_lookup_records_async (resolver, lookup->zone, G_RESOLVER_RECORD_SOA,
+		                                 NULL, on_missing_soa, lookup);
+		lookup = NULL;
+
+	/* Without the SOA we don't know how long to cache for, so we don't */
+	} else if (error != NULL) {
+		g_debug ("Couldn't lookup SOA for %s: %s", lookup->zone, error->message);
+	}
+
+	g_clear_error (&error);
+	if (lookup)
+		missing_lookup_free (lookup);
+}
+
+void
+realm_disco_cache_store_missing (const gchar *name,
+                                 const gchar *domain)
+{
+	MissingLookup *lookup;
+	GResolver *resolver;
+
+	g_return_if_fail (name != NULL);
+	g_return_if_fail (domain != NULL);
+
+	if (!missing_prepare ())
+		return;
+
+	lookup = g_new0 (MissingLookup, 1);
+	lookup->key = realm_disco_cache_key (name);
+	lookup->zone = realm_disco_cache_key (domain);
+
+	/* Find the SOA of the closest enclosing zone */
+	resolver = g_resolver_get_default ();
+	g_resolver_lookup_records_async (resolver, lookup->zone, G_RESOLVER_RECORD_SOA,
+	                                 NULL, on_missing_soa, lookup);
+	g_object_unref (resolver);
+}
+
+void
+realm_disco_cache_flush (void)
+{
+	if (missing_cache != NULL)
+		g_hash_table_remove_all (missing_cache);
+
+	if (disco_cache == NULL)
+		return;
+
+	g_hash_table_remove_all (disco_cache);
+	save_cache ();
+}
+
+void
+realm_disco_cache_uninit (void)
+{
+	if (network_sig != 0)
+		g_signal_handler_disconnect (g_network_monitor_get_default (), network_sig);
+	network_sig = 0;
+
+	if (missing_cache != NULL)
+		g_hash_table_destroy (missing_cache);
+	missing_cache = NULL;
+
+	if (disco_cache != NULL)
+		g_hash_table_destroy (disco_cache);
+	disco_cache = NULL;
+}
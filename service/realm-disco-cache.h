@@ -0,0 +1,42 @@
+/* realmd -- Realm configuration service
+ *
+ * Copyright 2026 The realmd contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2 of the licence or (at
+ * your option) any later version.
+ *
+ * See the included COPYING file for more information.
+ */
+
+#include "config.h"
+
+#ifndef __REALM_DISCO_CACHE_H__
+#define __REALM_DISCO_CACHE_H__
+
+#include "realm-disco.h"
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+gchar *         realm_disco_cache_key           (const gchar *input);
+
+RealmDisco *    realm_disco_cache_lookup        (const gchar *input);
+
+void            realm_disco_cache_store         (const gchar *input,
+                                                 RealmDisco *disco);
+
+gboolean        realm_disco_cache_is_missing    (const gchar *name);
+
+void            realm_disco_cache_store_missing (const gchar *name,
+                                                 const gchar *domain);
+
+void            realm_disco_cache_flush         (void);
+
+void            realm_disco_cache_uninit        (void);
+
+G_END_DECLS
+
+#endif /* __REALM_DISCO_CACHE_H__ */
@@ -15,7 +15,13 @@
 #include "config.h"
 
 #include "realm-diagnostics.h"
+#include "realm-disco-cache.h"
 #include "realm-disco-dns.h"
+#include "realm-disco-records.h"
+#include "realm-disco-score.h"
+#include "realm-disco-srv.h"
+#include "realm-settings.h"
+#include "realm-trace.h"
 
 #include <glib/gi18n.h>
 
@@ -26,17 +32,54 @@ typedef enum {
 	PHASE_DONE
 } DiscoPhase;
 
+/* Maximum number of concurrent host lookups for SRV targets */
+#define MAX_RESOLVING  8
+
+typedef struct _RealmDiscoDns RealmDiscoDns;
+
+/* A single lookup that is given up on after a configured time */
 typedef struct {
+	GCancellable *cancellable;
+	GCancellable *parent;
+	gulong parent_sig;
+	guint timeout_id;
+	gboolean expired;
+} Deadline;
+
+typedef struct {
+	RealmDiscoDns *self;
+	gchar *hostname;
+	guint16 port;
+	guint16 priority;
+	GList *addresses;
+	gboolean resolved;
+	Deadline deadline;
+	RealmTraceSpan *span;
+} Target;
+
+struct _RealmDiscoDns {
 	GSocketAddressEnumerator parent;
 	gchar *name;
 	GQueue addresses;
-	GQueue targets;
-	gint current_port;
+	guint group_length;
+	guint16 group_priority;
+	GPtrArray *targets;
+	guint next_target;
+	guint next_resolve;
+	gint resolving;
 	gint returned;
+	GQueue pending;
+	GError *error;
 	DiscoPhase phase;
+	gboolean srv_only;
+	gboolean not_missing;
+	Deadline srv_deadline;
+	RealmTraceSpan *srv_span;
 	GResolver *resolver;
+	RealmDiscoRecords *records;
+	GCancellable *cancellable;
 	GDBusMethodInvocation *invocation;
-} RealmDiscoDns;
+};
 
 typedef struct {
 	GSocketAddressEnumeratorClass parent;
@@ -46,17 +89,90 @@ typedef struct {
 #define REALM_DISCO_DNS(inst)     (G_TYPE_CHECK_INSTANCE_CAST ((inst), REALM_TYPE_DISCO_DNS, RealmDiscoDns))
 #define REALM_IS_DISCO_DNS(inst)  (G_TYPE_CHECK_INSTANCE_TYPE ((inst), REALM_TYPE_DISCO_DNS))
 
-static void return_or_resolve (RealmDiscoDns *self, GTask *task);
+static void process_lookups (RealmDiscoDns *self);
 
 GType realm_disco_dns_get_type (void) G_GNUC_CONST;
 
 G_DEFINE_TYPE (RealmDiscoDns, realm_disco_dns, G_TYPE_SOCKET_ADDRESS_ENUMERATOR);
 
+static void
+on_deadline_parent (GCancellable *parent,
+                    gpointer user_data)
+{
+	g_cancellable_cancel (user_data);
+}
+
+static gboolean
+on_deadline (gpointer user_data)
+{
+	Deadline *deadline = user_data;
+
+	deadline->timeout_id = 0;
+	deadline->expired = TRUE;
+	g_cancellable_cancel (deadline->cancellable);
+	return FALSE;
+}
+
+static GCancellable *
+deadline_start (Deadline *deadline,
+                GCancellable *parent,
+                const gchar *setting)
+{
+	gdouble timeout;
+
+	deadline->cancellable = g_cancellable_new ();
+	if (parent) {
+		deadline->parent = g_object_ref (parent);
+		deadline->parent_sig = g_cancellable_connect (parent, G_CALLBACK (on_deadline_parent),
+		                                              deadline->cancellable, NULL);
+	}
+
+	timeout = realm_settings_double ("discovery", setting, 5);
+	if (timeout > 0)
+		deadline->timeout_id = g_timeout_add (timeout * 1000, on_deadline, deadline);
+
+	return deadline->cancellable;
+}
+
+static void
+deadline_finish (Deadline *deadline,
+                 GError **error,
+                 const gchar *name)
+{
+	/* Ran out of time, rather than the caller going away */
+	if (deadline->expired && g_error_matches (*error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+		g_clear_error (error);
+		g_set_error (error, G_RESOLVER_ERROR, G_RESOLVER_ERROR_TEMPORARY_FAILURE,
+		             "Timed out looking up %s", name);
+	}
+
+	if (deadline->timeout_id)
+		g_source_remove (deadline->timeout_id);
+	deadline->timeout_id = 0;
+	if (deadline->parent) {
+		g_cancellable_disconnect (deadline->parent, deadline->parent_sig);
+		g_object_unref (deadline->parent);
+		deadline->parent = NULL;
+	}
+	g_clear_object (&deadline->cancellable);
+}
+
+static void
+target_free (gpointer data)
+{
+	Target *target = data;
+	g_assert (target->deadline.cancellable == NULL);
+	g_free (target->hostname);
+	g_list_free_full (target->addresses, g_object_unref);
+	g_free (target);
+}
+
 static void
 realm_disco_dns_init (RealmDiscoDns *self)
 {
 	g_queue_init (&self->addresses);
-	g_queue_init (&self->targets);
+	g_queue_init (&self->pending);
+	self->targets = g_ptr_array_new_with_free_func (target_free);
 }
 
 static void
@@ -66,8 +182,12 @@ realm_disco_dns_finalize (GObject *obj)
 	gpointer value;
 
 	g_free (self->name);
-	g_object_unref (self->invocation);
+	g_clear_object (&self->invocation);
 	g_clear_object (&self->resolver);
+	realm_disco_records_unref (self->records);
+	g_clear_object (&self->cancellable);
+	g_clear_error (&self->error);
+	g_ptr_array_free (self->targets, TRUE);
 
 	for (;;) {
 		value = g_queue_pop_head (&self->addresses);
@@ -76,12 +196,8 @@ realm_disco_dns_finalize (GObject *obj)
 		g_object_unref (value);
 	}
 
-	for (;;) {
-		value = g_queue_pop_head (&self->targets);
-		if (!value)
-			break;
-		g_srv_target_free (value);
-	}
+	/* Each pending task holds a reference to us */
+	g_assert (g_queue_is_empty (&self->pending));
 
 	G_OBJECT_CLASS (realm_disco_dns_parent_class)->finalize (obj);
 }
@@ -95,123 +211,362 @@ realm_disco_dns_next (GSocketAddressEnumerator *enumerator,
 	g_return_val_if_reached (NULL);
 }
 
+static void
+add_target (RealmDiscoDns *self,
+            const gchar *hostname,
+            guint16 port,
+            guint16 priority)
+{
+	Target *target;
+
+	target = g_new0 (Target, 1);
+	target->self = self;
+	target->hostname = g_strdup (hostname);
+	target->port = port;
+	target->priority = priority;
+	g_ptr_array_add (self->targets, target);
+}
+
+static void
+add_resolved_target (RealmDiscoDns *self,
+                     RealmDiscoRecords *records)
+{
+	Target *target;
+
+	target = self->targets->pdata[self->targets->len - 1];
+	target->addresses = g_list_copy (records->addresses);
+	g_list_foreach (target->addresses, (GFunc)g_object_ref, NULL);
+	target->resolved = TRUE;
+
+	if (records->host_error) {
+		g_debug ("%s", records->host_error->message);
+		if (!g_error_matches (records->host_error, G_RESOLVER_ERROR, G_RESOLVER_ERROR_NOT_FOUND))
+			self->not_missing = TRUE;
+	}
+}
+
 static void
 on_name_resolved (GObject *source,
                   GAsyncResult *result,
                   gpointer user_data)
 {
-	GTask *task = G_TASK (user_data);
-	RealmDiscoDns *self = g_task_get_source_object (task);
+	Target *target = user_data;
+	RealmDiscoDns *self = target->self;
 	GError *error = NULL;
-	GList *addrs;
-	GList *l;
 
-	addrs = g_resolver_lookup_by_name_finish (self->resolver, result, &error);
+	target->addresses = g_resolver_lookup_by_name_finish (self->resolver, result, &error);
+	deadline_finish (&target->deadline, &error, target->hostname);
+	realm_trace_end (target->span, error);
+	target->span = NULL;
+
+	/*
+	 * Failing to resolve one of the servers is not fatal, the others
+	 * may still work. So just treat it as an absence of addresses.
+	 */
+	if (error) {
+		g_debug ("%s", error->message);
+		if (!g_error_matches (error, G_RESOLVER_ERROR, G_RESOLVER_ERROR_NOT_FOUND))
+			self->not_missing = TRUE;
+		g_error_free (error);
+	}
+
+	target->resolved = TRUE;
+	self->resolving--;
+
+	process_lookups (self);
+	g_object_unref (self);
+}
+
+static void
+add_service_targets (RealmDiscoDns *self,
+                     GList *targets,
+                     GHashTable *glue,
+                     GError *error)
+{
+	Target *target;
+	GList *l;
 
 	if (error)
 		g_debug ("%s", error->message);
 
+	/* Only a definite answer that the name doesn't exist can be cached */
+	if (targets != NULL || !g_error_matches (error, G_RESOLVER_ERROR, G_RESOLVER_ERROR_NOT_FOUND))
+		self->not_missing = TRUE;
+
 	/* These are not real errors, just absence of addresses */
 	if (g_error_matches (error, G_RESOLVER_ERROR, G_RESOLVER_ERROR_NOT_FOUND) ||
 	    g_error_matches (error, G_RESOLVER_ERROR, G_RESOLVER_ERROR_TEMPORARY_FAILURE))
 		g_clear_error (&error);
 
-	if (error) {
-		g_task_return_error (task, error);
-
-	} else {
-		for (l = addrs; l != NULL; l = g_list_next (l))
-			g_queue_push_head (&self->addresses, g_inet_socket_address_new (l->data, self->current_port));
-		g_list_free_full (addrs, g_object_unref);
-		return_or_resolve (self, task);
+	/* Already sorted by priority and weight */
+	for (l = targets; l != NULL; l = g_list_next (l)) {
+		add_target (self, g_srv_target_get_hostname (l->data),
+		            g_srv_target_get_port (l->data),
+		            g_srv_target_get_priority (l->data));
+
+		/* No need to look up servers whose addresses came with the SRV response */
+		target = self->targets->pdata[self->targets->len - 1];
+		target->addresses = realm_disco_srv_glue_lookup (glue, target->hostname);
+		if (target->addresses) {
+			g_debug ("Using addresses from SRV response for: %s", target->hostname);
+			target->resolved = TRUE;
+		}
 	}
 
-	g_object_unref (task);
+	if (error) {
+		self->error = error;
+		self->phase = PHASE_DONE;
+	}
 }
 
-
 static void
 on_service_resolved (GObject *source,
                      GAsyncResult *result,
                      gpointer user_data)
 {
-	GTask *task = G_TASK (user_data);
-	RealmDiscoDns *self = g_task_get_source_object (task);
+	RealmDiscoDns *self = REALM_DISCO_DNS (user_data);
 	GError *error = NULL;
+	GHashTable *glue = NULL;
 	GList *targets;
-	GList *l;
+	gchar *name;
 
-	targets = g_resolver_lookup_service_finish (self->resolver, result, &error);
+	targets = realm_disco_srv_finish (result, &glue, &error);
+	name = g_strdup_printf ("_ldap._tcp.%s", self->name);
+	deadline_finish (&self->srv_deadline, &error, name);
+	g_free (name);
+	realm_trace_end (self->srv_span, error);
+	self->srv_span = NULL;
+	add_service_targets (self, targets, glue, error);
+	g_list_free_full (targets, (GDestroyNotify)g_srv_target_free);
+	if (glue)
+		g_hash_table_unref (glue);
+
+	self->resolving--;
+
+	process_lookups (self);
+	g_object_unref (self);
+}
 
-	if (error)
-		g_debug ("%s", error->message);
+static void
+on_records_resolved (GObject *source,
+                     GAsyncResult *result,
+                     gpointer user_data)
+{
+	RealmDiscoDns *self = REALM_DISCO_DNS (user_data);
+	GError *error = NULL;
 
-	/* These are not real errors, just absence of addresses */
-	if (g_error_matches (error, G_RESOLVER_ERROR, G_RESOLVER_ERROR_NOT_FOUND) ||
-	    g_error_matches (error, G_RESOLVER_ERROR, G_RESOLVER_ERROR_TEMPORARY_FAILURE))
-		g_clear_error (&error);
+	self->records = realm_disco_records_finish (result, &error);
+	realm_trace_end (self->srv_span, error ? error : self->records->ldap_error);
+	self->srv_span = NULL;
 
 	if (error) {
-		g_task_return_error (task, error);
-
+		self->error = error;
+		self->phase = PHASE_DONE;
 	} else {
-		for (l = targets; l != NULL; l = g_list_next (l))
-			g_queue_push_tail (&self->targets, l->data);
-		g_list_free (targets);
-		return_or_resolve (self, task);
+		add_service_targets (self, self->records->ldap_targets,
+		                     self->records->ldap_glue,
+		                     self->records->ldap_error ?
+		                             g_error_copy (self->records->ldap_error) : NULL);
 	}
 
-	g_object_unref (task);
+	self->resolving--;
+
+	process_lookups (self);
+	g_object_unref (self);
 }
 
 static void
-return_or_resolve (RealmDiscoDns *self,
-                   GTask *task)
+return_pending (RealmDiscoDns *self)
 {
 	GSocketAddress *address;
-	GSrvTarget *target;
+	GTask *task;
+
+	while (!g_queue_is_empty (&self->pending)) {
+		if (self->error) {
+			task = g_queue_pop_head (&self->pending);
+			g_task_return_error (task, g_error_copy (self->error));
+
+		} else {
+			address = g_queue_pop_head (&self->addresses);
+			if (address == NULL && self->phase != PHASE_DONE)
+				break;
+
+			task = g_queue_pop_head (&self->pending);
+			if (address)
+				self->returned++;
+			g_task_return_pointer (task, address, address ? g_object_unref : NULL);
+		}
+
+		g_object_unref (task);
+	}
+}
 
-	address = g_queue_pop_head (&self->addresses);
-	if (address) {
-		self->returned++;
-		g_task_return_pointer (task, address, g_object_unref);
-		return;
+static GList *
+interleave_families (GList *addresses)
+{
+	GList *preferred = NULL;
+	GList *other = NULL;
+	GList *result = NULL;
+	GSocketFamily family;
+	GList *l;
+
+	if (addresses == NULL)
+		return NULL;
+
+	/* The resolver puts the preferred address family first */
+	family = g_inet_address_get_family (addresses->data);
+	for (l = addresses; l != NULL; l = g_list_next (l)) {
+		if (g_inet_address_get_family (l->data) == family)
+			preferred = g_list_prepend (preferred, l->data);
+		else
+			other = g_list_prepend (other, l->data);
+	}
+	g_list_free (addresses);
+
+	preferred = g_list_reverse (preferred);
+	other = g_list_reverse (other);
+
+	/* Alternate IPv6 and IPv4, so a broken family doesn't stall us */
+	while (preferred || other) {
+		if (preferred) {
+			result = g_list_prepend (result, preferred->data);
+			preferred = g_list_delete_link (preferred, preferred);
+		}
+		if (other) {
+			result = g_list_prepend (result, other->data);
+			other = g_list_delete_link (other, other);
+		}
 	}
 
-	target = g_queue_pop_head (&self->targets);
-	if (target) {
-		self->current_port = g_srv_target_get_port (target);
-		g_resolver_lookup_by_name_async (self->resolver, g_srv_target_get_hostname (target),
-		                                 g_task_get_cancellable (task), on_name_resolved,
-		                                 g_object_ref (task));
-		g_srv_target_free (target);
-		return;
+	return g_list_reverse (result);
+}
+
+static void
+collect_addresses (RealmDiscoDns *self)
+{
+	GQueue group = G_QUEUE_INIT;
+	Target *target;
+	GList *l;
+	guint i;
+
+	/*
+	 * Lookups complete in any order, but addresses are returned in the
+	 * order of the targets. Only the targets at the front whose lookups
+	 * have completed are ready.
+	 */
+	while (self->next_target < self->targets->len) {
+		target = self->targets->pdata[self->next_target];
+		if (!target->resolved)
+			break;
+
+		/*
+		 * The SRV priority order stands. Among queued addresses of the
+		 * same priority, known fast and healthy servers go first and
+		 * failing ones last.
+		 */
+		if (target->priority != self->group_priority)
+			self->group_length = 0;
+		self->group_priority = target->priority;
+		self->group_length = MIN (self->group_length, self->addresses.length);
+
+		for (i = 0; i < self->group_length; i++)
+			g_queue_push_head (&group, g_queue_pop_tail (&self->addresses));
+
+		target->addresses = interleave_families (target->addresses);
+		for (l = target->addresses; l != NULL; l = g_list_next (l))
+			g_queue_push_tail (&group, g_inet_socket_address_new (l->data, target->port));
+
+		g_list_free_full (target->addresses, g_object_unref);
+		target->addresses = NULL;
+		self->next_target++;
+
+		self->group_length = group.length;
+		group.head = realm_disco_score_order (group.head);
+		for (l = group.head; l != NULL; l = g_list_next (l))
+			g_queue_push_tail (&self->addresses, l->data);
+		g_queue_clear (&group);
 	}
+}
+
+static void
+start_lookups (RealmDiscoDns *self)
+{
+	Target *target;
+
+	while (self->resolving < MAX_RESOLVING &&
+	       self->next_resolve < self->targets->len) {
+		target = self->targets->pdata[self->next_resolve++];
+		if (target->resolved)
+			continue;
+		target->span = realm_trace_begin (self->invocation, "dns", "%s", target->hostname);
+		g_resolver_lookup_by_name_async (self->resolver, target->hostname,
+		                                 deadline_start (&target->deadline, self->cancellable,
+		                                                 "host-timeout"),
+		                                 on_name_resolved, g_object_ref (self));
+		self->resolving++;
+	}
+}
+
+static void
+process_lookups (RealmDiscoDns *self)
+{
+	for (;;) {
+		collect_addresses (self);
+		start_lookups (self);
+
+		/* Still waiting on something, or have addresses to return */
+		if (self->resolving > 0 || !g_queue_is_empty (&self->addresses) ||
+		    self->next_target < self->targets->len || self->phase == PHASE_DONE)
+			break;
+
+		/* Nothing to do until someone asks */
+		if (g_queue_is_empty (&self->pending))
+			break;
+
+		switch (self->returned > 0 ? PHASE_DONE : self->phase) {
+		case PHASE_NONE:
+			realm_diagnostics_info (self->invocation, "Resolving: _ldap._tcp.%s", self->name);
+			self->srv_span = realm_trace_begin (self->invocation, "dns", "_ldap._tcp.%s", self->name);
+			if (self->srv_only) {
+				realm_disco_srv_async ("ldap", "tcp", self->name,
+				                       deadline_start (&self->srv_deadline, self->cancellable,
+				                                       "srv-timeout"),
+				                       on_service_resolved, g_object_ref (self));
+			} else {
+				/* Shared with the other providers discovering this name */
+				realm_disco_records_async (self->name, self->cancellable,
+				                           on_records_resolved, g_object_ref (self));
+			}
+			self->resolving++;
+			self->phase = PHASE_SRV;
+			break;
+		case PHASE_SRV:
+			if (self->srv_only) {
+				self->phase = PHASE_DONE;
+				break;
+			}
+			realm_diagnostics_info (self->invocation, "Resolving: %s", self->name);
+			add_target (self, self->name, 389, 0);
+			self->phase = PHASE_HOST;
+
+			/* The host lookup was already done along with the SRV lookups */
+			if (self->records)
+				add_resolved_target (self, self->records);
+			continue;
+		case PHASE_HOST:
+			realm_diagnostics_info (self->invocation, "No results: %s", self->name);
+			if (!self->not_missing)
+				realm_disco_cache_store_missing (self->name, self->name);
+			/* fall through */
+		case PHASE_DONE:
+			self->phase = PHASE_DONE;
+			break;
+		}
 
-	switch (self->returned > 0 ? PHASE_DONE : self->phase) {
-	case PHASE_NONE:
-		realm_diagnostics_info (self->invocation, "Resolving: _ldap._tcp.%s", self->name);
-		g_resolver_lookup_service_async (self->resolver, "ldap", "tcp", self->name,
-		                                 g_task_get_cancellable (task),
-		                                 on_service_resolved, g_object_ref (task));
-		self->phase = PHASE_SRV;
-		break;
-	case PHASE_SRV:
-		realm_diagnostics_info (self->invocation, "Resolving: %s", self->name);
-		g_resolver_lookup_by_name_async (self->resolver, self->name,
-		                                 g_task_get_cancellable (task), on_name_resolved,
-		                                 g_object_ref (task));
-		self->current_port = 389;
-		self->phase = PHASE_HOST;
-		break;
-	case PHASE_HOST:
-		realm_diagnostics_info (self->invocation, "No results: %s", self->name);
-		self->phase = PHASE_DONE;
-		/* fall through */
-	case PHASE_DONE:
-		g_task_return_pointer (task, NULL, NULL);
 		break;
 	}
+
+	return_pending (self);
 }
 
 static void
@@ -223,9 +578,13 @@ realm_disco_dns_next_async (GSocketAddressEnumerator *enumerator,
 	RealmDiscoDns *self = REALM_DISCO_DNS (enumerator);
 	GTask *task;
 
+	/* Lookups are shared by all callers, so use the first cancellable */
+	if (self->cancellable == NULL && cancellable != NULL)
+		self->cancellable = g_object_ref (cancellable);
+
 	task = g_task_new (enumerator, cancellable, callback, user_data);
-	return_or_resolve (self, task);
-	g_object_unref (task);
+	g_queue_push_tail (&self->pending, task);
+	process_lookups (self);
 }
 
 static GSocketAddress *
@@ -262,7 +621,7 @@ realm_disco_dns_enumerate_servers (const gchar *domain_or_server,
 
 	self = g_object_new (REALM_TYPE_DISCO_DNS, NULL);
 	self->name = g_hostname_to_ascii (input);
-	self->invocation = g_object_ref (invocation);
+	self->invocation = invocation ? g_object_ref (invocation) : NULL;
 
 	/* If is an IP, skip resolution */
 	if (g_hostname_is_ip_address (input)) {
@@ -270,6 +629,12 @@ realm_disco_dns_enumerate_servers (const gchar *domain_or_server,
 		g_queue_push_head (&self->addresses, g_inet_socket_address_new (inet, 389));
 		g_object_unref (inet);
 		self->phase = PHASE_HOST;
+
+	/* Recently found not to exist */
+	} else if (self->name && realm_disco_cache_is_missing (self->name)) {
+		realm_diagnostics_info (invocation, "No results (cached): %s", self->name);
+		self->phase = PHASE_DONE;
+
 	} else {
 		self->resolver = g_resolver_get_default ();
 	}
@@ -278,10 +643,39 @@ realm_disco_dns_enumerate_servers (const gchar *domain_or_server,
 	return G_SOCKET_ADDRESS_ENUMERATOR (self);
 }
 
+GSocketAddressEnumerator *
+realm_disco_dns_enumerate_site_servers (const gchar *domain,
+                                        const gchar *site,
+                                        GDBusMethodInvocation *invocation)
+{
+	RealmDiscoDns *self;
+	gchar *name;
+
+	g_return_val_if_fail (domain != NULL, NULL);
+	g_return_val_if_fail (site != NULL, NULL);
+
+	/* Looks up _ldap._tcp.<site>._sites.<domain> */
+	name = g_strdup_printf ("%s._sites.%s", site, domain);
+
+	self = g_object_new (REALM_TYPE_DISCO_DNS, NULL);
+	self->name = g_hostname_to_ascii (name);
+	self->invocation = invocation ? g_object_ref (invocation) : NULL;
+	self->resolver = g_resolver_get_default ();
+	self->srv_only = TRUE;
+
+	g_free (name);
+	return G_SOCKET_ADDRESS_ENUMERATOR (self);
+}
+
 RealmDiscoDnsHint
 realm_disco_dns_get_hint (GSocketAddressEnumerator *enumerator)
 {
-	g_return_val_if_fail (REALM_IS_DISCO_DNS (enumerator), FALSE);
+	g_return_val_if_fail (G_IS_SOCKET_ADDRESS_ENUMERATOR (enumerator), 0);
+
+	/* Other enumerators only ever list domain controllers */
+	if (!REALM_IS_DISCO_DNS (enumerator))
+		return 0;
+
 	switch (REALM_DISCO_DNS (enumerator)->phase) {
 	case PHASE_HOST:
 		return REALM_DISCO_IS_SERVER;
@@ -18,13 +18,17 @@
 #include "realm-dbus-constants.h"
 #include "realm-diagnostics.h"
 #include "realm-disco.h"
+#include "realm-disco-cache.h"
 #include "realm-disco-dns.h"
+#include "realm-disco-list.h"
 #include "realm-disco-domain.h"
 #include "realm-disco-mscldap.h"
 #include "realm-disco-rootdse.h"
+#include "realm-disco-score.h"
 #include "realm-errors.h"
 #include "realm-invocation.h"
 #include "realm-network.h"
+#include "realm-settings.h"
 
 #include <glib/gi18n.h>
 
@@ -41,8 +45,13 @@ typedef struct {
 	GDBusMethodInvocation *invocation;
 	GSocketAddressEnumerator *enumerator;
 	gint outstanding;
+	gint requesting;
+	guint stagger_id;
 	gboolean completed;
+	gboolean cached;
+	gboolean site_search;
 	RealmDisco *disco;
+	RealmDisco *fallback;
 	Callback *callback;
 } RealmDiscoDomain;
 
@@ -54,11 +63,19 @@ typedef struct {
 #define REALM_DISCO_DOMAIN(inst)     (G_TYPE_CHECK_INSTANCE_CAST ((inst), REALM_TYPE_DISCO_DOMAIN, RealmDiscoDomain))
 #define REALM_IS_DISCO_DOMAIN(inst)  (G_TYPE_CHECK_INSTANCE_TYPE ((inst), REALM_TYPE_DISCO_DOMAIN))
 
+typedef struct {
+	RealmDiscoDomain *self;
+	GSocketAddress *address;
+	gint64 started;
+} Probe;
+
 static GHashTable *discover_cache = NULL;
 
 static void  step_discover  (RealmDiscoDomain *self,
                              RealmDisco *disco);
 
+static void  start_stagger  (RealmDiscoDomain *self);
+
 GType realm_disco_domain_get_type (void) G_GNUC_CONST;
 
 void  realm_disco_domain_async_result_init (GAsyncResultIface *iface);
@@ -80,9 +97,10 @@ realm_disco_domain_finalize (GObject *obj)
 
 	g_free (self->input);
 	g_object_unref (self->cancellable);
-	g_object_unref (self->invocation);
+	g_clear_object (&self->invocation);
 	g_clear_object (&self->enumerator);
 	realm_disco_unref (self->disco);
+	realm_disco_unref (self->fallback);
 
 	g_assert (self->callback == NULL);
 	G_OBJECT_CLASS (realm_disco_domain_parent_class)->finalize (obj);
@@ -125,19 +143,30 @@ complete_discover (RealmDiscoDomain *self)
 	self->completed = TRUE;
 
 	/* No longer in the concurrency cache */
-	g_hash_table_remove (discover_cache, self->input);
-	if (g_hash_table_size (discover_cache) == 0)
-		g_hash_table_destroy (discover_cache);
-	discover_cache = NULL;
+	if (discover_cache && g_hash_table_lookup (discover_cache, self->input) == self) {
+		g_hash_table_remove (discover_cache, self->input);
+		if (g_hash_table_size (discover_cache) == 0) {
+			g_hash_table_destroy (discover_cache);
+			discover_cache = NULL;
+		}
+	}
 
 	/* Stop all other results */
 	g_cancellable_cancel (self->cancellable);
+	if (self->stagger_id)
+		g_source_remove (self->stagger_id);
+	self->stagger_id = 0;
 
 	call = self->callback;
 	self->callback = NULL;
 
-	if (self->disco)
+	if (self->disco && self->cached) {
+		realm_diagnostics_info (self->invocation, "Using cached discovery: %s", self->disco->domain_name);
+
+	} else if (self->disco) {
 		realm_diagnostics_info (self->invocation, "Successfully discovered: %s", self->disco->domain_name);
+		realm_disco_cache_store (self->input, self->disco);
+	}
 
 	while (call != NULL) {
 		next = call->next;
@@ -153,18 +182,33 @@ on_discover_rootdse (GObject *source,
                      GAsyncResult *result,
                      gpointer user_data)
 {
-	RealmDiscoDomain *self = REALM_DISCO_DOMAIN (user_data);
+	Probe *probe = user_data;
+	RealmDiscoDomain *self = probe->self;
 	GError *error = NULL;
 	RealmDisco *disco;
 
 	self->outstanding--;
 	disco = realm_disco_rootdse_finish (result, &error);
 
+	/* Probes cut short because we're done say nothing about the server */
+	if (disco != NULL)
+		realm_disco_score_success (probe->address, disco, g_get_monotonic_time () - probe->started);
+	else if (!g_cancellable_is_cancelled (self->cancellable))
+		realm_disco_score_failure (probe->address);
+
 	if (error && !self->completed)
 		realm_diagnostics_error (self->invocation, error, NULL);
 	g_clear_error (&error);
+
+	/* A failed probe makes way for the next one right away */
+	if (disco == NULL && self->stagger_id) {
+		g_source_remove (self->stagger_id);
+		self->stagger_id = 0;
+	}
 	step_discover (self, disco);
 
+	g_object_unref (probe->address);
+	g_free (probe);
 	g_object_unref (self);
 }
 
@@ -180,13 +224,23 @@ on_discover_next_address (GObject *source,
 	GInetSocketAddress *inet;
 	const gchar *explicit_host;
 	RealmDiscoDnsHint hint;
+	Probe *probe;
 	gchar *string;
 
+	self->requesting--;
+
 	if (self->completed) {
 		g_object_unref (self);
 		return;
 	}
 
+	/* Replaced by the site specific enumerator, ignore the address */
+	if (enumerator != self->enumerator) {
+		step_discover (self, NULL);
+		g_object_unref (self);
+		return;
+	}
+
 	address = g_socket_address_enumerator_next_finish (enumerator, result, &error);
 	if (error != NULL || address == NULL) {
 		if (error && !self->completed && !g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
@@ -205,11 +259,18 @@ on_discover_next_address (GObject *source,
 			explicit_host = NULL;
 
 		realm_diagnostics_info (self->invocation, "Performing LDAP DSE lookup on: %s", string);
+		probe = g_new0 (Probe, 1);
+		probe->self = g_object_ref (self);
+		probe->address = g_object_ref (address);
+		probe->started = g_get_monotonic_time ();
+
 		realm_disco_rootdse_async (address, explicit_host,
 		                           self->invocation, self->cancellable,
-		                           on_discover_rootdse, g_object_ref (self));
+		                           on_discover_rootdse, probe);
 		self->outstanding++;
 		g_free (string);
+
+		start_stagger (self);
 	}
 
 	step_discover (self, NULL);
@@ -217,6 +278,78 @@ on_discover_next_address (GObject *source,
 	g_object_unref (self);
 }
 
+static gboolean
+is_preferred_server (RealmDisco *disco)
+{
+	guint32 want = REALM_DISCO_DS_CLOSEST | REALM_DISCO_DS_WRITABLE;
+
+	/* Only Active Directory tells us about sites */
+	if (disco->server_software != REALM_DBUS_IDENTIFIER_ACTIVE_DIRECTORY ||
+	    disco->client_site == NULL)
+		return TRUE;
+
+	/* Don't second guess a server that was explicitly asked for */
+	if (disco->explicit_server)
+		return TRUE;
+
+	return (disco->server_flags & want) == want;
+}
+
+static gboolean
+on_probe_stagger (gpointer user_data)
+{
+	RealmDiscoDomain *self = REALM_DISCO_DOMAIN (user_data);
+
+	self->stagger_id = 0;
+	step_discover (self, NULL);
+	return FALSE;
+}
+
+static void
+start_stagger (RealmDiscoDomain *self)
+{
+	gdouble interval;
+
+	if (self->stagger_id || self->completed)
+		return;
+
+	interval = realm_settings_double ("discovery", "probe-interval", 0.25);
+	if (interval <= 0)
+		return;
+
+	self->stagger_id = g_timeout_add_full (G_PRIORITY_DEFAULT, interval * 1000,
+	                                       on_probe_stagger, g_object_ref (self),
+	                                       g_object_unref);
+}
+
+static void
+schedule_probes (RealmDiscoDomain *self)
+{
+	gdouble max;
+
+	/* One address at a time, the enumerator gives them out in order */
+	if (!self->enumerator || self->requesting > 0)
+		return;
+
+	max = realm_settings_double ("discovery", "max-probes", 5);
+	if (self->outstanding >= MAX (max, 1))
+		return;
+
+	/*
+	 * Happy eyeballs: while earlier probes are still pending start
+	 * another one every probe-interval, rather than waiting on servers
+	 * that may never answer.
+	 */
+	if (self->outstanding > 0 && self->stagger_id)
+		return;
+
+	self->requesting++;
+	g_socket_address_enumerator_next_async (self->enumerator,
+	                                        self->cancellable,
+	                                        on_discover_next_address,
+	                                        g_object_ref (self));
+}
+
 static void
 step_discover (RealmDiscoDomain *self,
                RealmDisco *disco)
@@ -225,20 +358,52 @@ step_discover (RealmDiscoDomain *self,
 	if (self->completed) {
 		realm_disco_unref (disco);
 
+	/*
+	 * The server is in another site, or read-only. Look for domain
+	 * controllers in our own site, since that's who we should join
+	 * against. Fall back to this result if none are found.
+	 */
+	} else if (disco && !self->site_search && !is_preferred_server (disco)) {
+		realm_diagnostics_info (self->invocation, "Searching for domain controllers in site: %s",
+		                        disco->client_site);
+		self->site_search = TRUE;
+		self->fallback = disco;
+		g_clear_object (&self->enumerator);
+		self->enumerator = realm_disco_dns_enumerate_site_servers (disco->domain_name,
+		                                                           disco->client_site,
+		                                                           self->invocation);
+		step_discover (self, NULL);
+
+	/* A server outside of our site, keep looking, but remember the first one */
+	} else if (disco && !is_preferred_server (disco)) {
+		if (self->fallback == NULL)
+			self->fallback = disco;
+		else
+			realm_disco_unref (disco);
+		step_discover (self, NULL);
+
 	/* Either have a result, or finished searching: done */
 	} else if (disco || (self->enumerator == NULL && self->outstanding == 0)) {
+		if (disco == NULL) {
+			disco = self->fallback;
+			self->fallback = NULL;
+		}
 		self->disco = disco;
 		complete_discover (self);
 
-	/* Otherwise try up to three servers at once */
-	} else if (self->enumerator && self->outstanding < 3) {
-		g_socket_address_enumerator_next_async (self->enumerator,
-		                                        self->cancellable,
-		                                        on_discover_next_address,
-		                                        g_object_ref (self));
+	/* Otherwise try more servers */
+	} else {
+		schedule_probes (self);
 	}
 }
 
+static gboolean
+on_idle_complete_cached (gpointer user_data)
+{
+	complete_discover (user_data);
+	return FALSE;
+}
+
 static void
 on_cancel_propagate (GCancellable *source,
                      gpointer dest)
@@ -254,7 +419,9 @@ realm_disco_domain_async (const gchar *string,
 {
 	RealmDiscoDomain *self;
 	GCancellable *cancellable;
+	RealmDisco *disco;
 	Callback *call;
+	gchar *key;
 
 	g_return_if_fail (string != NULL);
 	g_return_if_fail (invocation == NULL || G_IS_DBUS_METHOD_INVOCATION (invocation));
@@ -262,18 +429,41 @@ realm_disco_domain_async (const gchar *string,
 	if (!discover_cache)
 		discover_cache = g_hash_table_new (g_str_hash, g_str_equal);
 
-	self = g_hash_table_lookup (discover_cache, string);
+	key = realm_disco_cache_key (string);
+	self = g_hash_table_lookup (discover_cache, key);
+	disco = self ? NULL : realm_disco_cache_lookup (key);
 
-	if (self == NULL) {
+	/* A previous discovery result that's still valid */
+	if (disco != NULL) {
 		self = g_object_new (REALM_TYPE_DISCO_DOMAIN, NULL);
-		self->input = g_strdup (string);
-		self->invocation = g_object_ref (invocation);
-		self->enumerator = realm_disco_dns_enumerate_servers (string, invocation);
+		self->input = key;
+		self->invocation = invocation ? g_object_ref (invocation) : NULL;
+		self->disco = disco;
+		self->cached = TRUE;
+		g_idle_add_full (G_PRIORITY_DEFAULT, on_idle_complete_cached,
+		                 g_object_ref (self), g_object_unref);
+
+	} else if (self == NULL) {
+		self = g_object_new (REALM_TYPE_DISCO_DOMAIN, NULL);
+		self->input = key;
+		self->invocation = invocation ? g_object_ref (invocation) : NULL;
+		self->enumerator = realm_disco_list_enumerate_servers (string);
+
+		/*
+		 * Domain controllers listed in realmd.conf are all there is, so
+		 * don't go looking in DNS for the ones in our site either.
+		 */
+		if (self->enumerator) {
+			realm_diagnostics_info (invocation, "Using domain controllers from realmd.conf for: %s", string);
+			self->site_search = TRUE;
+		} else {
+			self->enumerator = realm_disco_dns_enumerate_servers (string, invocation);
+		}
 
 		g_hash_table_insert (discover_cache, self->input, self);
 		g_assert (!self->completed);
 
-		cancellable = realm_invocation_get_cancellable (invocation);
+		cancellable = invocation ? realm_invocation_get_cancellable (invocation) : NULL;
 		if (cancellable) {
 			g_cancellable_connect (cancellable, (GCallback)on_cancel_propagate,
 			                       g_object_ref (self->cancellable), g_object_unref);
@@ -284,6 +474,7 @@ realm_disco_domain_async (const gchar *string,
 	} else {
 		g_assert (!self->completed);
 		g_object_ref (self);
+		g_free (key);
 	}
 
 	call = g_new0 (Callback, 1);
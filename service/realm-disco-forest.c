@@ -0,0 +1,347 @@
+/* realmd -- Realm configuration service
+ *
+ * Copyright 2026 The realmd contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2 of the licence or (at
+ * your option) any later version.
+ *
+ * See the included COPYING file for more information.
+ */
+
+#include "config.h"
+
+#include "realm-dbus-constants.h"
+#include "realm-diagnostics.h"
+#include "realm-disco-cache.h"
+#include "realm-disco-domain.h"
+#include "realm-disco-forest.h"
+#include "realm-disco-rootdse.h"
+#include "realm-invocation.h"
+#include "realm-ldap.h"
+
+/*
+ * Discovers every domain in an Active Directory forest in one go. The
+ * domain asked for is discovered as usual, and then the crossRef objects
+ * in the Partitions container of the configuration naming context tell
+ * us the names of the other domains. That container is replicated to
+ * every domain controller in the forest, so we read it over the LDAP
+ * connection that discovery left in the pool, rather than finding and
+ * connecting to another server.
+ *
+ * The other domains are then discovered concurrently. They share the
+ * discovery cache and DNS lookups with any other discovery going on,
+ * and providers discovering the same forest at once share all of it.
+ *
+ * Some domain controllers refuse to let anonymous clients read the
+ * configuration naming context. The trustedDomain objects that would
+ * also name the other domains need a bind just the same. So in that
+ * case forest mode is skipped, and only the domain asked for is
+ * returned.
+ */
+
+/* How many of the other domains are discovered at once */
+#define FOREST_CONCURRENT 16
+
+typedef struct {
+	GDBusMethodInvocation *invocation;
+	RealmDisco *root;
+	gchar **names;
+	RealmDisco **discos;
+	guint count;
+	guint next;
+	gint outstanding;
+} Forest;
+
+typedef struct {
+	GTask *task;
+	guint index;
+} Member;
+
+/* Forests being discovered, and the tasks waiting on each */
+static GHashTable *discovering = NULL;
+
+static void
+forest_free (gpointer data)
+{
+	Forest *forest = data;
+	guint i;
+
+	g_clear_object (&forest->invocation);
+	realm_disco_unref (forest->root);
+	g_strfreev (forest->names);
+	for (i = 0; i < forest->count; i++)
+		realm_disco_unref (forest->discos[i]);
+	g_free (forest->discos);
+	g_free (forest);
+}
+
+static void
+complete_forest (GTask *task)
+{
+	Forest *forest = g_task_get_task_data (task);
+	GList *discos = NULL;
+	guint i;
+
+	/* The domain asked for comes first, then the others in the order found */
+	for (i = forest->count; i > 0; i--) {
+		if (forest->discos[i - 1])
+			discos = g_list_prepend (discos, realm_disco_ref (forest->discos[i - 1]));
+	}
+	discos = g_list_prepend (discos, realm_disco_ref (forest->root));
+
+	g_task_return_pointer (task, discos, realm_disco_forest_free);
+}
+
+static void  step_forest  (GTask *task);
+
+static void
+on_member_discovered (GObject *source,
+                      GAsyncResult *result,
+                      gpointer user_data)
+{
+	Member *member = user_data;
+	Forest *forest = g_task_get_task_data (member->task);
+	GError *error = NULL;
+
+	forest->discos[member->index] = realm_disco_domain_finish (result, &error);
+	if (error != NULL) {
+		if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+			realm_diagnostics_error (forest->invocation, error, "Couldn't discover domain in forest: %s",
+			                         forest->names[member->index]);
+		}
+		g_error_free (error);
+	}
+
+	forest->outstanding--;
+	step_forest (member->task);
+
+	g_object_unref (member->task);
+	g_free (member);
+}
+
+static void
+step_forest (GTask *task)
+{
+	Forest *forest = g_task_get_task_data (task);
+	Member *member;
+
+	while (forest->next < forest->count && forest->outstanding < FOREST_CONCURRENT) {
+		member = g_new0 (Member, 1);
+		member->task = g_object_ref (task);
+		member->index = forest->next++;
+		forest->outstanding++;
+
+		realm_diagnostics_info (forest->invocation, "Discovering domain in forest: %s",
+		                        forest->names[member->index]);
+		realm_disco_domain_async (forest->names[member->index], forest->invocation,
+		                          on_member_discovered, member);
+	}
+
+	if (forest->outstanding == 0)
+		complete_forest (task);
+}
+
+static gboolean
+is_refused (GError *error)
+{
+	if (error->domain != REALM_LDAP_ERROR)
+		return FALSE;
+
+	/* What servers answer to an anonymous client they won't serve */
+	switch (error->code) {
+	case LDAP_OPERATIONS_ERROR:
+	case LDAP_STRONG_AUTH_REQUIRED:
+	case LDAP_CONFIDENTIALITY_REQUIRED:
+	case LDAP_INAPPROPRIATE_AUTH:
+	case LDAP_INSUFFICIENT_ACCESS:
+		return TRUE;
+	default:
+		return FALSE;
+	}
+}
+
+static void
+on_partitions_read (GObject *source,
+                    GAsyncResult *result,
+                    gpointer user_data)
+{
+	GTask *task = G_TASK (user_data);
+	Forest *forest = g_task_get_task_data (task);
+	GError *error = NULL;
+	gchar **names;
+	guint i;
+
+	names = realm_disco_rootdse_partitions_finish (result, &error);
+
+	/* Not fatal, we still have the domain that was asked for */
+	if (error != NULL) {
+		if (is_refused (error)) {
+			realm_diagnostics_info (forest->invocation,
+			                        "Anonymous clients may not list the domains in the forest, "
+			                        "only discovering: %s", forest->root->domain_name);
+
+		} else if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+			realm_diagnostics_error (forest->invocation, error,
+			                         "Couldn't read the domains in the forest, only discovering: %s",
+			                         forest->root->domain_name);
+		}
+		g_error_free (error);
+
+	} else {
+		forest->names = g_new0 (gchar *, g_strv_length (names) + 1);
+		for (i = 0; names[i] != NULL; i++) {
+			if (g_ascii_strcasecmp (names[i], forest->root->domain_name) != 0)
+				forest->names[forest->count++] = g_strdup (names[i]);
+		}
+		forest->discos = g_new0 (RealmDisco *, forest->count);
+		g_strfreev (names);
+	}
+
+	step_forest (task);
+	g_object_unref (task);
+}
+
+static void
+on_root_discovered (GObject *source,
+                    GAsyncResult *result,
+                    gpointer user_data)
+{
+	GTask *task = G_TASK (user_data);
+	Forest *forest = g_task_get_task_data (task);
+	GInetSocketAddress *inet;
+	GCancellable *cancellable;
+	GError *error = NULL;
+	gchar *string;
+
+	forest->root = realm_disco_domain_finish (result, &error);
+	if (error != NULL) {
+		g_task_return_error (task, error);
+
+	} else if (forest->root == NULL) {
+		g_task_return_pointer (task, NULL, NULL);
+
+	/* Only Active Directory has forests */
+	} else if (g_strcmp0 (forest->root->server_software, REALM_DBUS_IDENTIFIER_ACTIVE_DIRECTORY) != 0 ||
+	           forest->root->server_address == NULL) {
+		complete_forest (task);
+
+	} else {
+		inet = G_INET_SOCKET_ADDRESS (forest->root->server_address);
+		string = g_inet_address_to_string (g_inet_socket_address_get_address (inet));
+		realm_diagnostics_info (forest->invocation, "Reading domains in forest from: %s", string);
+		g_free (string);
+
+		cancellable = forest->invocation ? realm_invocation_get_cancellable (forest->invocation) : NULL;
+		realm_disco_rootdse_partitions_async (forest->root->server_address, forest->invocation,
+		                                      cancellable, on_partitions_read, g_object_ref (task));
+	}
+
+	g_object_unref (task);
+}
+
+static void
+discover_forest_async (const gchar *string,
+                       GDBusMethodInvocation *invocation,
+                       GAsyncReadyCallback callback,
+                       gpointer user_data)
+{
+	Forest *forest;
+	GTask *task;
+
+	task = g_task_new (NULL, NULL, callback, user_data);
+	forest = g_new0 (Forest, 1);
+	forest->invocation = invocation ? g_object_ref (invocation) : NULL;
+	g_task_set_task_data (task, forest, forest_free);
+
+	realm_disco_domain_async (string, invocation, on_root_discovered, task);
+}
+
+static void
+on_forest_discovered (GObject *source,
+                      GAsyncResult *result,
+                      gpointer user_data)
+{
+	gchar *key = user_data;
+	GError *error = NULL;
+	GQueue *waiting;
+	GList *discos;
+	GTask *task;
+
+	discos = g_task_propagate_pointer (G_TASK (result), &error);
+
+	waiting = g_hash_table_lookup (discovering, key);
+	g_hash_table_remove (discovering, key);
+	if (g_hash_table_size (discovering) == 0) {
+		g_hash_table_destroy (discovering);
+		discovering = NULL;
+	}
+
+	for (;;) {
+		task = g_queue_pop_head (waiting);
+		if (task == NULL)
+			break;
+		if (error) {
+			g_task_return_error (task, g_error_copy (error));
+		} else {
+			g_task_return_pointer (task, g_list_copy_deep (discos, (GCopyFunc)realm_disco_ref, NULL),
+			                       realm_disco_forest_free);
+		}
+		g_object_unref (task);
+	}
+
+	g_queue_free (waiting);
+	realm_disco_forest_free (discos);
+	g_clear_error (&error);
+	g_free (key);
+}
+
+void
+realm_disco_forest_async (const gchar *string,
+                          GDBusMethodInvocation *invocation,
+                          GAsyncReadyCallback callback,
+                          gpointer user_data)
+{
+	GQueue *waiting;
+	GTask *task;
+	gchar *key;
+
+	g_return_if_fail (string != NULL);
+	g_return_if_fail (invocation == NULL || G_IS_DBUS_METHOD_INVOCATION (invocation));
+
+	task = g_task_new (NULL, NULL, callback, user_data);
+	g_task_set_source_tag (task, realm_disco_forest_async);
+
+	if (!discovering)
+		discovering = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+	/* More than one provider discovers the same forest, only do it once */
+	key = realm_disco_cache_key (string);
+	waiting = g_hash_table_lookup (discovering, key);
+	if (waiting != NULL) {
+		g_queue_push_tail (waiting, task);
+		g_free (key);
+		return;
+	}
+
+	waiting = g_queue_new ();
+	g_queue_push_tail (waiting, task);
+	g_hash_table_insert (discovering, g_strdup (key), waiting);
+
+	discover_forest_async (string, invocation, on_forest_discovered, key);
+}
+
+GList *
+realm_disco_forest_finish (GAsyncResult *result,
+                           GError **error)
+{
+	g_return_val_if_fail (g_task_is_valid (result, NULL), NULL);
+	return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+void
+realm_disco_forest_free (gpointer discos)
+{
+	g_list_free_full (discos, realm_disco_unref);
+}
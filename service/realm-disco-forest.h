@@ -0,0 +1,36 @@
+/* realmd -- Realm configuration service
+ *
+ * Copyright 2026 The realmd contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2 of the licence or (at
+ * your option) any later version.
+ *
+ * See the included COPYING file for more information.
+ */
+
+#include "config.h"
+
+#ifndef __REALM_DISCO_FOREST_H__
+#define __REALM_DISCO_FOREST_H__
+
+#include "realm-disco.h"
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+void          realm_disco_forest_async    (const gchar *string,
+                                           GDBusMethodInvocation *invocation,
+                                           GAsyncReadyCallback callback,
+                                           gpointer user_data);
+
+GList *       realm_disco_forest_finish   (GAsyncResult *result,
+                                           GError **error);
+
+void          realm_disco_forest_free     (gpointer discos);
+
+G_END_DECLS
+
+#endif /* __REALM_DISCO_FOREST_H__ */
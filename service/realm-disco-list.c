@@ -0,0 +1,200 @@
+/* realmd -- Realm configuration service
+ *
+ * Copyright 2026 The realmd contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2 of the licence or (at
+ * your option) any later version.
+ *
+ * See the included COPYING file for more information.
+ */
+
+#include "config.h"
+
+#include "realm-disco-list.h"
+#include "realm-disco-score.h"
+#include "realm-settings.h"
+
+#include <string.h>
+
+/*
+ * Domain controllers listed in realmd.conf for a domain, in place of
+ * looking them up in DNS. On segmented networks DNS can be the slowest
+ * and least reliable part of discovery, while the set of domain
+ * controllers hardly ever changes:
+ *
+ *   [domain.example.com]
+ *   domain-controllers = 192.0.2.10 192.0.2.11 [2001:db8::10]:389
+ *
+ * The addresses are handed out best scoring first, just like the ones
+ * from DNS, and probed in parallel by the caller.
+ */
+
+typedef struct {
+	GSocketAddressEnumerator parent;
+	GQueue addresses;
+} RealmDiscoList;
+
+typedef struct {
+	GSocketAddressEnumeratorClass parent;
+} RealmDiscoListClass;
+
+#define REALM_TYPE_DISCO_LIST      (realm_disco_list_get_type ())
+#define REALM_DISCO_LIST(inst)     (G_TYPE_CHECK_INSTANCE_CAST ((inst), REALM_TYPE_DISCO_LIST, RealmDiscoList))
+#define REALM_IS_DISCO_LIST(inst)  (G_TYPE_CHECK_INSTANCE_TYPE ((inst), REALM_TYPE_DISCO_LIST))
+
+GType realm_disco_list_get_type (void) G_GNUC_CONST;
+
+G_DEFINE_TYPE (RealmDiscoList, realm_disco_list, G_TYPE_SOCKET_ADDRESS_ENUMERATOR);
+
+static void
+realm_disco_list_init (RealmDiscoList *self)
+{
+	g_queue_init (&self->addresses);
+}
+
+static void
+realm_disco_list_finalize (GObject *obj)
+{
+	RealmDiscoList *self = REALM_DISCO_LIST (obj);
+	gpointer value;
+
+	for (;;) {
+		value = g_queue_pop_head (&self->addresses);
+		if (!value)
+			break;
+		g_object_unref (value);
+	}
+
+	G_OBJECT_CLASS (realm_disco_list_parent_class)->finalize (obj);
+}
+
+static GSocketAddress *
+realm_disco_list_next (GSocketAddressEnumerator *enumerator,
+                       GCancellable *cancellable,
+                       GError **error)
+{
+	RealmDiscoList *self = REALM_DISCO_LIST (enumerator);
+	return g_queue_pop_head (&self->addresses);
+}
+
+static void
+realm_disco_list_next_async (GSocketAddressEnumerator *enumerator,
+                             GCancellable *cancellable,
+                             GAsyncReadyCallback callback,
+                             gpointer user_data)
+{
+	GSocketAddress *address;
+	GTask *task;
+
+	task = g_task_new (enumerator, cancellable, callback, user_data);
+	address = realm_disco_list_next (enumerator, cancellable, NULL);
+	g_task_return_pointer (task, address, address ? g_object_unref : NULL);
+	g_object_unref (task);
+}
+
+static GSocketAddress *
+realm_disco_list_next_finish (GSocketAddressEnumerator *enumerator,
+                              GAsyncResult *result,
+                              GError **error)
+{
+	return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+static void
+realm_disco_list_class_init (RealmDiscoListClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+	GSocketAddressEnumeratorClass *enum_class = G_SOCKET_ADDRESS_ENUMERATOR_CLASS (klass);
+
+	object_class->finalize = realm_disco_list_finalize;
+
+	enum_class->next = realm_disco_list_next;
+	enum_class->next_async = realm_disco_list_next_async;
+	enum_class->next_finish = realm_disco_list_next_finish;
+}
+
+GList *
+realm_disco_list_parse (const gchar *value)
+{
+	GSocketConnectable *connectable;
+	GList *addresses = NULL;
+	GError *error = NULL;
+	const gchar *hostname;
+	GInetAddress *inet;
+	gchar **entries;
+	gint i;
+
+	g_return_val_if_fail (value != NULL, NULL);
+
+	entries = g_strsplit_set (value, " \t,", -1);
+	for (i = 0; entries[i] != NULL; i++) {
+		if (entries[i][0] == '\0')
+			continue;
+
+		connectable = g_network_address_parse (entries[i], 389, &error);
+		if (error != NULL) {
+			g_message ("Invalid domain controller address in realmd.conf: %s: %s",
+			           entries[i], error->message);
+			g_clear_error (&error);
+			continue;
+		}
+
+		/* The whole point is to not use DNS, so only addresses are accepted */
+		hostname = g_network_address_get_hostname (G_NETWORK_ADDRESS (connectable));
+		if (!g_hostname_is_ip_address (hostname)) {
+			g_message ("Domain controllers in realmd.conf must be IP addresses: %s",
+			           entries[i]);
+			g_object_unref (connectable);
+			continue;
+		}
+
+		inet = g_inet_address_new_from_string (hostname);
+		addresses = g_list_prepend (addresses, g_inet_socket_address_new (inet,
+		                            g_network_address_get_port (G_NETWORK_ADDRESS (connectable))));
+		g_object_unref (inet);
+		g_object_unref (connectable);
+	}
+
+	g_strfreev (entries);
+	return g_list_reverse (addresses);
+}
+
+GSocketAddressEnumerator *
+realm_disco_list_enumerate_servers (const gchar *domain)
+{
+	RealmDiscoList *self;
+	const gchar *value;
+	GList *addresses;
+	gchar *section;
+	GList *l;
+
+	g_return_val_if_fail (domain != NULL, NULL);
+
+	/* Sections for realms are named after the domain in lower case */
+	section = g_ascii_strdown (domain, -1);
+	g_strstrip (section);
+	if (g_str_has_suffix (section, "."))
+		section[strlen (section) - 1] = '\0';
+
+	value = realm_settings_value (section, "domain-controllers");
+	g_free (section);
+
+	if (value == NULL)
+		return NULL;
+
+	addresses = realm_disco_list_parse (value);
+	if (addresses == NULL)
+		return NULL;
+
+	/* Servers known to be fast and healthy first, failing ones last */
+	addresses = realm_disco_score_order (addresses);
+
+	self = g_object_new (REALM_TYPE_DISCO_LIST, NULL);
+	for (l = addresses; l != NULL; l = g_list_next (l))
+		g_queue_push_tail (&self->addresses, l->data);
+	g_list_free (addresses);
+
+	return G_SOCKET_ADDRESS_ENUMERATOR (self);
+}
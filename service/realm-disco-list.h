@@ -0,0 +1,28 @@
+/* realmd -- Realm configuration service
+ *
+ * Copyright 2026 The realmd contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2 of the licence or (at
+ * your option) any later version.
+ *
+ * See the included COPYING file for more information.
+ */
+
+#include "config.h"
+
+#ifndef __REALM_DISCO_LIST_H__
+#define __REALM_DISCO_LIST_H__
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+GSocketAddressEnumerator *  realm_disco_list_enumerate_servers   (const gchar *domain);
+
+GList *                     realm_disco_list_parse               (const gchar *value);
+
+G_END_DECLS
+
+#endif /* __REALM_DISCO_LIST_H__ */
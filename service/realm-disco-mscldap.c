@@ -16,27 +16,77 @@
 
 #include "realm-dbus-constants.h"
 #include "realm-disco-mscldap.h"
+#include "realm-disco-netlogon.h"
 #include "realm-ldap.h"
 #include "realm-options.h"
+#include "realm-settings.h"
 
 #include <glib/gi18n.h>
 
 #include <errno.h>
-#include <resolv.h>
+#include <string.h>
 #include <unistd.h>
 
 typedef struct {
+	guint32 msgid;
 	gchar *explicit_server;
 	GSocketAddress *address;
-	GSource *source;
+	GSource *cancel_source;
 	gint count;
-	gint fever_id;
-	gint normal_id;
+	guint resend_id;
+	guint timeout_id;
 } Closure;
 
+typedef struct {
+	GSocket *socket;
+	GSource *source;
+} CldapSocket;
+
 /* Number of rapid requets to do */
 #define DISCO_FEVER  4
 
+/* Largest CLDAP response we accept */
+#define CLDAP_MAX_DATAGRAM  4096
+
+/* BER tags used in CLDAP messages */
+#define BER_SEQUENCE         0x30
+#define BER_SET              0x31
+#define BER_INTEGER          0x02
+#define BER_OCTET_STRING     0x04
+#define LDAP_SEARCH_ENTRY    0x64
+#define LDAP_SEARCH_DONE     0x65
+
+/*
+ * The SearchRequest part of a NetLogon ping. This is the same for every
+ * ping, only the message id around it changes. It is equivalent to:
+ *
+ * base: "", scope: base, filter: (&(NtVer=\06\00\00\00)(AAC=\00\00\00\00)),
+ * attributes: NetLogon
+ */
+static const guchar cldap_search_request[] = {
+	0x63, 0x3b,                                    /* [APPLICATION 3] SearchRequest */
+	  0x04, 0x00,                                  /* baseObject: "" */
+	  0x0a, 0x01, 0x00,                            /* scope: baseObject */
+	  0x0a, 0x01, 0x00,                            /* derefAliases: never */
+	  0x02, 0x01, 0x00,                            /* sizeLimit: 0 */
+	  0x02, 0x01, 0x00,                            /* timeLimit: 0 */
+	  0x01, 0x01, 0x00,                            /* typesOnly: FALSE */
+	  0xa0, 0x1c,                                  /* filter: and */
+	    0xa3, 0x0d,                                /* equalityMatch */
+	      0x04, 0x05, 'N', 't', 'V', 'e', 'r',
+	      0x04, 0x04, 0x06, 0x00, 0x00, 0x00,
+	    0xa3, 0x0b,                                /* equalityMatch */
+	      0x04, 0x03, 'A', 'A', 'C',
+	      0x04, 0x04, 0x00, 0x00, 0x00, 0x00,
+	  0x30, 0x0a,                                  /* attributes */
+	    0x04, 0x08, 'N', 'e', 't', 'L', 'o', 'g', 'o', 'n',
+};
+
+/* All outstanding pings share one socket per address family */
+static CldapSocket cldap_sockets[2] = { { NULL, NULL }, { NULL, NULL } };
+static GHashTable *cldap_pings = NULL;
+static guint32 cldap_last_msgid = 0;
+
 #ifndef HOST_NAME_MAX
 #define HOST_NAME_MAX 255
 #endif
@@ -48,12 +98,9 @@ closure_free (gpointer data)
 
 	g_free (clo->explicit_server);
 	g_object_unref (clo->address);
-	if (clo->fever_id)
-		g_source_remove (clo->fever_id);
-	if (clo->normal_id)
-		g_source_remove (clo->normal_id);
-	g_source_destroy (clo->source);
-	g_source_unref (clo->source);
+	g_assert (clo->resend_id == 0);
+	g_assert (clo->timeout_id == 0);
+	g_assert (clo->cancel_source == NULL);
 	g_free (clo);
 }
 
@@ -93,106 +140,50 @@ explicit_netbios_name (void)
 	return NULL;
 }
 
-static gchar *
-get_string (guchar *beg,
-            guchar *end,
-            guchar **at)
-{
-	gchar buffer[HOST_NAME_MAX];
-	int n;
-
-	n = dn_expand (beg, end, *at, buffer, sizeof (buffer));
-	if (n < 0)
-		return NULL;
-
-	if (!realm_options_check_domain_name (buffer)) {
-		g_message ("received invalid NetLogon string characters");
-		return NULL;
-	}
-
-	(*at) += n;
-	return g_strdup (buffer);
-}
-
 static gboolean
-parse_string (guchar *beg,
-              guchar *end,
-              guchar **at,
+parse_string (const RealmNetlogon *netlogon,
+              RealmNetlogonName name,
               gchar **result)
 {
-	gchar *string;
+	gchar buffer[REALM_NETLOGON_MAX_NAME];
 
 	g_assert (result);
 
-	string = get_string (beg, end, at);
-	if (string == NULL)
+	if (realm_disco_netlogon_name (netlogon, name, buffer, sizeof (buffer)) < 0)
 		return FALSE;
 
-	g_free (*result);
-	*result = string;
-
-	return TRUE;
-}
-
-static gboolean
-get_32_le (unsigned char **at,
-           unsigned char *end,
-           unsigned int *val)
-{
-	unsigned char *p = *at;
-	if (p + 4 > end)
+	if (!realm_options_check_domain_name (buffer)) {
+		g_message ("received invalid NetLogon string characters");
 		return FALSE;
-	*val = p[0] | p[1] << 8 | p[2] << 16 | p[3] << 24;
-	(*at) += 4;
-	return TRUE;
-}
+	}
 
-static gboolean
-skip_n (unsigned char **at,
-        unsigned char *end,
-        int n)
-{
-	if ((*at) + n > end)
-		return FALSE;
-	(*at) += n;
+	g_free (*result);
+	*result = g_strdup (buffer);
 	return TRUE;
 }
 
 static gboolean
-parse_netlogon (struct berval **bvs,
+parse_netlogon (const guchar *data,
+                gsize length,
                 RealmDisco *disco,
                 GError **error)
 {
-	guchar *at, *end, *beg;
-	gchar *unused = NULL;
-	guint type, flags;
-	gboolean success = FALSE;
-
-	if (bvs != NULL && bvs[0] != NULL) {
-		beg = (guchar *)bvs[0]->bv_val;
-		end = beg + bvs[0]->bv_len;
-		at = beg;
-		success = TRUE;
-	}
-
-	/* domain forest */
-	if (!success ||
-	    !get_32_le (&at, end, &type) || type != 23 ||
-	    !get_32_le (&at, end, &flags) ||
-	    !skip_n (&at, end, 16) || /* guid */
-	    !parse_string (beg, end, &at, &unused) || /* forest */
-	    !parse_string (beg, end, &at, &disco->domain_name) ||
-	    !parse_string (beg, end, &at, &unused) || /* hostname */
-	    !parse_string (beg, end, &at, &disco->workgroup) ||
-	    !parse_string (beg, end, &at, &unused) || /* shorthost */
-	    !parse_string (beg, end, &at, &unused) || /* user */
-	    !parse_string (beg, end, &at, &unused) || /* server site */
-	    !parse_string (beg, end, &at, &unused)) { /* client site */
-		success = FALSE;
+	RealmNetlogon netlogon;
+	gboolean success;
+
+	success = realm_disco_netlogon_decode (data, length, &netlogon) &&
+	          parse_string (&netlogon, REALM_NETLOGON_DNS_DOMAIN, &disco->domain_name) &&
+	          parse_string (&netlogon, REALM_NETLOGON_DNS_HOST, &disco->server_name) &&
+	          parse_string (&netlogon, REALM_NETLOGON_NETBIOS_DOMAIN, &disco->workgroup) &&
+	          parse_string (&netlogon, REALM_NETLOGON_SERVER_SITE, &disco->server_site) &&
+	          parse_string (&netlogon, REALM_NETLOGON_CLIENT_SITE, &disco->client_site);
+
+	/* An empty client site means the server couldn't map our address */
+	if (success && disco->client_site && disco->client_site[0] == '\0') {
+		g_free (disco->client_site);
+		disco->client_site = NULL;
 	}
 
-	g_free (unused);
-
 	if (!success) {
 		g_set_error (error, REALM_LDAP_ERROR, LDAP_PROTOCOL_ERROR,
 		             _("Received invalid or unsupported Netlogon data from server"));
@@ -200,6 +191,7 @@ parse_netlogon (struct berval **bvs,
 	}
 
 	disco->server_software = REALM_DBUS_IDENTIFIER_ACTIVE_DIRECTORY;
+	disco->server_flags = netlogon.flags;
 	disco->explicit_netbios = explicit_netbios_name ();
 	disco->kerberos_realm = g_ascii_strup (disco->domain_name, -1);
 	return TRUE;
@@ -218,7 +210,10 @@ realm_disco_mscldap_result (LDAP *ldap,
 	entry = ldap_first_entry (ldap, message);
 	if (entry != NULL)
 		bvs = ldap_get_values_len (ldap, entry, "NetLogon");
-	ret = parse_netlogon (bvs, disco, error);
+	if (bvs != NULL && bvs[0] != NULL)
+		ret = parse_netlogon ((guchar *)bvs[0]->bv_val, bvs[0]->bv_len, disco, error);
+	else
+		ret = parse_netlogon (NULL, 0, disco, error);
 	ldap_value_free_len (bvs);
 
 	return ret;
@@ -246,84 +241,418 @@ realm_disco_mscldap_request (LDAP *ldap,
 }
 
 static gboolean
-on_resend (gpointer user_data)
+ber_read (const guchar **at,
+          const guchar *end,
+          guchar tag,
+          const guchar **value,
+          gsize *length)
+{
+	const guchar *p = *at;
+	gsize len;
+	gint n;
+
+	if (end - p < 2 || p[0] != tag)
+		return FALSE;
+
+	len = p[1];
+	p += 2;
+
+	/* Long form length */
+	if (len & 0x80) {
+		n = len & 0x7f;
+		if (n == 0 || n > 4 || end - p < n)
+			return FALSE;
+		for (len = 0; n > 0; n--)
+			len = (len << 8) | *(p++);
+	}
+
+	if (len > (gsize)(end - p))
+		return FALSE;
+
+	*value = p;
+	*length = len;
+	*at = p + len;
+	return TRUE;
+}
+
+static gboolean
+ber_read_msgid (const guchar **at,
+                const guchar *end,
+                guint32 *msgid)
 {
-	realm_ldap_set_condition (user_data, G_IO_OUT | G_IO_IN);
+	const guchar *value;
+	gsize length;
+	gsize i;
+
+	/* We only ever send positive 31-bit message ids */
+	if (!ber_read (at, end, BER_INTEGER, &value, &length) ||
+	    length == 0 || length > 4 || value[0] & 0x80)
+		return FALSE;
+
+	*msgid = 0;
+	for (i = 0; i < length; i++)
+		*msgid = (*msgid << 8) | value[i];
 	return TRUE;
 }
 
-static GIOCondition
-on_ldap_io (LDAP *ldap,
-            GIOCondition cond,
-            gpointer user_data)
+static gboolean
+cldap_parse_message (const guchar *data,
+                     gsize length,
+                     guint32 *msgid,
+                     guchar *op_tag,
+                     const guchar **op,
+                     gsize *n_op)
+{
+	const guchar *at = data;
+	const guchar *end = data + length;
+	const guchar *message;
+	gsize n_message;
+
+	if (!ber_read (&at, end, BER_SEQUENCE, &message, &n_message))
+		return FALSE;
+
+	at = message;
+	end = message + n_message;
+	if (!ber_read_msgid (&at, end, msgid) || at >= end)
+		return FALSE;
+
+	/* The protocolOp, either a search entry or done */
+	*op_tag = at[0];
+	return ber_read (&at, end, *op_tag, op, n_op);
+}
+
+static gboolean
+cldap_parse_netlogon (const guchar *entry,
+                      gsize n_entry,
+                      const guchar **netlogon,
+                      gsize *n_netlogon)
+{
+	const guchar *at = entry;
+	const guchar *end = entry + n_entry;
+	const guchar *attrs, *attr, *type, *vals, *value;
+	gsize n_attrs, n_attr, n_type, n_vals, n_value;
+	const guchar *attrs_end, *attr_end;
+
+	/* objectName, always empty for NetLogon, then attributes */
+	if (!ber_read (&at, end, BER_OCTET_STRING, &value, &n_value) ||
+	    !ber_read (&at, end, BER_SEQUENCE, &attrs, &n_attrs))
+		return FALSE;
+
+	at = attrs;
+	attrs_end = attrs + n_attrs;
+	while (at < attrs_end) {
+		if (!ber_read (&at, attrs_end, BER_SEQUENCE, &attr, &n_attr))
+			return FALSE;
+
+		attr_end = attr + n_attr;
+		if (!ber_read (&attr, attr_end, BER_OCTET_STRING, &type, &n_type) ||
+		    !ber_read (&attr, attr_end, BER_SET, &vals, &n_vals))
+			return FALSE;
+
+		if (n_type == 8 && g_ascii_strncasecmp ((const gchar *)type, "NetLogon", 8) == 0)
+			return ber_read (&vals, vals + n_vals, BER_OCTET_STRING, netlogon, n_netlogon);
+	}
+
+	return FALSE;
+}
+
+static gsize
+cldap_build_request (guint32 msgid,
+                     guchar *buffer,
+                     gsize n_buffer)
+{
+	guchar integer[5];
+	gsize n_integer;
+	gsize length;
+	gint i;
+
+	/* Minimal big endian encoding of a positive integer */
+	n_integer = 0;
+	for (i = 3; i >= 0; i--) {
+		if (n_integer == 0 && i > 0 && ((msgid >> (i * 8)) & 0xff) == 0)
+			continue;
+		if (n_integer == 0 && (msgid >> (i * 8)) & 0x80)
+			integer[n_integer++] = 0x00;
+		integer[n_integer++] = (msgid >> (i * 8)) & 0xff;
+	}
+
+	length = 2 + n_integer + sizeof (cldap_search_request);
+	g_assert (length < 0x80);
+	g_assert (length + 2 <= n_buffer);
+
+	buffer[0] = BER_SEQUENCE;
+	buffer[1] = length;
+	buffer[2] = BER_INTEGER;
+	buffer[3] = n_integer;
+	memcpy (buffer + 4, integer, n_integer);
+	memcpy (buffer + 4 + n_integer, cldap_search_request, sizeof (cldap_search_request));
+
+	return length + 2;
+}
+
+static void
+cldap_socket_close (CldapSocket *cs)
+{
+	if (cs->source) {
+		g_source_destroy (cs->source);
+		g_source_unref (cs->source);
+		cs->source = NULL;
+	}
+
+	g_clear_object (&cs->socket);
+}
+
+static void
+ping_stop (GTask *task)
+{
+	Closure *clo = g_task_get_task_data (task);
+	gint i;
+
+	if (clo->resend_id)
+		g_source_remove (clo->resend_id);
+	clo->resend_id = 0;
+
+	if (clo->timeout_id)
+		g_source_remove (clo->timeout_id);
+	clo->timeout_id = 0;
+
+	if (clo->cancel_source) {
+		g_source_destroy (clo->cancel_source);
+		g_source_unref (clo->cancel_source);
+		clo->cancel_source = NULL;
+	}
+
+	if (clo->msgid == 0)
+		return;
+
+	/* Removing from the table may drop the last reference to task */
+	g_hash_table_remove (cldap_pings, GUINT_TO_POINTER (clo->msgid));
+	clo->msgid = 0;
+
+	/* Don't keep the sockets around when nothing is outstanding */
+	if (g_hash_table_size (cldap_pings) == 0) {
+		for (i = 0; i < G_N_ELEMENTS (cldap_sockets); i++)
+			cldap_socket_close (cldap_sockets + i);
+		g_hash_table_destroy (cldap_pings);
+		cldap_pings = NULL;
+	}
+}
+
+static void
+ping_return_error (GTask *task,
+                   GError *error)
+{
+	g_object_ref (task);
+	ping_stop (task);
+	g_task_return_error (task, error);
+	g_object_unref (task);
+}
+
+static void
+ping_receive (GTask *task,
+              const guchar *data,
+              gsize length)
 {
-	GTask *task = G_TASK (user_data);
 	Closure *clo = g_task_get_task_data (task);
-	struct timeval tvpoll = { 0, 0 };
-	LDAPMessage *message;
+	const guchar *netlogon = NULL;
+	gsize n_netlogon = 0;
 	GError *error = NULL;
 	RealmDisco *disco;
-	int msgid;
+	guint32 msgid;
+	guchar op_tag;
+	const guchar *op;
+	gsize n_op;
+
+	g_debug ("Received response");
+
+	if (!cldap_parse_message (data, length, &msgid, &op_tag, &op, &n_op) ||
+	    op_tag != LDAP_SEARCH_ENTRY ||
+	    !cldap_parse_netlogon (op, n_op, &netlogon, &n_netlogon)) {
+		netlogon = NULL;
+		n_netlogon = 0;
+	}
+
+	disco = realm_disco_new (NULL);
+	disco->server_address = g_object_ref (clo->address);
+
+	g_object_ref (task);
+	ping_stop (task);
 
-	/* Cancelled */
-	if (cond & G_IO_ERR) {
-		realm_ldap_set_error (&error, ldap, 0);
+	if (parse_netlogon (netlogon, n_netlogon, disco, &error)) {
+		disco->explicit_server = g_strdup (clo->explicit_server);
+		g_task_return_pointer (task, disco, realm_disco_unref);
+	} else {
+		realm_disco_unref (disco);
 		g_task_return_error (task, error);
-		return G_IO_NVAL;
 	}
 
-	/* Ready for input */
-	if (cond & G_IO_OUT) {
-		g_debug ("Sending NetLogon ping");
-		if (!realm_disco_mscldap_request (ldap, &msgid, &error)) {
-			g_task_return_error (task, error);
-			return G_IO_NVAL;
+	g_object_unref (task);
+}
+
+static gboolean
+same_address (GSocketAddress *one,
+              GSocketAddress *two)
+{
+	GInetSocketAddress *a, *b;
+
+	if (!G_IS_INET_SOCKET_ADDRESS (one) || !G_IS_INET_SOCKET_ADDRESS (two))
+		return FALSE;
+
+	a = G_INET_SOCKET_ADDRESS (one);
+	b = G_INET_SOCKET_ADDRESS (two);
+
+	return g_inet_socket_address_get_port (a) == g_inet_socket_address_get_port (b) &&
+	       g_inet_address_equal (g_inet_socket_address_get_address (a),
+	                             g_inet_socket_address_get_address (b));
+}
+
+static gboolean
+on_cldap_input (GSocket *socket,
+                GIOCondition cond,
+                gpointer user_data)
+{
+	guchar buffer[CLDAP_MAX_DATAGRAM];
+	GSocketAddress *from;
+	GError *error = NULL;
+	const guchar *op;
+	GTask *task;
+	Closure *clo;
+	guint32 msgid;
+	guchar op_tag;
+	gsize n_op;
+	gssize ret;
+
+	for (;;) {
+		from = NULL;
+		ret = g_socket_receive_from (socket, &from, (gchar *)buffer,
+		                             sizeof (buffer), NULL, &error);
+		if (ret < 0) {
+			if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK))
+				g_debug ("Couldn't receive CLDAP response: %s", error->message);
+			g_error_free (error);
+			break;
 		}
 
-		/* Remove rapid fire after sending a feverish batch */
-		if (clo->count++ > DISCO_FEVER && clo->fever_id != 0) {
-			g_source_remove (clo->fever_id);
-			clo->fever_id = 0;
+		/* Match the response to an outstanding ping by message id */
+		task = NULL;
+		if (cldap_pings && cldap_parse_message (buffer, ret, &msgid, &op_tag, &op, &n_op))
+			task = g_hash_table_lookup (cldap_pings, GUINT_TO_POINTER (msgid));
+
+		if (task == NULL) {
+			g_debug ("Ignoring unexpected CLDAP response");
+
+		} else {
+			clo = g_task_get_task_data (task);
+			if (same_address (clo->address, from))
+				ping_receive (task, buffer, ret);
+			else
+				g_debug ("Ignoring CLDAP response from wrong address");
 		}
+
+		g_clear_object (&from);
+
+		/* The socket was closed when the last ping completed */
+		if (cldap_pings == NULL)
+			return FALSE;
 	}
 
-	/* Ready to get a result */
-	if (cond & G_IO_IN) {
-		switch (ldap_result (ldap, LDAP_RES_ANY, 0, &tvpoll, &message)) {
-		case LDAP_RES_SEARCH_ENTRY:
-		case LDAP_RES_SEARCH_RESULT:
-			g_debug ("Received response");
-			disco = realm_disco_new (NULL);
-			disco->server_address = g_object_ref (clo->address);
-			if (realm_disco_mscldap_result (ldap, message, disco, &error)) {
-				disco->explicit_server = g_strdup (clo->explicit_server);
-				g_task_return_pointer (task, disco, realm_disco_unref);
-			} else {
-				realm_disco_unref (disco);
-				g_task_return_error (task, error);
-			}
-			ldap_msgfree (message);
-			return G_IO_NVAL;
-		case -1:
-			realm_ldap_set_error (&error, ldap, -1);
-			g_task_return_error (task, error);
-			return G_IO_NVAL;
-		case 0:
-			break;
-		default:
-			/* Ignore and keep waiting */
-			ldap_msgfree (message);
-			break;
-		}
+	return TRUE;
+}
+
+static GSocket *
+cldap_socket_for (GSocketFamily family,
+                  GError **error)
+{
+	CldapSocket *cs;
+
+	cs = cldap_sockets + (family == G_SOCKET_FAMILY_IPV6 ? 1 : 0);
+	if (cs->socket)
+		return cs->socket;
+
+	cs->socket = g_socket_new (family, G_SOCKET_TYPE_DATAGRAM,
+	                           G_SOCKET_PROTOCOL_UDP, error);
+	if (cs->socket == NULL)
+		return NULL;
+
+	g_socket_set_blocking (cs->socket, FALSE);
+	cs->source = g_socket_create_source (cs->socket, G_IO_IN, NULL);
+	g_source_set_callback (cs->source, (GSourceFunc)on_cldap_input, NULL, NULL);
+	g_source_attach (cs->source, NULL);
+
+	return cs->socket;
+}
+
+static gboolean
+on_resend (gpointer user_data)
+{
+	GTask *task = G_TASK (user_data);
+	Closure *clo = g_task_get_task_data (task);
+	guchar buffer[128];
+	GError *error = NULL;
+	GSocket *socket;
+	gsize length;
+
+	clo->resend_id = 0;
+
+	socket = cldap_socket_for (g_socket_address_get_family (clo->address), &error);
+	if (socket != NULL) {
+		g_debug ("Sending NetLogon ping");
+		length = cldap_build_request (clo->msgid, buffer, sizeof (buffer));
+		g_socket_send_to (socket, clo->address, (gchar *)buffer, length, NULL, &error);
+	}
+
+	/* Full socket buffer, just try again later */
+	if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK))
+		g_clear_error (&error);
+
+	if (error != NULL) {
+		ping_return_error (task, error);
+		return FALSE;
 	}
 
-	/* Now wait for a response */
-	return G_IO_IN;
+	/* Send a feverish batch, and then slow down */
+	clo->resend_id = g_timeout_add (clo->count++ < DISCO_FEVER ? 100 : 1000,
+	                                on_resend, task);
+	return FALSE;
+}
+
+static gboolean
+on_timeout (gpointer user_data)
+{
+	GTask *task = G_TASK (user_data);
+	Closure *clo = g_task_get_task_data (task);
+
+	clo->timeout_id = 0;
+	ping_return_error (task, g_error_new (G_IO_ERROR, G_IO_ERROR_TIMED_OUT,
+	                                      _("Timed out waiting for a Netlogon reply")));
+	return FALSE;
+}
+
+static gboolean
+on_cancelled (GCancellable *cancellable,
+              gpointer user_data)
+{
+	GTask *task = G_TASK (user_data);
+	GError *error = NULL;
+
+	g_cancellable_set_error_if_cancelled (cancellable, &error);
+	ping_return_error (task, error);
+	return FALSE;
+}
+
+static guint32
+cldap_next_msgid (void)
+{
+	do {
+		cldap_last_msgid = (cldap_last_msgid + 1) & 0x7fffffff;
+	} while (cldap_last_msgid == 0 ||
+	         g_hash_table_lookup (cldap_pings, GUINT_TO_POINTER (cldap_last_msgid)));
+
+	return cldap_last_msgid;
 }
 
 void
 realm_disco_mscldap_async (GSocketAddress *address,
-                           GSocketProtocol protocol,
                            const gchar *explicit_server,
                            GCancellable *cancellable,
                            GAsyncReadyCallback callback,
@@ -331,8 +660,9 @@ realm_disco_mscldap_async (GSocketAddress *address,
 {
 	GTask *task;
 	Closure *clo;
+	gdouble timeout;
 
-	g_return_if_fail (address != NULL);
+	g_return_if_fail (G_IS_INET_SOCKET_ADDRESS (address));
 
 	task = g_task_new (NULL, cancellable, callback, user_data);
 	clo = g_new0 (Closure, 1);
@@ -340,24 +670,34 @@ realm_disco_mscldap_async (GSocketAddress *address,
 	clo->address = g_object_ref (address);
 	g_task_set_task_data (task, clo, closure_free);
 
-	if (protocol == G_SOCKET_PROTOCOL_UDP &&
-	    !ldap_is_ldap_url ("cldap://hostname")) {
-		g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
-		                         _("LDAP on this system does not support UDP connections"));
+	if (g_task_return_error_if_cancelled (task)) {
 		g_object_unref (task);
 		return;
 	}
 
-	clo->source = realm_ldap_connect_anonymous (address, protocol, cancellable);
-	g_source_set_callback (clo->source, (GSourceFunc)on_ldap_io,
-	                       g_object_ref (task), g_object_unref);
-	g_source_attach (clo->source, g_task_get_context (task));
+	if (cldap_pings == NULL) {
+		cldap_pings = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+		                                     NULL, g_object_unref);
+		cldap_last_msgid = g_random_int_range (1, 0x7fffffff);
+	}
+
+	/* The table owns a reference to the task until it completes */
+	clo->msgid = cldap_next_msgid ();
+	g_hash_table_insert (cldap_pings, GUINT_TO_POINTER (clo->msgid), g_object_ref (task));
 
-	if (protocol == G_SOCKET_PROTOCOL_UDP) {
-		clo->fever_id = g_timeout_add (100, on_resend, clo->source);
-		clo->normal_id = g_timeout_add (1000, on_resend, clo->source);
+	if (cancellable) {
+		clo->cancel_source = g_cancellable_source_new (cancellable);
+		g_source_set_callback (clo->cancel_source, (GSourceFunc)on_cancelled, task, NULL);
+		g_source_attach (clo->cancel_source, g_task_get_context (task));
 	}
 
+	timeout = realm_settings_double ("discovery", "netlogon-timeout", 5);
+	if (timeout > 0)
+		clo->timeout_id = g_timeout_add (timeout * 1000, on_timeout, task);
+
+	/* Sends the first ping right away */
+	on_resend (task);
+
 	g_object_unref (task);
 }
 
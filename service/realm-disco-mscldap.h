@@ -22,7 +22,6 @@
 #include <ldap.h>
 
 void           realm_disco_mscldap_async      (GSocketAddress *address,
-                                               GSocketProtocol protocol,
                                                const gchar *explicit_server,
                                                GCancellable *cancellable,
                                                GAsyncReadyCallback callback,
@@ -0,0 +1,236 @@
+/* realmd -- Realm configuration service
+ *
+ * Copyright 2026 The realmd contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2 of the licence or (at
+ * your option) any later version.
+ *
+ * See the included COPYING file for more information.
+ */
+
+#include "config.h"
+
+#include "realm-disco-netlogon.h"
+
+#include <string.h>
+
+/*
+ * Decodes the NetLogon attribute that a domain controller returns to a
+ * NetLogon ping. This is done for every server we probe, so it doesn't
+ * allocate or copy anything: the names in the response are only checked
+ * while decoding, and expanded into a caller's buffer when asked for.
+ *
+ * The names are RFC 1035 compressed. Compression pointers must point
+ * backwards, before the name that contains them, so that following
+ * them always ends.
+ */
+
+static gssize
+walk_name (const guchar *beg,
+           const guchar *end,
+           gsize offset,
+           gchar *buffer,
+           gsize size,
+           gsize *consumed)
+{
+	const guchar *at;
+	const guchar *limit;
+	gboolean jumped = FALSE;
+	gsize out = 0;
+	gsize target;
+	guchar len;
+
+	if (offset >= (gsize)(end - beg))
+		return -1;
+
+	at = beg + offset;
+	limit = at;
+
+	for (;;) {
+		if (at >= end)
+			return -1;
+
+		len = *at;
+
+		/* The end of the name */
+		if (len == 0) {
+			if (!jumped && consumed)
+				*consumed = (at + 1) - (beg + offset);
+			break;
+
+		/* A compression pointer */
+		} else if ((len & 0xC0) == 0xC0) {
+			if (end - at < 2)
+				return -1;
+			target = ((len & 0x3F) << 8) | at[1];
+			if (!jumped && consumed)
+				*consumed = (at + 2) - (beg + offset);
+			if (target >= (gsize)(limit - beg))
+				return -1;
+			jumped = TRUE;
+			at = beg + target;
+			limit = at;
+
+		/* Reserved label types */
+		} else if (len & 0xC0) {
+			return -1;
+
+		/* A plain label */
+		} else {
+			if (end - at < len + 1)
+				return -1;
+			/* Can't be represented as a string */
+			if (memchr (at + 1, '\0', len))
+				return -1;
+			if (out + len + (out ? 1 : 0) >= REALM_NETLOGON_MAX_NAME)
+				return -1;
+			if (buffer) {
+				if (out + len + (out ? 1 : 0) >= size)
+					return -1;
+				if (out)
+					buffer[out] = '.';
+				memcpy (buffer + out + (out ? 1 : 0), at + 1, len);
+			}
+			out += len + (out ? 1 : 0);
+			at += len + 1;
+		}
+	}
+
+	if (buffer) {
+		if (out >= size)
+			return -1;
+		buffer[out] = '\0';
+	}
+
+	return out;
+}
+
+static gboolean
+read_name (const guchar *beg,
+           const guchar *end,
+           const guchar **at,
+           gssize *offset)
+{
+	gsize consumed = 0;
+
+	if (walk_name (beg, end, *at - beg, NULL, 0, &consumed) < 0)
+		return FALSE;
+
+	*offset = *at - beg;
+	(*at) += consumed;
+	return TRUE;
+}
+
+static guint16
+load_16_le (const guchar *p)
+{
+	return p[0] | p[1] << 8;
+}
+
+static guint32
+load_32_le (const guchar *p)
+{
+	return (guint32)p[0] | (guint32)p[1] << 8 |
+	       (guint32)p[2] << 16 | (guint32)p[3] << 24;
+}
+
+/**
+ * realm_disco_netlogon_decode:
+ * @data: the NetLogon attribute value
+ * @length: length of @data
+ * @netlogon: filled in with the decoded response
+ *
+ * Decode a NETLOGON_SAM_LOGON_RESPONSE_EX. @netlogon refers to @data
+ * afterwards, so @data must outlive it.
+ *
+ * Returns: whether the response was valid
+ */
+gboolean
+realm_disco_netlogon_decode (const guchar *data,
+                             gsize length,
+                             RealmNetlogon *netlogon)
+{
+	const guchar *at, *end, *tail;
+	gint i;
+
+	g_return_val_if_fail (netlogon != NULL, FALSE);
+
+	/* Opcode, Sbz, Flags, DomainGuid, then the tail at the end */
+	if (data == NULL || length < 24 + 8)
+		return FALSE;
+
+	at = data;
+	end = data + length;
+	tail = end - 8;
+
+	netlogon->data = data;
+	netlogon->length = length;
+	netlogon->opcode = load_16_le (at);
+	if (netlogon->opcode != REALM_NETLOGON_LOGON_SAM_LOGON_RESPONSE_EX)
+		return FALSE;
+
+	/* The Sbz field is ignored */
+	netlogon->flags = load_32_le (at + 4);
+	memcpy (netlogon->domain_guid, at + 8, 16);
+	at += 24;
+
+	/* The version decides which of the optional fields are present */
+	netlogon->nt_version = load_32_le (tail);
+	netlogon->lm_nt_token = load_16_le (tail + 4);
+	netlogon->lm_20_token = load_16_le (tail + 6);
+
+	for (i = 0; i < REALM_NETLOGON_N_NAMES; i++)
+		netlogon->names[i] = -1;
+	for (i = REALM_NETLOGON_FOREST; i <= REALM_NETLOGON_CLIENT_SITE; i++) {
+		if (!read_name (data, tail, &at, &netlogon->names[i]))
+			return FALSE;
+	}
+
+	netlogon->sockaddr = NULL;
+	netlogon->sockaddr_size = 0;
+	if (netlogon->nt_version & REALM_NETLOGON_NT_VERSION_5EX_WITH_IP) {
+		if (at >= tail || (gsize)(tail - at - 1) < at[0])
+			return FALSE;
+		netlogon->sockaddr_size = at[0];
+		netlogon->sockaddr = at + 1;
+		at += 1 + netlogon->sockaddr_size;
+	}
+
+	if (netlogon->nt_version & REALM_NETLOGON_NT_VERSION_WITH_CLOSEST_SITE) {
+		if (!read_name (data, tail, &at, &netlogon->names[REALM_NETLOGON_NEXT_CLOSEST_SITE]))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * realm_disco_netlogon_name:
+ * @netlogon: a decoded response
+ * @name: which name to expand
+ * @buffer: buffer to place the nul terminated name in
+ * @size: size of @buffer, REALM_NETLOGON_MAX_NAME is always enough
+ *
+ * Expand one of the names in a decoded response. An empty name expands
+ * to an empty string.
+ *
+ * Returns: the length of the name, or -1 if not present or too long
+ */
+gssize
+realm_disco_netlogon_name (const RealmNetlogon *netlogon,
+                           RealmNetlogonName name,
+                           gchar *buffer,
+                           gsize size)
+{
+	g_return_val_if_fail (netlogon != NULL, -1);
+	g_return_val_if_fail (name < REALM_NETLOGON_N_NAMES, -1);
+	g_return_val_if_fail (buffer != NULL, -1);
+
+	if (netlogon->names[name] < 0)
+		return -1;
+
+	return walk_name (netlogon->data, netlogon->data + netlogon->length,
+	                  netlogon->names[name], buffer, size, NULL);
+}
@@ -0,0 +1,85 @@
+/* realmd -- Realm configuration service
+ *
+ * Copyright 2026 The realmd contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2 of the licence or (at
+ * your option) any later version.
+ *
+ * See the included COPYING file for more information.
+ */
+
+#include "config.h"
+
+#ifndef __REALM_DISCO_NETLOGON_H__
+#define __REALM_DISCO_NETLOGON_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* NETLOGON_SAM_LOGON_RESPONSE_EX opcode */
+#define REALM_NETLOGON_LOGON_SAM_LOGON_RESPONSE_EX  23
+
+/* Bits in the NtVersion field */
+#define REALM_NETLOGON_NT_VERSION_1               0x01
+#define REALM_NETLOGON_NT_VERSION_5               0x02
+#define REALM_NETLOGON_NT_VERSION_5EX             0x04
+#define REALM_NETLOGON_NT_VERSION_5EX_WITH_IP     0x08
+#define REALM_NETLOGON_NT_VERSION_WITH_CLOSEST_SITE 0x10
+
+/* Longest expanded name, including the terminating nul */
+#define REALM_NETLOGON_MAX_NAME  256
+
+/* The names in a response, in the order they appear */
+typedef enum {
+	REALM_NETLOGON_FOREST,
+	REALM_NETLOGON_DNS_DOMAIN,
+	REALM_NETLOGON_DNS_HOST,
+	REALM_NETLOGON_NETBIOS_DOMAIN,
+	REALM_NETLOGON_NETBIOS_HOST,
+	REALM_NETLOGON_USER,
+	REALM_NETLOGON_SERVER_SITE,
+	REALM_NETLOGON_CLIENT_SITE,
+	REALM_NETLOGON_NEXT_CLOSEST_SITE,
+	REALM_NETLOGON_N_NAMES
+} RealmNetlogonName;
+
+/*
+ * A decoded NETLOGON_SAM_LOGON_RESPONSE_EX [MS-ADTS 6.3.1.9]. Nothing is
+ * copied: the names are offsets into the data, which must stay around
+ * while they are expanded with realm_disco_netlogon_name().
+ */
+typedef struct {
+	const guchar *data;
+	gsize length;
+
+	guint16 opcode;
+	guint32 flags;
+	guchar domain_guid[16];
+
+	/* Offset of each name, or -1 if not present */
+	gssize names[REALM_NETLOGON_N_NAMES];
+
+	/* Only with REALM_NETLOGON_NT_VERSION_5EX_WITH_IP */
+	const guchar *sockaddr;
+	gsize sockaddr_size;
+
+	guint32 nt_version;
+	guint16 lm_nt_token;
+	guint16 lm_20_token;
+} RealmNetlogon;
+
+gboolean       realm_disco_netlogon_decode     (const guchar *data,
+                                                gsize length,
+                                                RealmNetlogon *netlogon);
+
+gssize         realm_disco_netlogon_name       (const RealmNetlogon *netlogon,
+                                                RealmNetlogonName name,
+                                                gchar *buffer,
+                                                gsize size);
+
+G_END_DECLS
+
+#endif /* __REALM_DISCO_NETLOGON_H__ */
@@ -0,0 +1,354 @@
+/* realmd -- Realm configuration service
+ *
+ * Copyright 2026 The realmd contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2 of the licence or (at
+ * your option) any later version.
+ *
+ * See the included COPYING file for more information.
+ */
+
+#include "config.h"
+
+#include "realm-disco-cache.h"
+#include "realm-disco-records.h"
+#include "realm-disco-srv.h"
+#include "realm-settings.h"
+
+/*
+ * Every provider wants to know about the same handful of DNS records when
+ * discovering a name: the LDAP and Kerberos SRV records and the addresses
+ * of the name itself. Rather than each provider querying these one after
+ * another, we query them all in parallel once, and hand the same results
+ * to every caller that asks while the queries are in flight.
+ *
+ * The queries themselves are not cancelled when a caller goes away, since
+ * other callers may be waiting on them. Each caller can still cancel its
+ * own wait. The SRV and host queries are given up on after the [discovery]
+ * srv-timeout and host-timeout settings, which counts as a temporary
+ * failure rather than an absence of records.
+ *
+ * The LDAP SRV lookup also keeps the addresses of its targets when the DNS
+ * server sends them along, so discovery needn't look each one up again.
+ */
+
+typedef struct {
+	gchar *key;
+	RealmDiscoRecords *records;
+	GError *udp_error;
+	GList *tcp_targets;
+	GError *tcp_error;
+	gint outstanding;
+	GCancellable *srv_cancellable;
+	guint srv_timeout_id;
+	GCancellable *host_cancellable;
+	guint host_timeout_id;
+	GList *waiters;
+} Lookup;
+
+typedef struct {
+	GTask *task;
+	Lookup *lookup;
+	GSource *cancel_source;
+} Waiter;
+
+static GHashTable *inflight = NULL;
+
+RealmDiscoRecords *
+realm_disco_records_ref (RealmDiscoRecords *records)
+{
+	g_return_val_if_fail (records != NULL, NULL);
+	g_atomic_int_inc (&records->refs);
+	return records;
+}
+
+void
+realm_disco_records_unref (gpointer data)
+{
+	RealmDiscoRecords *records = data;
+
+	if (!data)
+		return;
+
+	if (!g_atomic_int_dec_and_test (&records->refs))
+		return;
+
+	g_free (records->name);
+	g_list_free_full (records->ldap_targets, (GDestroyNotify)g_srv_target_free);
+	if (records->ldap_glue)
+		g_hash_table_unref (records->ldap_glue);
+	g_list_free_full (records->kerberos_targets, (GDestroyNotify)g_srv_target_free);
+	g_list_free_full (records->addresses, g_object_unref);
+	g_clear_error (&records->ldap_error);
+	g_clear_error (&records->kerberos_error);
+	g_clear_error (&records->host_error);
+	g_free (records);
+}
+
+static void
+waiter_free (Waiter *waiter)
+{
+	if (waiter->cancel_source) {
+		g_source_destroy (waiter->cancel_source);
+		g_source_unref (waiter->cancel_source);
+	}
+	g_object_unref (waiter->task);
+	g_free (waiter);
+}
+
+static void
+lookup_free (gpointer data)
+{
+	Lookup *lookup = data;
+
+	g_assert (lookup->waiters == NULL);
+	g_free (lookup->key);
+	realm_disco_records_unref (lookup->records);
+	g_list_free_full (lookup->tcp_targets, (GDestroyNotify)g_srv_target_free);
+	g_clear_error (&lookup->udp_error);
+	g_clear_error (&lookup->tcp_error);
+	g_object_unref (lookup->srv_cancellable);
+	g_object_unref (lookup->host_cancellable);
+	g_assert (lookup->srv_timeout_id == 0);
+	g_assert (lookup->host_timeout_id == 0);
+	g_free (lookup);
+}
+
+static void
+complete_lookup (Lookup *lookup)
+{
+	RealmDiscoRecords *records = lookup->records;
+	Waiter *waiter;
+
+	if (lookup->srv_timeout_id)
+		g_source_remove (lookup->srv_timeout_id);
+	lookup->srv_timeout_id = 0;
+	if (lookup->host_timeout_id)
+		g_source_remove (lookup->host_timeout_id);
+	lookup->host_timeout_id = 0;
+
+	/* Prefer _kerberos._udp, but fall back to _kerberos._tcp */
+	if (records->kerberos_targets == NULL && lookup->tcp_targets != NULL) {
+		records->kerberos_targets = lookup->tcp_targets;
+		lookup->tcp_targets = NULL;
+		g_clear_error (&lookup->udp_error);
+
+	/* Only claim the name is missing if both say so */
+	} else if (records->kerberos_targets == NULL) {
+		if (g_error_matches (lookup->udp_error, G_RESOLVER_ERROR, G_RESOLVER_ERROR_NOT_FOUND) &&
+		    lookup->tcp_error != NULL) {
+			records->kerberos_error = lookup->tcp_error;
+			lookup->tcp_error = NULL;
+		} else {
+			records->kerberos_error = lookup->udp_error;
+			lookup->udp_error = NULL;
+		}
+	}
+
+	/* Later requests start new lookups */
+	g_hash_table_steal (inflight, lookup->key);
+
+	while (lookup->waiters) {
+		waiter = lookup->waiters->data;
+		lookup->waiters = g_list_delete_link (lookup->waiters, lookup->waiters);
+		g_task_return_pointer (waiter->task, realm_disco_records_ref (records),
+		                       realm_disco_records_unref);
+		waiter_free (waiter);
+	}
+
+	lookup_free (lookup);
+}
+
+static void
+check_timed_out (GError **error,
+                 const gchar *what,
+                 const gchar *name)
+{
+	/* Only our timeouts cancel these queries */
+	if (g_error_matches (*error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+		g_clear_error (error);
+		g_set_error (error, G_RESOLVER_ERROR, G_RESOLVER_ERROR_TEMPORARY_FAILURE,
+		             "Timed out looking up %s%s", what, name);
+	}
+}
+
+static void
+on_ldap_resolved (GObject *source,
+                  GAsyncResult *result,
+                  gpointer user_data)
+{
+	Lookup *lookup = user_data;
+	RealmDiscoRecords *records = lookup->records;
+
+	records->ldap_targets = realm_disco_srv_finish (result, &records->ldap_glue,
+	                                                &records->ldap_error);
+	check_timed_out (&records->ldap_error, "_ldap._tcp.", lookup->key);
+	if (--lookup->outstanding == 0)
+		complete_lookup (lookup);
+}
+
+static void
+on_kerberos_udp_resolved (GObject *source,
+                          GAsyncResult *result,
+                          gpointer user_data)
+{
+	Lookup *lookup = user_data;
+	RealmDiscoRecords *records = lookup->records;
+
+	records->kerberos_targets = g_resolver_lookup_service_finish (G_RESOLVER (source), result,
+	                                                              &lookup->udp_error);
+	check_timed_out (&lookup->udp_error, "_kerberos._udp.", lookup->key);
+	if (--lookup->outstanding == 0)
+		complete_lookup (lookup);
+}
+
+static void
+on_kerberos_tcp_resolved (GObject *source,
+                          GAsyncResult *result,
+                          gpointer user_data)
+{
+	Lookup *lookup = user_data;
+
+	lookup->tcp_targets = g_resolver_lookup_service_finish (G_RESOLVER (source), result,
+	                                                        &lookup->tcp_error);
+	check_timed_out (&lookup->tcp_error, "_kerberos._tcp.", lookup->key);
+	if (--lookup->outstanding == 0)
+		complete_lookup (lookup);
+}
+
+static void
+on_host_resolved (GObject *source,
+                  GAsyncResult *result,
+                  gpointer user_data)
+{
+	Lookup *lookup = user_data;
+	RealmDiscoRecords *records = lookup->records;
+
+	records->addresses = g_resolver_lookup_by_name_finish (G_RESOLVER (source), result,
+	                                                       &records->host_error);
+	check_timed_out (&records->host_error, "", lookup->key);
+	if (--lookup->outstanding == 0)
+		complete_lookup (lookup);
+}
+
+static gboolean
+on_waiter_cancelled (GCancellable *cancellable,
+                     gpointer user_data)
+{
+	Waiter *waiter = user_data;
+	Lookup *lookup = waiter->lookup;
+	GError *error = NULL;
+
+	lookup->waiters = g_list_remove (lookup->waiters, waiter);
+
+	g_cancellable_set_error_if_cancelled (cancellable, &error);
+	g_task_return_error (waiter->task, error);
+	waiter_free (waiter);
+
+	return FALSE;
+}
+
+static gboolean
+on_timeout (gpointer user_data)
+{
+	GCancellable *cancellable = user_data;
+	g_cancellable_cancel (cancellable);
+	return FALSE;
+}
+
+static guint
+start_timeout (const gchar *setting,
+               GCancellable *cancellable)
+{
+	gdouble timeout;
+
+	timeout = realm_settings_double ("discovery", setting, 5);
+	if (timeout <= 0)
+		return 0;
+
+	return g_timeout_add_full (G_PRIORITY_DEFAULT, timeout * 1000, on_timeout,
+	                           g_object_ref (cancellable), g_object_unref);
+}
+
+static Lookup *
+start_lookup (const gchar *key)
+{
+	GResolver *resolver;
+	Lookup *lookup;
+
+	lookup = g_new0 (Lookup, 1);
+	lookup->key = g_strdup (key);
+	lookup->records = g_new0 (RealmDiscoRecords, 1);
+	lookup->records->refs = 1;
+	lookup->records->name = g_strdup (key);
+
+	lookup->srv_cancellable = g_cancellable_new ();
+	lookup->host_cancellable = g_cancellable_new ();
+
+	resolver = g_resolver_get_default ();
+
+	realm_disco_srv_async ("ldap", "tcp", key, lookup->srv_cancellable,
+	                       on_ldap_resolved, lookup);
+	g_resolver_lookup_service_async (resolver, "kerberos", "udp", key, lookup->srv_cancellable,
+	                                 on_kerberos_udp_resolved, lookup);
+	g_resolver_lookup_service_async (resolver, "kerberos", "tcp", key, lookup->srv_cancellable,
+	                                 on_kerberos_tcp_resolved, lookup);
+	g_resolver_lookup_by_name_async (resolver, key, lookup->host_cancellable,
+	                                 on_host_resolved, lookup);
+	lookup->outstanding = 4;
+
+	lookup->srv_timeout_id = start_timeout ("srv-timeout", lookup->srv_cancellable);
+	lookup->host_timeout_id = start_timeout ("host-timeout", lookup->host_cancellable);
+
+	g_object_unref (resolver);
+	return lookup;
+}
+
+void
+realm_disco_records_async (const gchar *name,
+                           GCancellable *cancellable,
+                           GAsyncReadyCallback callback,
+                           gpointer user_data)
+{
+	Lookup *lookup;
+	Waiter *waiter;
+	gchar *key;
+
+	g_return_if_fail (name != NULL);
+
+	if (inflight == NULL)
+		inflight = g_hash_table_new (g_str_hash, g_str_equal);
+
+	key = realm_disco_cache_key (name);
+	lookup = g_hash_table_lookup (inflight, key);
+	if (lookup == NULL) {
+		lookup = start_lookup (key);
+		g_hash_table_insert (inflight, lookup->key, lookup);
+	} else {
+		g_debug ("Sharing DNS lookups for: %s", key);
+	}
+	g_free (key);
+
+	waiter = g_new0 (Waiter, 1);
+	waiter->task = g_task_new (NULL, cancellable, callback, user_data);
+	waiter->lookup = lookup;
+
+	if (cancellable) {
+		waiter->cancel_source = g_cancellable_source_new (cancellable);
+		g_source_set_callback (waiter->cancel_source, (GSourceFunc)on_waiter_cancelled,
+		                       waiter, NULL);
+		g_source_attach (waiter->cancel_source, g_main_context_get_thread_default ());
+	}
+
+	lookup->waiters = g_list_append (lookup->waiters, waiter);
+}
+
+RealmDiscoRecords *
+realm_disco_records_finish (GAsyncResult *result,
+                            GError **error)
+{
+	g_return_val_if_fail (g_task_is_valid (result, NULL), NULL);
+	return g_task_propagate_pointer (G_TASK (result), error);
+}
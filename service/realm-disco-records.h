@@ -0,0 +1,56 @@
+/* realmd -- Realm configuration service
+ *
+ * Copyright 2026 The realmd contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2 of the licence or (at
+ * your option) any later version.
+ *
+ * See the included COPYING file for more information.
+ */
+
+#include "config.h"
+
+#ifndef __REALM_DISCO_RECORDS_H__
+#define __REALM_DISCO_RECORDS_H__
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+typedef struct {
+	gint refs;
+	gchar *name;
+
+	/* GSrvTarget for _ldap._tcp */
+	GList *ldap_targets;
+	GError *ldap_error;
+
+	/* Addresses of the _ldap._tcp targets sent with the SRV response, or NULL */
+	GHashTable *ldap_glue;
+
+	/* GSrvTarget for _kerberos._udp, or else _kerberos._tcp */
+	GList *kerberos_targets;
+	GError *kerberos_error;
+
+	/* GInetAddress for the name itself */
+	GList *addresses;
+	GError *host_error;
+} RealmDiscoRecords;
+
+void                  realm_disco_records_async     (const gchar *name,
+                                                     GCancellable *cancellable,
+                                                     GAsyncReadyCallback callback,
+                                                     gpointer user_data);
+
+RealmDiscoRecords *   realm_disco_records_finish    (GAsyncResult *result,
+                                                     GError **error);
+
+RealmDiscoRecords *   realm_disco_records_ref       (RealmDiscoRecords *records);
+
+void                  realm_disco_records_unref     (gpointer records);
+
+G_END_DECLS
+
+#endif /* __REALM_DISCO_RECORDS_H__ */
@@ -20,6 +20,8 @@
 #include "realm-disco-rootdse.h"
 #include "realm-ldap.h"
 #include "realm-options.h"
+#include "realm-settings.h"
+#include "realm-trace.h"
 
 #include <glib/gi18n.h>
 
@@ -33,7 +35,14 @@ struct _Closure {
 	GDBusMethodInvocation *invocation;
 
 	gchar *default_naming_context;
+	gchar *configuration_context;
+	GPtrArray *names;
 	gint msgid;
+	gint msgall;
+	gboolean reusable;
+	gboolean pooled;
+	GSocketAddress *source_address;
+	RealmTraceSpan *span;
 
 	gboolean (* request) (GTask *task,
 	                      Closure *clo,
@@ -51,10 +60,16 @@ closure_free (gpointer data)
 	Closure *clo = data;
 
 	ldap_memfree (clo->default_naming_context);
+	g_free (clo->configuration_context);
+	if (clo->names)
+		g_ptr_array_unref (clo->names);
+	realm_trace_end (clo->span, NULL);
 
-	g_source_destroy (clo->source);
+	if (!clo->pooled)
+		g_source_destroy (clo->source);
 	g_source_unref (clo->source);
 	g_clear_object (&clo->invocation);
+	g_object_unref (clo->source_address);
 	realm_disco_unref (clo->disco);
 	g_free (clo);
 }
@@ -115,6 +130,40 @@ entry_get_attribute (LDAP *ldap,
 	return value;
 }
 
+static void
+set_phase_deadline (Closure *clo,
+                    const gchar *setting,
+                    gdouble def)
+{
+	gdouble timeout;
+
+	/* Each phase of the exchange gets its own deadline */
+	timeout = realm_settings_double ("discovery", setting, def);
+	if (timeout > 0) {
+		realm_ldap_set_deadline (clo->source, g_get_monotonic_time () +
+		                         timeout * G_TIME_SPAN_SECOND);
+	} else {
+		realm_ldap_set_deadline (clo->source, 0);
+	}
+}
+
+static void
+begin_phase (Closure *clo,
+             const gchar *phase)
+{
+	GInetSocketAddress *inet;
+	gchar *string;
+
+	/* The previous phase went fine, or we wouldn't be here */
+	realm_trace_end (clo->span, NULL);
+
+	inet = G_INET_SOCKET_ADDRESS (clo->source_address);
+	string = g_inet_address_to_string (g_inet_socket_address_get_address (inet));
+	clo->span = realm_trace_begin (clo->invocation, "ldap", "%s: %s:%u", phase, string,
+	                               (guint)g_inet_socket_address_get_port (inet));
+	g_free (string);
+}
+
 static gboolean
 search_ldap (GTask *task,
              Closure *clo,
@@ -159,6 +208,7 @@ result_krb_realm (GTask *task,
 	g_debug ("Found realm: %s", clo->disco->kerberos_realm);
 
 	/* All done */
+	clo->reusable = TRUE;
 	g_task_return_boolean (task, TRUE);
 	return FALSE;
 }
@@ -170,6 +220,7 @@ request_krb_realm (GTask *task,
 {
 	const char *attrs[] = { "cn", NULL };
 
+	set_phase_deadline (clo, "rootdse-timeout", 5);
 	clo->request = NULL;
 	clo->result = result_krb_realm;
 
@@ -226,12 +277,82 @@ request_domain_info (GTask *task,
                      LDAP *ldap)
 {
 	const char *attrs[] = { "info", "associatedDomain", NULL };
-	int ret;
-	int ldap_opt_val;
 
+	begin_phase (clo, "Domain info");
+	set_phase_deadline (clo, "rootdse-timeout", 5);
 	clo->request = NULL;
 	clo->result = result_domain_info;
 
+	return search_ldap (task, clo, ldap, clo->default_naming_context,
+	                    LDAP_SCOPE_BASE, NULL, attrs);
+}
+
+static void
+on_install_tls (GObject *source,
+                GAsyncResult *result,
+                gpointer user_data)
+{
+	GTask *task = G_TASK (user_data);
+	Closure *clo = g_task_get_task_data (task);
+	GError *error = NULL;
+
+	if (!realm_ldap_install_tls_finish (result, &error)) {
+		g_debug ("Failed to setup TLS tunnel, trying without: %s", error->message);
+		g_error_free (error);
+	}
+
+	/* Next search for IPA field */
+	clo->request = request_domain_info;
+	clo->result = NULL;
+	realm_ldap_set_condition (clo->source, G_IO_OUT);
+
+	g_object_unref (task);
+}
+
+static gboolean
+result_start_tls (GTask *task,
+                  Closure *clo,
+                  LDAP *ldap,
+                  LDAPMessage *message)
+{
+	int code;
+	int ret;
+
+	realm_ldap_set_deadline (clo->source, 0);
+
+	/* Next search for IPA field */
+	clo->request = request_domain_info;
+	clo->result = NULL;
+
+	ret = ldap_parse_result (ldap, message, &code, NULL, NULL, NULL, NULL, 0);
+	if (ret != LDAP_SUCCESS || code != LDAP_SUCCESS) {
+		g_debug ("Server refused TLS tunnel, trying without");
+		return TRUE;
+	}
+
+	/*
+	 * The server agreed to StartTLS. The handshake happens in another
+	 * thread, and the connection is left alone until on_install_tls().
+	 */
+	clo->request = NULL;
+	realm_ldap_install_tls_async (clo->source,
+	                              realm_settings_double ("discovery", "starttls-timeout", 5),
+	                              on_install_tls, g_object_ref (task));
+	return TRUE;
+}
+
+static gboolean
+request_start_tls (GTask *task,
+                   Closure *clo,
+                   LDAP *ldap)
+{
+	int ret;
+	int ldap_opt_val;
+
+	/* A pooled connection that is already encrypted */
+	if (ldap_tls_inplace (ldap))
+		return request_domain_info (task, clo, ldap);
+
 	/* Trying to setup a TLS tunnel in the case the IPA server requires an
 	 * encrypted connected. Trying without in case of an error. Since we
 	 * most probably do not have the IPA CA certificate we will not check
@@ -248,13 +369,22 @@ request_domain_info (GTask *task,
 		g_debug ("Failed to refresh LDAP context for TLS, trying without");
 	}
 
-	ret = ldap_start_tls_s (ldap, NULL, NULL);
+	/*
+	 * Only send the StartTLS request here, and wait for the response
+	 * in result_start_tls() from the main loop, rather than blocking.
+	 */
+	begin_phase (clo, "StartTLS");
+	ret = ldap_start_tls (ldap, NULL, NULL, &clo->msgid);
 	if (ret != LDAP_SUCCESS) {
 		g_debug ("Failed to setup TLS tunnel, trying without");
+		return request_domain_info (task, clo, ldap);
 	}
 
-	return search_ldap (task, clo, ldap, clo->default_naming_context,
-	                    LDAP_SCOPE_BASE, NULL, attrs);
+	set_phase_deadline (clo, "starttls-timeout", 5);
+
+	clo->request = NULL;
+	clo->result = result_start_tls;
+	return TRUE;
 }
 
 static void
@@ -290,6 +420,7 @@ result_netlogon (GTask *task,
 
 	if (realm_disco_mscldap_result (ldap, message, clo->disco, &error)) {
 		g_debug ("Received TCP Netlogon response");
+		clo->reusable = TRUE;
 		g_task_return_boolean (task, TRUE);
 	} else {
 		g_debug ("Failed TCP Netlogon response: %s", error->message);
@@ -308,12 +439,15 @@ request_netlogon (GTask *task,
 	GError *error = NULL;
 
 	g_debug ("Sending TCP Netlogon request");
+	begin_phase (clo, "NetLogon");
 
 	if (!realm_disco_mscldap_request (ldap, &clo->msgid, &error)) {
 		g_task_return_error (task, error);
 		return FALSE;
 	}
 
+	set_phase_deadline (clo, "netlogon-timeout", 5);
+
 	clo->request = NULL;
 	clo->result = result_netlogon;
 	return TRUE;
@@ -329,6 +463,9 @@ result_root_dse (GTask *task,
 	LDAPMessage *entry;
 	gchar *string;
 
+	/* The server answered, so it's not one of the dead ones */
+	realm_ldap_set_deadline (clo->source, 0);
+
 	entry = ldap_first_entry (ldap, message);
 
 	/* Parse out the default naming context */
@@ -359,11 +496,14 @@ result_root_dse (GTask *task,
 			realm_diagnostics_info (clo->invocation, "Sending MS-CLDAP ping to: %s", string);
 			g_free (string);
 
-			realm_disco_mscldap_async (clo->disco->server_address, G_SOCKET_PROTOCOL_UDP,
+			begin_phase (clo, "CLDAP NetLogon");
+
+			realm_disco_mscldap_async (clo->disco->server_address,
 			                           clo->disco->explicit_server, g_task_get_cancellable (task),
 			                           on_udp_mscldap_complete, g_object_ref (task));
 
-			/* Disconnect from TCP at this point */
+			/* Done with TCP at this point */
+			clo->reusable = TRUE;
 			return FALSE;
 		}
 
@@ -376,8 +516,8 @@ result_root_dse (GTask *task,
 			return FALSE;
 		}
 
-		/* Next search for IPA field */
-		clo->request = request_domain_info;
+		/* Try to use TLS, and then search for IPA field */
+		clo->request = request_start_tls;
 		clo->result = NULL;
 		return TRUE;
 	}
@@ -390,12 +530,137 @@ request_root_dse (GTask *task,
 {
 	const char *attrs[] = { "defaultNamingContext", "supportedCapabilities", NULL };
 
+	/* Connected, so now wait for the answer */
+	begin_phase (clo, "rootDSE");
+	set_phase_deadline (clo, "rootdse-timeout", 5);
+
 	clo->request = NULL;
 	clo->result = result_root_dse;
 
 	return search_ldap (task, clo, ldap, "", LDAP_SCOPE_BASE, NULL, attrs);
 }
 
+/* The crossRef objects for domains, rather than application partitions */
+#define PARTITIONS_FILTER "(&(objectClass=crossRef)(systemFlags:1.2.840.113556.1.4.803:=2))"
+
+static gboolean
+check_search_result (GTask *task,
+                     LDAP *ldap,
+                     LDAPMessage *message)
+{
+	char *info = NULL;
+	int code;
+	int ret;
+
+	ret = ldap_parse_result (ldap, message, &code, NULL, &info, NULL, NULL, 0);
+	if (ret != LDAP_SUCCESS)
+		code = ret;
+
+	/* Usually a server that won't answer anonymous clients */
+	if (code != LDAP_SUCCESS) {
+		g_task_return_new_error (task, REALM_LDAP_ERROR, code, "%s",
+		                         info && info[0] ? info : ldap_err2string (code));
+	}
+
+	ldap_memfree (info);
+	return code == LDAP_SUCCESS;
+}
+
+static gboolean
+result_partitions (GTask *task,
+                   Closure *clo,
+                   LDAP *ldap,
+                   LDAPMessage *message)
+{
+	LDAPMessage *entry;
+	gchar *name;
+
+	realm_ldap_set_deadline (clo->source, 0);
+
+	if (!check_search_result (task, ldap, message))
+		return FALSE;
+
+	for (entry = ldap_first_entry (ldap, message); entry != NULL;
+	     entry = ldap_next_entry (ldap, entry)) {
+		name = entry_get_attribute (ldap, entry, "dnsRoot", TRUE);
+		if (name != NULL) {
+			g_debug ("Found domain in forest: %s", name);
+			g_ptr_array_add (clo->names, name);
+		}
+	}
+
+	/* All done */
+	clo->reusable = TRUE;
+	g_task_return_boolean (task, TRUE);
+	return FALSE;
+}
+
+static gboolean
+request_partitions (GTask *task,
+                    Closure *clo,
+                    LDAP *ldap)
+{
+	const char *attrs[] = { "dnsRoot", NULL };
+	gboolean ret;
+	gchar *base;
+
+	begin_phase (clo, "Partitions");
+	set_phase_deadline (clo, "rootdse-timeout", 5);
+	clo->request = NULL;
+	clo->result = result_partitions;
+
+	base = g_strdup_printf ("CN=Partitions,%s", clo->configuration_context);
+	ret = search_ldap (task, clo, ldap, base, LDAP_SCOPE_ONELEVEL, PARTITIONS_FILTER, attrs);
+	g_free (base);
+
+	return ret;
+}
+
+static gboolean
+result_configuration (GTask *task,
+                      Closure *clo,
+                      LDAP *ldap,
+                      LDAPMessage *message)
+{
+	LDAPMessage *entry;
+
+	realm_ldap_set_deadline (clo->source, 0);
+
+	if (!check_search_result (task, ldap, message))
+		return FALSE;
+
+	entry = ldap_first_entry (ldap, message);
+	clo->configuration_context = entry_get_attribute (ldap, entry, "configurationNamingContext", FALSE);
+
+	if (clo->configuration_context == NULL) {
+		g_task_return_new_error (task, REALM_LDAP_ERROR, LDAP_NO_SUCH_OBJECT,
+		                         "Couldn't find configuration naming context on LDAP server");
+		return FALSE;
+	}
+
+	g_debug ("Got configurationNamingContext: %s", clo->configuration_context);
+
+	/* Next list the domains */
+	clo->request = request_partitions;
+	clo->result = NULL;
+	return TRUE;
+}
+
+static gboolean
+request_configuration (GTask *task,
+                       Closure *clo,
+                       LDAP *ldap)
+{
+	const char *attrs[] = { "configurationNamingContext", NULL };
+
+	begin_phase (clo, "Configuration");
+	set_phase_deadline (clo, "rootdse-timeout", 5);
+	clo->request = NULL;
+	clo->result = result_configuration;
+
+	return search_ldap (task, clo, ldap, "", LDAP_SCOPE_BASE, NULL, attrs);
+}
+
 static GIOCondition
 on_ldap_io (LDAP *ldap,
             GIOCondition cond,
@@ -417,10 +682,16 @@ on_ldap_io (LDAP *ldap,
 
 	/* Ready to get a result */
 	if (cond & G_IO_IN && clo->result != NULL) {
-		switch (ldap_result (ldap, clo->msgid, 0, &tvpoll, &message)) {
+		switch (ldap_result (ldap, clo->msgid, clo->msgall, &tvpoll, &message)) {
 		case LDAP_RES_INTERMEDIATE:
 		case LDAP_RES_SEARCH_REFERENCE:
-			ret = TRUE;
+			/* When waiting for everything, these can come first */
+			if (clo->msgall == LDAP_MSG_ALL) {
+				ret = clo->result (task, clo, ldap, message);
+				ldap_msgfree (message);
+			} else {
+				ret = TRUE;
+			}
 			break;
 		case -1:
 			realm_ldap_set_error (&error, ldap, -1);
@@ -436,6 +707,13 @@ on_ldap_io (LDAP *ldap,
 			break;
 		}
 
+		/* Done with the connection, keep it around if still good */
+		if (!ret && clo->reusable &&
+		    realm_ldap_pool_give (clo->source_address, clo->source)) {
+			clo->pooled = TRUE;
+			return G_IO_IN;
+		}
+
 		if (!ret)
 			return G_IO_NVAL;
 	}
@@ -449,6 +727,34 @@ on_ldap_io (LDAP *ldap,
 	       (clo->result ? G_IO_IN : 0);
 }
 
+static void
+begin_exchange (GTask *task,
+                Closure *clo,
+                GCancellable *cancellable)
+{
+	gboolean reused;
+
+	/* Reuse an earlier connection to the same server if possible */
+	clo->source = realm_ldap_pool_take (clo->source_address, cancellable);
+	reused = (clo->source != NULL);
+	if (!reused) {
+		begin_phase (clo, "Connect");
+		clo->source = realm_ldap_connect_anonymous (clo->source_address, G_SOCKET_PROTOCOL_TCP,
+		                                            cancellable);
+	}
+
+	g_source_set_callback (clo->source, (GSourceFunc)on_ldap_io,
+	                       g_object_ref (task), g_object_unref);
+
+	/* Give up on servers that don't accept a connection */
+	set_phase_deadline (clo, "connect-timeout", 3);
+
+	if (reused)
+		realm_ldap_set_condition (clo->source, G_IO_OUT);
+	else
+		g_source_attach (clo->source, g_task_get_context (task));
+}
+
 void
 realm_disco_rootdse_async (GSocketAddress *address,
                            const gchar *explicit_server,
@@ -467,17 +773,13 @@ realm_disco_rootdse_async (GSocketAddress *address,
 	clo->disco = realm_disco_new (NULL);
 	clo->disco->explicit_server = g_strdup (explicit_server);
 	clo->disco->server_address = g_object_ref (address);
+	clo->source_address = g_object_ref (address);
 
 	clo->invocation = invocation ? g_object_ref (invocation) : NULL;
 	clo->request = request_root_dse;
 	g_task_set_task_data (task, clo, closure_free);
 
-	clo->source = realm_ldap_connect_anonymous (address, G_SOCKET_PROTOCOL_TCP,
-	                                            cancellable);
-	g_source_set_callback (clo->source, (GSourceFunc)on_ldap_io,
-	                       g_object_ref (task), g_object_unref);
-	g_source_attach (clo->source, g_task_get_context (task));
-
+	begin_exchange (task, clo, cancellable);
 	g_object_unref (task);
 }
 
@@ -485,16 +787,25 @@ RealmDisco *
 realm_disco_rootdse_finish (GAsyncResult *result,
                             GError **error)
 {
+	GError *err = NULL;
 	Closure *clo;
 	RealmDisco *disco;
 
 	g_return_val_if_fail (g_task_is_valid (result, NULL), NULL);
 	g_return_val_if_fail (error == NULL || *error == NULL, NULL);
 
-	if (!g_task_propagate_boolean (G_TASK (result), error))
+	/* The last phase ends with the whole exchange */
+	clo = g_task_get_task_data (G_TASK (result));
+	if (!g_task_propagate_boolean (G_TASK (result), &err)) {
+		realm_trace_end (clo->span, err);
+		clo->span = NULL;
+		g_propagate_error (error, err);
 		return FALSE;
+	}
+
+	realm_trace_end (clo->span, NULL);
+	clo->span = NULL;
 
-	clo = g_task_get_task_data (G_TASK (result));
 	disco = clo->disco;
 	clo->disco = NULL;
 
@@ -506,3 +817,61 @@ realm_disco_rootdse_finish (GAsyncResult *result,
 
 	return disco;
 }
+
+void
+realm_disco_rootdse_partitions_async (GSocketAddress *address,
+                                      GDBusMethodInvocation *invocation,
+                                      GCancellable *cancellable,
+                                      GAsyncReadyCallback callback,
+                                      gpointer user_data)
+{
+	GTask *task;
+	Closure *clo;
+
+	g_return_if_fail (address != NULL);
+
+	task = g_task_new (NULL, cancellable, callback, user_data);
+	clo = g_new0 (Closure, 1);
+	clo->source_address = g_object_ref (address);
+	clo->names = g_ptr_array_new_with_free_func (g_free);
+
+	/* Wait for all the crossRef entries at once */
+	clo->msgall = LDAP_MSG_ALL;
+
+	clo->invocation = invocation ? g_object_ref (invocation) : NULL;
+	clo->request = request_configuration;
+	g_task_set_task_data (task, clo, closure_free);
+
+	/* Usually the connection that discovery just finished with */
+	begin_exchange (task, clo, cancellable);
+	g_object_unref (task);
+}
+
+gchar **
+realm_disco_rootdse_partitions_finish (GAsyncResult *result,
+                                       GError **error)
+{
+	GError *err = NULL;
+	Closure *clo;
+	gchar **names;
+
+	g_return_val_if_fail (g_task_is_valid (result, NULL), NULL);
+	g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+	clo = g_task_get_task_data (G_TASK (result));
+	if (!g_task_propagate_boolean (G_TASK (result), &err)) {
+		realm_trace_end (clo->span, err);
+		clo->span = NULL;
+		g_propagate_error (error, err);
+		return NULL;
+	}
+
+	realm_trace_end (clo->span, NULL);
+	clo->span = NULL;
+
+	g_ptr_array_add (clo->names, NULL);
+	names = (gchar **)g_ptr_array_free (clo->names, FALSE);
+	clo->names = NULL;
+
+	return names;
+}
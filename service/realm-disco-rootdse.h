@@ -29,4 +29,13 @@ void           realm_disco_rootdse_async    (GSocketAddress *address,
 RealmDisco *   realm_disco_rootdse_finish   (GAsyncResult *result,
                                              GError **error);
 
+void           realm_disco_rootdse_partitions_async   (GSocketAddress *address,
+                                                       GDBusMethodInvocation *invocation,
+                                                       GCancellable *cancellable,
+                                                       GAsyncReadyCallback callback,
+                                                       gpointer user_data);
+
+gchar **       realm_disco_rootdse_partitions_finish  (GAsyncResult *result,
+                                                       GError **error);
+
 #endif /* __REALM_DISCO_ROOTDSE_H__ */
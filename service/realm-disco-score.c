@@ -0,0 +1,320 @@
+/* realmd -- Realm configuration service
+ *
+ * Copyright 2026 The realmd contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2 of the licence or (at
+ * your option) any later version.
+ *
+ * See the included COPYING file for more information.
+ */
+
+#include "config.h"
+
+#include "realm-disco-score.h"
+
+#include <stdlib.h>
+
+/*
+ * A scoreboard of how domain controllers have responded to discovery
+ * probes, keyed by server address. Used to try known fast and healthy
+ * servers first, and to pick the server we join against.
+ */
+
+/* Data older than this isn't trusted */
+#define SCORE_MAX_AGE      (3600 * G_TIME_SPAN_SECOND)
+
+/* Don't grow without bounds */
+#define SCORE_MAX_ENTRIES  1024
+
+typedef struct {
+	gchar *domain;
+	gint64 rtt;
+	guint successes;
+	guint failures;
+	guint consecutive;
+	guint32 flags;
+	gint64 last_seen;
+	gint64 last_used;
+} Score;
+
+static GHashTable *scores = NULL;
+
+static void
+score_free (gpointer data)
+{
+	Score *score = data;
+	g_free (score->domain);
+	g_free (score);
+}
+
+static gchar *
+address_key (GSocketAddress *address)
+{
+	GInetAddress *inet;
+
+	if (!G_IS_INET_SOCKET_ADDRESS (address))
+		return NULL;
+
+	inet = g_inet_socket_address_get_address (G_INET_SOCKET_ADDRESS (address));
+	return g_inet_address_to_string (inet);
+}
+
+static void
+prune_scores (gint64 now)
+{
+	GHashTableIter iter;
+	const gchar *oldest = NULL;
+	gint64 oldest_used = G_MAXINT64;
+	const gchar *key;
+	Score *score;
+
+	g_hash_table_iter_init (&iter, scores);
+	while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&score)) {
+		if (now - score->last_used > SCORE_MAX_AGE)
+			g_hash_table_iter_remove (&iter);
+	}
+
+	if (g_hash_table_size (scores) < SCORE_MAX_ENTRIES)
+		return;
+
+	/* Forget the least recently used server */
+	g_hash_table_iter_init (&iter, scores);
+	while (g_hash_table_iter_next (&iter, (gpointer *)&key, (gpointer *)&score)) {
+		if (score->last_used < oldest_used) {
+			oldest_used = score->last_used;
+			oldest = key;
+		}
+	}
+
+	if (oldest != NULL)
+		g_hash_table_remove (scores, oldest);
+}
+
+static Score *
+lookup_score (GSocketAddress *address,
+              gboolean create)
+{
+	Score *score;
+	gchar *key;
+
+	key = address_key (address);
+	if (key == NULL)
+		return NULL;
+
+	if (scores == NULL) {
+		if (!create) {
+			g_free (key);
+			return NULL;
+		}
+		scores = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, score_free);
+	}
+
+	score = g_hash_table_lookup (scores, key);
+	if (score == NULL && create) {
+		if (g_hash_table_size (scores) >= SCORE_MAX_ENTRIES)
+			prune_scores (g_get_real_time ());
+		score = g_new0 (Score, 1);
+		g_hash_table_insert (scores, key, score);
+		key = NULL;
+	}
+
+	g_free (key);
+	return score;
+}
+
+/* Lower is better: 0 is healthy, 1 is unknown and 2 is failing */
+static gint
+score_rank (Score *score,
+            gint64 now)
+{
+	if (score == NULL || now - score->last_used > SCORE_MAX_AGE)
+		return 1;
+	if (score->consecutive > 0 || score->successes == 0)
+		return 2;
+	return 0;
+}
+
+void
+realm_disco_score_success (GSocketAddress *address,
+                           RealmDisco *disco,
+                           gint64 rtt)
+{
+	Score *score;
+
+	g_return_if_fail (disco != NULL);
+
+	score = lookup_score (address, TRUE);
+	if (score == NULL)
+		return;
+
+	if (disco->domain_name) {
+		g_free (score->domain);
+		score->domain = g_ascii_strdown (disco->domain_name, -1);
+	}
+
+	/* Smoothed like TCP does its round trip time */
+	if (score->successes == 0)
+		score->rtt = rtt;
+	else
+		score->rtt = (score->rtt * 7 + rtt) / 8;
+
+	score->successes++;
+	score->consecutive = 0;
+	score->flags = disco->server_flags;
+	score->last_seen = score->last_used = g_get_real_time ();
+}
+
+void
+realm_disco_score_failure (GSocketAddress *address)
+{
+	Score *score;
+
+	score = lookup_score (address, TRUE);
+	if (score == NULL)
+		return;
+
+	score->failures++;
+	score->consecutive++;
+	score->last_used = g_get_real_time ();
+}
+
+/* Looked up once for each address, before sorting */
+typedef struct {
+	GSocketAddress *address;
+	guint index;
+	gint rank;
+	gint64 rtt;
+} Order;
+
+static gint
+compare_order (gconstpointer a,
+               gconstpointer b)
+{
+	const Order *one = a;
+	const Order *two = b;
+
+	if (one->rank != two->rank)
+		return one->rank - two->rank;
+	if (one->rank == 0 && one->rtt != two->rtt)
+		return one->rtt < two->rtt ? -1 : 1;
+
+	/* Otherwise keep the order we were given */
+	return one->index < two->index ? -1 : (one->index > two->index ? 1 : 0);
+}
+
+GList *
+realm_disco_score_order (GList *addresses)
+{
+	Order *order;
+	Score *score;
+	guint length;
+	gint64 now;
+	GList *l;
+	guint i;
+
+	length = g_list_length (addresses);
+	if (length < 2)
+		return addresses;
+
+	now = g_get_real_time ();
+	order = g_new (Order, length);
+	for (l = addresses, i = 0; l != NULL; l = g_list_next (l), i++) {
+		score = lookup_score (l->data, FALSE);
+		order[i].address = l->data;
+		order[i].index = i;
+		order[i].rank = score_rank (score, now);
+		order[i].rtt = score ? score->rtt : 0;
+	}
+
+	qsort (order, length, sizeof (Order), compare_order);
+
+	for (l = addresses, i = 0; l != NULL; l = g_list_next (l), i++)
+		l->data = order[i].address;
+
+	g_free (order);
+	return addresses;
+}
+
+gboolean
+realm_disco_score_is_failing (GSocketAddress *address)
+{
+	return score_rank (lookup_score (address, FALSE), g_get_real_time ()) == 2;
+}
+
+gchar *
+realm_disco_score_best (const gchar *domain)
+{
+	GHashTableIter iter;
+	const gchar *best = NULL;
+	const gchar *key;
+	Score *best_score = NULL;
+	gboolean closest, best_closest = FALSE;
+	Score *score;
+	gint64 now;
+
+	g_return_val_if_fail (domain != NULL, NULL);
+
+	if (scores == NULL)
+		return NULL;
+
+	now = g_get_real_time ();
+
+	g_hash_table_iter_init (&iter, scores);
+	while (g_hash_table_iter_next (&iter, (gpointer *)&key, (gpointer *)&score)) {
+		if (score->domain == NULL || g_ascii_strcasecmp (score->domain, domain) != 0)
+			continue;
+		if (score_rank (score, now) != 0)
+			continue;
+
+		/* Can't join against a read-only domain controller */
+		if (score->flags != 0 && !(score->flags & REALM_DISCO_DS_WRITABLE))
+			continue;
+
+		/* Servers in our own site win, then the fastest */
+		closest = (score->flags & REALM_DISCO_DS_CLOSEST) ? TRUE : FALSE;
+		if (best_score == NULL || (closest && !best_closest) ||
+		    (closest == best_closest && score->rtt < best_score->rtt)) {
+			best = key;
+			best_score = score;
+			best_closest = closest;
+		}
+	}
+
+	return g_strdup (best);
+}
+
+GVariant *
+realm_disco_score_dump (const gchar *domain)
+{
+	GHashTableIter iter;
+	GVariantBuilder builder;
+	const gchar *key;
+	Score *score;
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(ssxuux)"));
+
+	if (scores != NULL) {
+		g_hash_table_iter_init (&iter, scores);
+		while (g_hash_table_iter_next (&iter, (gpointer *)&key, (gpointer *)&score)) {
+			if (domain && domain[0] &&
+			    (score->domain == NULL || g_ascii_strcasecmp (score->domain, domain) != 0))
+				continue;
+			g_variant_builder_add (&builder, "(ssxuux)",
+			                       score->domain ? score->domain : "", key,
+			                       score->rtt, score->successes, score->failures,
+			                       score->last_seen / G_USEC_PER_SEC);
+		}
+	}
+
+	return g_variant_builder_end (&builder);
+}
+
+void
+realm_disco_score_uninit (void)
+{
+	if (scores != NULL)
+		g_hash_table_destroy (scores);
+	scores = NULL;
+}
@@ -0,0 +1,42 @@
+/* realmd -- Realm configuration service
+ *
+ * Copyright 2026 The realmd contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2 of the licence or (at
+ * your option) any later version.
+ *
+ * See the included COPYING file for more information.
+ */
+
+#include "config.h"
+
+#ifndef __REALM_DISCO_SCORE_H__
+#define __REALM_DISCO_SCORE_H__
+
+#include "realm-disco.h"
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+void            realm_disco_score_success       (GSocketAddress *address,
+                                                 RealmDisco *disco,
+                                                 gint64 rtt);
+
+void            realm_disco_score_failure       (GSocketAddress *address);
+
+GList *         realm_disco_score_order         (GList *addresses);
+
+gboolean        realm_disco_score_is_failing    (GSocketAddress *address);
+
+gchar *         realm_disco_score_best          (const gchar *domain);
+
+GVariant *      realm_disco_score_dump          (const gchar *domain);
+
+void            realm_disco_score_uninit        (void);
+
+G_END_DECLS
+
+#endif /* __REALM_DISCO_SCORE_H__ */
@@ -0,0 +1,411 @@
+/* realmd -- Realm configuration service
+ *
+ * Copyright 2026 The realmd contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2 of the licence or (at
+ * your option) any later version.
+ *
+ * See the included COPYING file for more information.
+ */
+
+#include "config.h"
+
+#include "realm-disco-srv.h"
+#include "realm-settings.h"
+
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <arpa/nameser.h>
+#include <resolv.h>
+
+#include <string.h>
+
+/*
+ * GResolver only hands back the answer section of an SRV response. But
+ * DNS servers, and Active Directory ones in particular, send along the
+ * addresses of the targets in the additional section. Throwing those away
+ * means looking up each domain controller by name afterwards, one more
+ * round trip per server before we can even connect.
+ *
+ * So we send the SRV query ourselves with the resolver library, and keep
+ * the glue addresses. Large domains have more SRV records than fit in a
+ * UDP response, in which case we ask again over TCP rather than make do
+ * with a partial list.
+ *
+ * The [discovery] direct-srv setting turns this off, and we go through
+ * GResolver like everything else.
+ */
+
+/* Initial size of the buffer for a response, grown when it doesn't fit */
+#define ANSWER_SIZE  4096
+
+/* The largest response possible over TCP */
+#define ANSWER_MAX   65535
+
+typedef struct {
+	GList *targets;
+	GHashTable *glue;
+} SrvResult;
+
+static void
+srv_result_free (gpointer data)
+{
+	SrvResult *result = data;
+
+	g_list_free_full (result->targets, (GDestroyNotify)g_srv_target_free);
+	if (result->glue)
+		g_hash_table_unref (result->glue);
+	g_free (result);
+}
+
+static GHashTable *
+glue_new (void)
+{
+	return g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+	                              (GDestroyNotify)g_resolver_free_addresses);
+}
+
+static void
+glue_add (GHashTable *glue,
+          const gchar *hostname,
+          GInetAddress *address)
+{
+	GList *addresses;
+	gchar *key;
+
+	key = g_ascii_strdown (hostname, -1);
+	addresses = g_hash_table_lookup (glue, key);
+
+	/* Appending to a list doesn't change its head */
+	if (addresses) {
+		g_list_append (addresses, address);
+		g_free (key);
+	} else {
+		g_hash_table_insert (glue, key, g_list_append (NULL, address));
+	}
+}
+
+GList *
+realm_disco_srv_glue_lookup (GHashTable *glue,
+                             const gchar *hostname)
+{
+	GList *addresses;
+	gchar *key;
+
+	g_return_val_if_fail (hostname != NULL, NULL);
+
+	if (glue == NULL)
+		return NULL;
+
+	key = g_ascii_strdown (hostname, -1);
+	addresses = g_list_copy (g_hash_table_lookup (glue, key));
+	g_list_foreach (addresses, (GFunc)g_object_ref, NULL);
+	g_free (key);
+
+	return addresses;
+}
+
+static void
+set_invalid (GError **error,
+             const gchar *rrname)
+{
+	g_set_error (error, G_RESOLVER_ERROR, G_RESOLVER_ERROR_INTERNAL,
+	             "Invalid DNS response for %s", rrname);
+}
+
+static void
+parse_glue (ns_msg *msg,
+            GHashTable *glue)
+{
+	GInetAddress *address;
+	ns_rr rr;
+	int count;
+	int i;
+
+	count = ns_msg_count (*msg, ns_s_ar);
+	for (i = 0; i < count; i++) {
+		if (ns_parserr (msg, ns_s_ar, i, &rr) < 0)
+			break;
+
+		if (ns_rr_class (rr) != ns_c_in)
+			continue;
+		else if (ns_rr_type (rr) == ns_t_a && ns_rr_rdlen (rr) == 4)
+			address = g_inet_address_new_from_bytes (ns_rr_rdata (rr), G_SOCKET_FAMILY_IPV4);
+		else if (ns_rr_type (rr) == ns_t_aaaa && ns_rr_rdlen (rr) == 16)
+			address = g_inet_address_new_from_bytes (ns_rr_rdata (rr), G_SOCKET_FAMILY_IPV6);
+		else
+			continue;
+
+		glue_add (glue, ns_rr_name (rr), address);
+	}
+}
+
+GList *
+realm_disco_srv_parse (const guchar *answer,
+                       gsize length,
+                       const gchar *rrname,
+                       GHashTable **glue,
+                       GError **error)
+{
+	GList *targets = NULL;
+	gchar name[NS_MAXDNAME];
+	const guchar *rdata;
+	guint16 priority;
+	guint16 weight;
+	guint16 port;
+	ns_msg msg;
+	ns_rr rr;
+	int count;
+	int i;
+
+	g_return_val_if_fail (answer != NULL, NULL);
+	g_return_val_if_fail (rrname != NULL, NULL);
+
+	if (ns_initparse (answer, length, &msg) < 0) {
+		set_invalid (error, rrname);
+		return NULL;
+	}
+
+	switch (ns_msg_getflag (msg, ns_f_rcode)) {
+	case ns_r_noerror:
+		break;
+	case ns_r_nxdomain:
+		g_set_error (error, G_RESOLVER_ERROR, G_RESOLVER_ERROR_NOT_FOUND,
+		             "No DNS records found for %s", rrname);
+		return NULL;
+	case ns_r_servfail:
+		g_set_error (error, G_RESOLVER_ERROR, G_RESOLVER_ERROR_TEMPORARY_FAILURE,
+		             "Temporary failure looking up %s", rrname);
+		return NULL;
+	default:
+		g_set_error (error, G_RESOLVER_ERROR, G_RESOLVER_ERROR_INTERNAL,
+		             "Couldn't look up %s: DNS response code %d", rrname,
+		             (int)ns_msg_getflag (msg, ns_f_rcode));
+		return NULL;
+	}
+
+	count = ns_msg_count (msg, ns_s_an);
+	for (i = 0; i < count; i++) {
+		if (ns_parserr (&msg, ns_s_an, i, &rr) < 0) {
+			set_invalid (error, rrname);
+			g_list_free_full (targets, (GDestroyNotify)g_srv_target_free);
+			return NULL;
+		}
+
+		/* Skip over any CNAME records that led us here */
+		if (ns_rr_class (rr) != ns_c_in || ns_rr_type (rr) != ns_t_srv)
+			continue;
+
+		rdata = ns_rr_rdata (rr);
+		if (ns_rr_rdlen (rr) < 7 ||
+		    dn_expand (ns_msg_base (msg), ns_msg_end (msg), rdata + 6, name, sizeof (name)) < 0) {
+			set_invalid (error, rrname);
+			g_list_free_full (targets, (GDestroyNotify)g_srv_target_free);
+			return NULL;
+		}
+
+		/* A target of "." means the service is decidedly not available */
+		if (name[0] == '\0')
+			continue;
+
+		priority = ns_get16 (rdata);
+		weight = ns_get16 (rdata + 2);
+		port = ns_get16 (rdata + 4);
+		targets = g_list_prepend (targets, g_srv_target_new (name, port, priority, weight));
+	}
+
+	if (targets == NULL) {
+		g_set_error (error, G_RESOLVER_ERROR, G_RESOLVER_ERROR_NOT_FOUND,
+		             "No DNS records found for %s", rrname);
+		return NULL;
+	}
+
+	if (glue) {
+		*glue = glue_new ();
+		parse_glue (&msg, *glue);
+	}
+
+	return g_srv_target_list_sort (g_list_reverse (targets));
+}
+
+static guchar *
+send_query (res_state state,
+            const gchar *rrname,
+            gsize *length,
+            GError **error)
+{
+	guchar query[NS_PACKETSZ];
+	guchar *answer;
+	gsize size;
+	int qlen;
+	int len;
+
+	qlen = res_nmkquery (state, ns_o_query, rrname, ns_c_in, ns_t_srv,
+	                     NULL, 0, NULL, query, sizeof (query));
+	if (qlen < 0) {
+		g_set_error (error, G_RESOLVER_ERROR, G_RESOLVER_ERROR_INTERNAL,
+		             "Couldn't build DNS query for %s", rrname);
+		return NULL;
+	}
+
+	size = ANSWER_SIZE;
+	answer = g_malloc (size);
+
+	for (;;) {
+		len = res_nsend (state, query, qlen, answer, size);
+		if (len < 0) {
+			g_set_error (error, G_RESOLVER_ERROR, G_RESOLVER_ERROR_TEMPORARY_FAILURE,
+			             "No response from DNS server for %s", rrname);
+			g_free (answer);
+			return NULL;
+		}
+
+		/* The whole response didn't fit, make room and ask again */
+		if ((gsize)len > size && len <= ANSWER_MAX) {
+			size = len;
+			answer = g_realloc (answer, size);
+			continue;
+		}
+
+		/* Truncated over UDP, ask again over TCP */
+		if (len >= NS_HFIXEDSZ && (answer[2] & 0x02) &&
+		    !(state->options & RES_USEVC)) {
+			g_debug ("DNS response for %s was truncated, retrying over TCP", rrname);
+			state->options |= RES_USEVC;
+			continue;
+		}
+
+		break;
+	}
+
+	*length = MIN ((gsize)len, size);
+	return answer;
+}
+
+static void
+srv_thread (GTask *task,
+            gpointer source_object,
+            gpointer task_data,
+            GCancellable *cancellable)
+{
+	const gchar *rrname = task_data;
+	struct __res_state state;
+	SrvResult *result;
+	GError *error = NULL;
+	guchar *answer;
+	gsize length;
+
+	memset (&state, 0, sizeof (state));
+	if (res_ninit (&state) < 0) {
+		g_task_return_new_error (task, G_RESOLVER_ERROR, G_RESOLVER_ERROR_INTERNAL,
+		                         "Couldn't initialize the DNS resolver");
+		return;
+	}
+
+	/* We fall back to TCP ourselves, rather than accept a partial answer */
+	state.options |= RES_IGNTC;
+#ifdef RES_USE_EDNS0
+	state.options |= RES_USE_EDNS0;
+#endif
+
+	answer = send_query (&state, rrname, &length, &error);
+	res_nclose (&state);
+
+	if (answer == NULL) {
+		g_task_return_error (task, error);
+		return;
+	}
+
+	result = g_new0 (SrvResult, 1);
+	result->targets = realm_disco_srv_parse (answer, length, rrname, &result->glue, &error);
+	g_free (answer);
+
+	if (error) {
+		srv_result_free (result);
+		g_task_return_error (task, error);
+	} else {
+		g_task_return_pointer (task, result, srv_result_free);
+	}
+}
+
+static void
+on_service_resolved (GObject *source,
+                     GAsyncResult *res,
+                     gpointer user_data)
+{
+	GTask *task = G_TASK (user_data);
+	GError *error = NULL;
+	SrvResult *result;
+	GList *targets;
+
+	targets = g_resolver_lookup_service_finish (G_RESOLVER (source), res, &error);
+	if (error) {
+		g_task_return_error (task, error);
+	} else {
+		result = g_new0 (SrvResult, 1);
+		result->targets = targets;
+		g_task_return_pointer (task, result, srv_result_free);
+	}
+
+	g_object_unref (task);
+}
+
+void
+realm_disco_srv_async (const gchar *service,
+                       const gchar *protocol,
+                       const gchar *domain,
+                       GCancellable *cancellable,
+                       GAsyncReadyCallback callback,
+                       gpointer user_data)
+{
+	GResolver *resolver;
+	GTask *task;
+
+	g_return_if_fail (service != NULL);
+	g_return_if_fail (protocol != NULL);
+	g_return_if_fail (domain != NULL);
+
+	task = g_task_new (NULL, cancellable, callback, user_data);
+
+	if (realm_settings_boolean ("discovery", "direct-srv", TRUE)) {
+		g_task_set_task_data (task, g_strdup_printf ("_%s._%s.%s", service, protocol, domain), g_free);
+
+		/* The resolver library can't be interrupted, so don't make callers wait */
+		g_task_set_return_on_cancel (task, TRUE);
+		g_task_run_in_thread (task, srv_thread);
+		g_object_unref (task);
+
+	} else {
+		resolver = g_resolver_get_default ();
+		g_resolver_lookup_service_async (resolver, service, protocol, domain,
+		                                 cancellable, on_service_resolved, task);
+		g_object_unref (resolver);
+	}
+}
+
+GList *
+realm_disco_srv_finish (GAsyncResult *result,
+                        GHashTable **glue,
+                        GError **error)
+{
+	SrvResult *srv;
+	GList *targets;
+
+	g_return_val_if_fail (g_task_is_valid (result, NULL), NULL);
+
+	srv = g_task_propagate_pointer (G_TASK (result), error);
+	if (srv == NULL)
+		return NULL;
+
+	targets = srv->targets;
+	srv->targets = NULL;
+	if (glue) {
+		*glue = srv->glue;
+		srv->glue = NULL;
+	}
+
+	srv_result_free (srv);
+	return targets;
+}
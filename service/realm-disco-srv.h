@@ -0,0 +1,44 @@
+/* realmd -- Realm configuration service
+ *
+ * Copyright 2026 The realmd contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2 of the licence or (at
+ * your option) any later version.
+ *
+ * See the included COPYING file for more information.
+ */
+
+#include "config.h"
+
+#ifndef __REALM_DISCO_SRV_H__
+#define __REALM_DISCO_SRV_H__
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+void         realm_disco_srv_async       (const gchar *service,
+                                          const gchar *protocol,
+                                          const gchar *domain,
+                                          GCancellable *cancellable,
+                                          GAsyncReadyCallback callback,
+                                          gpointer user_data);
+
+GList *      realm_disco_srv_finish      (GAsyncResult *result,
+                                          GHashTable **glue,
+                                          GError **error);
+
+GList *      realm_disco_srv_parse       (const guchar *answer,
+                                          gsize length,
+                                          const gchar *rrname,
+                                          GHashTable **glue,
+                                          GError **error);
+
+GList *      realm_disco_srv_glue_lookup (GHashTable *glue,
+                                          const gchar *hostname);
+
+G_END_DECLS
+
+#endif /* __REALM_DISCO_SRV_H__ */
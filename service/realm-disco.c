@@ -48,6 +48,28 @@ realm_disco_ref (RealmDisco *disco)
 	return disco;
 }
 
+RealmDisco *
+realm_disco_copy (RealmDisco *disco)
+{
+	RealmDisco *copy;
+
+	g_return_val_if_fail (disco != NULL, NULL);
+
+	copy = realm_disco_new (disco->domain_name);
+	copy->server_software = disco->server_software;
+	copy->kerberos_realm = g_strdup (disco->kerberos_realm);
+	copy->workgroup = g_strdup (disco->workgroup);
+	copy->explicit_server = g_strdup (disco->explicit_server);
+	copy->explicit_netbios = g_strdup (disco->explicit_netbios);
+	copy->server_address = disco->server_address ? g_object_ref (disco->server_address) : NULL;
+	copy->dns_fqdn = g_strdup (disco->dns_fqdn);
+	copy->server_name = g_strdup (disco->server_name);
+	copy->server_site = g_strdup (disco->server_site);
+	copy->client_site = g_strdup (disco->client_site);
+	copy->server_flags = disco->server_flags;
+	return copy;
+}
+
 void
 realm_disco_unref (gpointer data)
 {
@@ -63,6 +85,9 @@ realm_disco_unref (gpointer data)
 		g_free (disco->kerberos_realm);
 		g_free (disco->workgroup);
 		g_free (disco->dns_fqdn);
+		g_free (disco->server_name);
+		g_free (disco->server_site);
+		g_free (disco->client_site);
 		if (disco->server_address)
 			g_object_unref (disco->server_address);
 		g_free (disco);
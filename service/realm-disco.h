@@ -31,8 +31,16 @@ typedef struct {
 	gchar *explicit_netbios;
 	GSocketAddress *server_address;
 	gchar *dns_fqdn;
+	gchar *server_name;
+	gchar *server_site;
+	gchar *client_site;
+	guint32 server_flags;
 } RealmDisco;
 
+/* Flags in server_flags, from the NetLogon response */
+#define        REALM_DISCO_DS_CLOSEST       0x00000080
+#define        REALM_DISCO_DS_WRITABLE      0x00000100
+
 #define        REALM_TYPE_DISCO             (realm_disco_get_type ())
 
 GType          realm_disco_get_type         (void) G_GNUC_CONST;
@@ -41,6 +49,8 @@ RealmDisco *   realm_disco_new              (const gchar *domain);
 
 RealmDisco *   realm_disco_ref              (RealmDisco *disco);
 
+RealmDisco *   realm_disco_copy             (RealmDisco *disco);
+
 void           realm_disco_unref            (gpointer disco);
 
 G_END_DECLS
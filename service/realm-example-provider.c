@@ -184,7 +184,7 @@ realm_example_provider_discover_async (RealmProvider *provider,
 		g_object_set_data_full (G_OBJECT (task), "the-domain", domain, g_free);
 
 		realm_usleep_async (delay * G_USEC_PER_SEC,
-		                    realm_invocation_get_cancellable (invocation),
+		                    invocation ? realm_invocation_get_cancellable (invocation) : NULL,
 		                    on_discover_sleep_done,
 		                    g_object_ref (task));
 	}
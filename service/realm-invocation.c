@@ -14,9 +14,11 @@
 
 #include "config.h"
 
+#include "realm-command.h"
 #include "realm-daemon.h"
 #include "realm-dbus-constants.h"
 #include "realm-dbus-generated.h"
+#include "realm-disco-score.h"
 #include "realm-invocation.h"
 
 #include <glib.h>
@@ -35,6 +37,7 @@ typedef struct {
 
 static InvocationMethod invocation_methods[] = {
 	{ REALM_DBUS_PROVIDER_INTERFACE, "Discover", "org.freedesktop.realmd.discover-realm", 2 },
+	{ REALM_DBUS_PROVIDER_INTERFACE, "DiscoverMany", "org.freedesktop.realmd.discover-realm", 2 },
 	{ REALM_DBUS_KERBEROS_MEMBERSHIP_INTERFACE, "Join", "org.freedesktop.realmd.configure-realm", 2 },
 	{ REALM_DBUS_KERBEROS_MEMBERSHIP_INTERFACE, "Leave", "org.freedesktop.realmd.deconfigure-realm", 2 },
 	{ REALM_DBUS_REALM_INTERFACE, "Deconfigure", "org.freedesktop.realmd.deconfigure-realm", 1 },
@@ -380,6 +383,25 @@ unwatch_and_free_client (gpointer data)
 	realm_daemon_poke ();
 }
 
+static gboolean
+on_service_get_domain_controllers (RealmDbusService *object,
+                                   GDBusMethodInvocation *invocation,
+                                   const gchar *domain)
+{
+	realm_dbus_service_complete_get_domain_controllers (object, invocation,
+	                                                    realm_disco_score_dump (domain));
+	return TRUE;
+}
+
+static gboolean
+on_service_get_command_metrics (RealmDbusService *object,
+                                GDBusMethodInvocation *invocation)
+{
+	realm_dbus_service_complete_get_command_metrics (object, invocation,
+	                                                 realm_command_metrics_dump ());
+	return TRUE;
+}
+
 void
 realm_invocation_initialize (GDBusConnection *connection)
 {
@@ -402,6 +424,10 @@ realm_invocation_initialize (GDBusConnection *connection)
 	g_signal_connect (service, "handle-release", G_CALLBACK (on_service_release), NULL);
 	g_signal_connect (service, "handle-set-locale", G_CALLBACK (on_service_set_locale), NULL);
 	g_signal_connect (service, "handle-cancel", G_CALLBACK (on_service_cancel), NULL);
+	g_signal_connect (service, "handle-get-domain-controllers",
+	                  G_CALLBACK (on_service_get_domain_controllers), NULL);
+	g_signal_connect (service, "handle-get-command-metrics",
+	                  G_CALLBACK (on_service_get_command_metrics), NULL);
 	g_dbus_interface_skeleton_export (G_DBUS_INTERFACE_SKELETON (service),
 	                                  connection, REALM_DBUS_SERVICE_PATH, NULL);
 
@@ -15,6 +15,8 @@
 #include "config.h"
 
 #include "realm-dbus-constants.h"
+#include "realm-disco-cache.h"
+#include "realm-disco-records.h"
 #include "realm-invocation.h"
 #include "realm-kerberos-provider.h"
 
@@ -45,23 +47,34 @@ on_kerberos_discover (GObject *source,
 {
 	GTask *task = G_TASK (user_data);
 	const gchar *domain = g_task_get_task_data (task);
+	RealmDiscoRecords *records;
 	GError *error = NULL;
 	RealmDisco *disco;
-	GList *targets;
+	gchar *srv;
 
-	targets = g_resolver_lookup_service_finish (G_RESOLVER (source), result, &error);
-	if (targets) {
-		g_list_free_full (targets, (GDestroyNotify)g_srv_target_free);
+	records = realm_disco_records_finish (result, &error);
+	if (records && records->kerberos_targets) {
 		disco = realm_disco_new (domain);
 		disco->kerberos_realm = g_ascii_strup (domain, -1);
 		g_task_return_pointer (task, disco, realm_disco_unref);
 
-	} else if (error) {
-		g_debug ("Resolving %s failed: %s", domain, error->message);
-		g_error_free (error);
+	} else {
+		if (records && records->kerberos_error) {
+			g_debug ("Resolving %s failed: %s", domain, records->kerberos_error->message);
+			if (g_error_matches (records->kerberos_error, G_RESOLVER_ERROR, G_RESOLVER_ERROR_NOT_FOUND)) {
+				srv = g_strdup_printf ("_kerberos._udp.%s", domain);
+				realm_disco_cache_store_missing (srv, domain);
+				g_free (srv);
+			}
+		} else if (error) {
+			g_debug ("Resolving %s failed: %s", domain, error->message);
+			g_error_free (error);
+		}
 		g_task_return_pointer (task, NULL, NULL);
 	}
 
+	realm_disco_records_unref (records);
+
 	g_object_unref (task);
 }
 
@@ -75,26 +88,32 @@ realm_kerberos_provider_discover_async (RealmProvider *provider,
 {
 	GTask *task;
 	const gchar *software;
-	GResolver *resolver;
 	gchar *name;
+	gchar *srv;
 
 	task = g_task_new (provider, NULL, callback, user_data);
+	name = g_hostname_to_ascii (string);
+	srv = g_strdup_printf ("_kerberos._udp.%s", name);
 
 	/* If filtering for specific software, don't return anything */
 	if (g_variant_lookup (options, REALM_DBUS_OPTION_SERVER_SOFTWARE, "&s", &software) ||
 	    g_variant_lookup (options, REALM_DBUS_OPTION_CLIENT_SOFTWARE, "&s", &software)) {
 		g_task_return_pointer (task, NULL, NULL);
+		g_free (name);
+
+	/* Recently found not to exist */
+	} else if (realm_disco_cache_is_missing (srv)) {
+		g_debug ("No results (cached): %s", srv);
+		g_task_return_pointer (task, NULL, NULL);
+		g_free (name);
 
 	} else {
-		name = g_hostname_to_ascii (string);
-		resolver = g_resolver_get_default ();
-		g_resolver_lookup_service_async (resolver, "kerberos", "udp", name,
-		                                 realm_invocation_get_cancellable (invocation),
-		                                 on_kerberos_discover, g_object_ref (task));
+		realm_disco_records_async (name, invocation ? realm_invocation_get_cancellable (invocation) : NULL,
+		                           on_kerberos_discover, g_object_ref (task));
 		g_task_set_task_data (task, name, g_free);
-		g_object_unref (resolver);
 	}
 
+	g_free (srv);
 	g_object_unref (task);
 }
 
@@ -1002,6 +1002,31 @@ realm_kerberos_set_details (RealmKerberos *self,
 	g_ptr_array_free (tuples, TRUE);
 }
 
+const gchar *
+realm_kerberos_get_detail (RealmKerberos *self,
+                           const gchar *name)
+{
+	GVariant *details;
+	const gchar *key;
+	const gchar *value;
+	GVariantIter iter;
+
+	g_return_val_if_fail (REALM_IS_KERBEROS (self), NULL);
+	g_return_val_if_fail (name != NULL, NULL);
+
+	details = realm_dbus_realm_get_details (self->pv->realm_iface);
+	if (details == NULL)
+		return NULL;
+
+	g_variant_iter_init (&iter, details);
+	while (g_variant_iter_next (&iter, "(&s&s)", &key, &value)) {
+		if (g_str_equal (key, name))
+			return value;
+	}
+
+	return NULL;
+}
+
 gboolean
 realm_kerberos_is_configured (RealmKerberos *self)
 {
@@ -129,6 +129,9 @@ void                realm_kerberos_set_login_formats           (RealmKerberos *s
 void                realm_kerberos_set_details                 (RealmKerberos *self,
                                                                 ...) G_GNUC_NULL_TERMINATED;
 
+const gchar *       realm_kerberos_get_detail                  (RealmKerberos *self,
+                                                                const gchar *name);
+
 gboolean            realm_kerberos_is_configured               (RealmKerberos *self);
 
 void                realm_kerberos_set_configured              (RealmKerberos *self,
@@ -53,6 +53,12 @@ typedef struct {
 
 	gboolean connect_done;
 
+	/* Another thread is doing the TLS handshake, leave the connection be */
+	gboolean handshaking;
+
+	/* Monotonic time after which we fail with LDAP_TIMEOUT, or zero */
+	gint64 deadline;
+
 	/* An LDAP failure we should always return if non-zero */
 	int force_fail;
 } LdapSource;
@@ -62,6 +68,23 @@ ldap_source_prepare (GSource *source,
                      gint *timeout)
 {
 	LdapSource *ls = (LdapSource *)source;
+	gint64 now;
+
+	/* Only the deadline and cancellation apply while handshaking */
+	if (ls->handshaking) {
+		*timeout = -1;
+		if (ls->force_fail != 0)
+			return FALSE;
+		if (g_cancellable_is_cancelled (ls->cancellable))
+			return TRUE;
+		if (ls->deadline > 0) {
+			now = g_source_get_time (source);
+			if (now >= ls->deadline)
+				return TRUE;
+			*timeout = (ls->deadline - now + 999) / 1000;
+		}
+		return FALSE;
+	}
 
 	if (ls->force_fail != 0)
 		return TRUE;
@@ -69,6 +92,13 @@ ldap_source_prepare (GSource *source,
 		return TRUE;
 
 	*timeout = -1;
+	if (ls->deadline > 0) {
+		now = g_source_get_time (source);
+		if (now >= ls->deadline)
+			return TRUE;
+		*timeout = (ls->deadline - now + 999) / 1000;
+	}
+
 	if ((ls->condition & ls->pollfd.revents) != 0)
 		return TRUE;
 
@@ -106,6 +136,25 @@ ldap_source_dispatch (GSource     *source,
 	socklen_t slen;
 	int error;
 
+	/*
+	 * The handshake thread owns the connection, so neither it nor the
+	 * callback may be touched here. Shut down the socket to make the
+	 * handshake fail, and report why when it's done.
+	 */
+	if (ls->handshaking) {
+		if (ls->force_fail == 0) {
+			if (g_cancellable_is_cancelled (ls->cancellable)) {
+				ls->force_fail = LDAP_CANCELLED;
+			} else {
+				g_debug ("timed out waiting for TLS handshake");
+				ls->force_fail = LDAP_TIMEOUT;
+			}
+			ls->cancel_pollfd.events = 0;
+			shutdown (ls->sock, SHUT_RDWR);
+		}
+		return TRUE;
+	}
+
 	cond = ls->pollfd.revents & ls->condition;
 
 	/*
@@ -115,6 +164,10 @@ ldap_source_dispatch (GSource     *source,
 	if (g_cancellable_is_cancelled (ls->cancellable)) {
 		ls->force_fail = LDAP_CANCELLED;
 
+	} else if (ls->deadline > 0 && g_source_get_time (source) >= ls->deadline) {
+		g_debug ("timed out waiting for server");
+		ls->force_fail = LDAP_TIMEOUT;
+
 	} else if (cond & (G_IO_HUP | G_IO_ERR)) {
 		g_debug ("socket closed or error");
 		ls->force_fail = LDAP_SERVER_DOWN;
@@ -189,8 +242,6 @@ realm_ldap_connect_anonymous (GSocketAddress *address,
 	LdapSource *ls;
 	gchar *addrname;
 	GInetSocketAddress *inet;
-	struct berval cred;
-	Sockbuf *sb = NULL;
 	gsize native_len;
 	gpointer native;
 	int version;
@@ -252,48 +303,7 @@ realm_ldap_connect_anonymous (GSocketAddress *address,
 
 		break;
 
-	case G_SOCKET_PROTOCOL_UDP:
-		url = g_strdup_printf ("cldap://%s:%d", addrname, port);
-
-		/*
-		 * HACK: ldap_init_fd() does not work for UDP, otherwise we
-		 * could use the same code path as above, but it doesn't
-		 * block while connecting anyway, so just use ldap_initialize()
-		 */
-		rc = ldap_initialize (&ls->ldap, url);
-		g_free (url);
-
-		/* Not an expected failure */
-		if (rc != LDAP_SUCCESS) {
-			g_warning ("ldap_initialize() failed: %s", ldap_err2string (rc));
-			return NULL;
-		}
-
-		/*
-		 * An anonymous bind is used to actually connect the connection
-		 * so we can get at the socket. For UDP with openldap an anonymous
-		 * bind is treated as a no-op.
-		 */
-
-		cred.bv_val = "";
-		cred.bv_len = 0;
-		rc = ldap_sasl_bind_s (ls->ldap, NULL, LDAP_SASL_SIMPLE, &cred, NULL, NULL, NULL);
-
-		/* Not an expected failure */
-		if (rc != LDAP_SUCCESS) {
-			g_warning ("ldap_sasl_bind_s() failed: %s", ldap_err2string (rc));
-			return NULL;
-		}
-
-		if (ldap_get_option (ls->ldap, LDAP_OPT_SOCKBUF, &sb) < 0)
-			g_return_val_if_reached (NULL);
-		g_return_val_if_fail (sb != NULL, NULL);
-		if (ber_sockbuf_ctrl (sb, LBER_SB_OPT_GET_FD, &ls->sock) != 1)
-			g_return_val_if_reached (NULL);
-
-		ls->connect_done = TRUE;
-		break;
-
+	/* CLDAP over UDP is implemented natively, see realm-disco-mscldap.c */
 	default:
 		g_return_val_if_reached (NULL);
 		break;
@@ -335,6 +345,274 @@ realm_ldap_set_condition (GSource *source,
 		g_main_context_wakeup (context);
 }
 
+void
+realm_ldap_set_deadline (GSource *source,
+                         gint64 deadline)
+{
+	LdapSource *ls = (LdapSource *)source;
+	GMainContext *context;
+
+	ls->deadline = deadline;
+
+	context = g_source_get_context (source);
+	if (context != NULL)
+		g_main_context_wakeup (context);
+}
+
+/*
+ * libldap only knows how to do the TLS handshake blocking, so it's done
+ * in another thread. The connection isn't polled or touched until the
+ * handshake is done. The deadline and cancellation still apply, and
+ * shut down the socket so that the handshake fails promptly.
+ */
+
+static void
+install_tls_thread (GTask *task,
+                    gpointer source_object,
+                    gpointer task_data,
+                    GCancellable *cancellable)
+{
+	LdapSource *ls = task_data;
+	GError *error = NULL;
+	int ret;
+
+	ret = ldap_install_tls (ls->ldap);
+	if (ret == LDAP_SUCCESS) {
+		g_task_return_boolean (task, TRUE);
+	} else {
+		realm_ldap_set_error (&error, ls->ldap, ret);
+		g_task_return_error (task, error);
+	}
+}
+
+void
+realm_ldap_install_tls_async (GSource *source,
+                              gdouble timeout,
+                              GAsyncReadyCallback callback,
+                              gpointer user_data)
+{
+	LdapSource *ls = (LdapSource *)source;
+	struct timeval tv;
+	GTask *task;
+
+	g_return_if_fail (source != NULL);
+	g_return_if_fail (!ls->handshaking);
+
+	if (timeout > 0) {
+		tv.tv_sec = (time_t)timeout;
+		tv.tv_usec = (suseconds_t)((timeout - tv.tv_sec) * G_USEC_PER_SEC);
+		ldap_set_option (ls->ldap, LDAP_OPT_NETWORK_TIMEOUT, &tv);
+		ls->deadline = g_get_monotonic_time () + timeout * G_TIME_SPAN_SECOND;
+	}
+
+	ls->handshaking = TRUE;
+	g_source_remove_poll (source, &ls->pollfd);
+
+	/* The source keeps the connection alive until the thread is done */
+	task = g_task_new (NULL, NULL, callback, user_data);
+	g_task_set_source_tag (task, realm_ldap_install_tls_async);
+	g_task_set_task_data (task, g_source_ref (source), (GDestroyNotify)g_source_unref);
+	g_task_run_in_thread (task, install_tls_thread);
+	g_object_unref (task);
+}
+
+gboolean
+realm_ldap_install_tls_finish (GAsyncResult *result,
+                               GError **error)
+{
+	LdapSource *ls;
+	GMainContext *context;
+
+	g_return_val_if_fail (g_task_is_valid (result, NULL), FALSE);
+
+	ls = g_task_get_task_data (G_TASK (result));
+	ls->handshaking = FALSE;
+	ls->deadline = 0;
+	ls->pollfd.revents = 0;
+	g_source_add_poll ((GSource *)ls, &ls->pollfd);
+	if (ls->cancellable)
+		ls->cancel_pollfd.events = G_IO_IN;
+
+	context = g_source_get_context ((GSource *)ls);
+	if (context != NULL)
+		g_main_context_wakeup (context);
+
+	/* Timed out or cancelled, whatever the handshake made of it */
+	if (ls->force_fail != 0) {
+		g_task_propagate_boolean (G_TASK (result), NULL);
+		realm_ldap_set_error (error, NULL, ls->force_fail);
+		return FALSE;
+	}
+
+	return g_task_propagate_boolean (G_TASK (result), error);
+}
+
+void
+realm_ldap_set_cancellable (GSource *source,
+                            GCancellable *cancellable)
+{
+	LdapSource *ls = (LdapSource *)source;
+
+	if (ls->cancellable) {
+		g_source_remove_poll (source, &ls->cancel_pollfd);
+		g_cancellable_release_fd (ls->cancellable);
+		g_object_unref (ls->cancellable);
+		ls->cancellable = NULL;
+	}
+
+	if (g_cancellable_make_pollfd (cancellable,
+	                               &ls->cancel_pollfd)) {
+		ls->cancellable = g_object_ref (cancellable);
+		g_source_add_poll (source, &ls->cancel_pollfd);
+	}
+}
+
+/*
+ * Anonymous connections that are done with are kept around for a while,
+ * one per server address, so that the next operation against the same
+ * server doesn't have to connect (and perhaps StartTLS) again. While in
+ * the pool the connection is watched, and dropped when the server closes
+ * it or it has been idle for too long.
+ */
+
+/* Seconds to keep an idle connection */
+#define POOL_IDLE      30
+
+/* Maximum number of idle connections */
+#define POOL_MAX       16
+
+static GHashTable *ldap_pool = NULL;
+
+static gchar *
+pool_key (GSocketAddress *address)
+{
+	GInetSocketAddress *inet;
+	gchar *string;
+	gchar *key;
+	gint port;
+
+	inet = G_INET_SOCKET_ADDRESS (address);
+	string = g_inet_address_to_string (g_inet_socket_address_get_address (inet));
+	port = g_inet_socket_address_get_port (inet);
+	key = g_strdup_printf ("%s:%d", string, port ? port : 389);
+	g_free (string);
+
+	return key;
+}
+
+static void
+pool_source_free (gpointer data)
+{
+	GSource *source = data;
+	g_source_destroy (source);
+	g_source_unref (source);
+}
+
+static GIOCondition
+on_pooled_io (LDAP *ldap,
+              GIOCondition cond,
+              gpointer user_data)
+{
+	const gchar *key = user_data;
+	struct timeval tvpoll = { 0, 0 };
+	LDAPMessage *message;
+	gboolean drop = FALSE;
+	int rc;
+
+	/* Closed by the server, idle for too long, or some other failure */
+	if (cond & (G_IO_ERR | G_IO_HUP)) {
+		drop = TRUE;
+
+	/* Left over responses from the last operation */
+	} else if (cond & G_IO_IN) {
+		for (;;) {
+			rc = ldap_result (ldap, LDAP_RES_ANY, LDAP_MSG_ALL, &tvpoll, &message);
+			if (rc <= 0)
+				break;
+			ldap_msgfree (message);
+		}
+		drop = (rc < 0);
+	}
+
+	if (drop) {
+		g_debug ("Dropping pooled LDAP connection: %s", key);
+		g_hash_table_remove (ldap_pool, key);
+		return G_IO_NVAL;
+	}
+
+	return G_IO_IN;
+}
+
+gboolean
+realm_ldap_pool_give (GSocketAddress *address,
+                      GSource *source)
+{
+	LdapSource *ls = (LdapSource *)source;
+	gchar *key;
+
+	g_return_val_if_fail (G_IS_INET_SOCKET_ADDRESS (address), FALSE);
+	g_return_val_if_fail (source != NULL, FALSE);
+
+	if (ls->force_fail != 0 || g_source_is_destroyed (source))
+		return FALSE;
+
+	if (ldap_pool == NULL)
+		ldap_pool = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, pool_source_free);
+
+	key = pool_key (address);
+	if (!g_hash_table_lookup (ldap_pool, key) &&
+	    g_hash_table_size (ldap_pool) >= POOL_MAX) {
+		g_free (key);
+		return FALSE;
+	}
+
+	/* The cancellable of the last operation doesn't apply any more */
+	realm_ldap_set_cancellable (source, NULL);
+	realm_ldap_set_deadline (source, g_get_monotonic_time () + POOL_IDLE * G_TIME_SPAN_SECOND);
+	realm_ldap_set_condition (source, G_IO_IN);
+	g_source_set_callback (source, (GSourceFunc)on_pooled_io, g_strdup (key), g_free);
+
+	g_debug ("Keeping pooled LDAP connection: %s", key);
+	g_hash_table_replace (ldap_pool, key, g_source_ref (source));
+	return TRUE;
+}
+
+GSource *
+realm_ldap_pool_take (GSocketAddress *address,
+                      GCancellable *cancellable)
+{
+	GSource *source = NULL;
+	gpointer orig_key;
+	gchar *key;
+
+	g_return_val_if_fail (G_IS_INET_SOCKET_ADDRESS (address), NULL);
+
+	if (ldap_pool == NULL)
+		return NULL;
+
+	key = pool_key (address);
+	if (g_hash_table_lookup_extended (ldap_pool, key, &orig_key, (gpointer *)&source)) {
+		g_hash_table_steal (ldap_pool, key);
+		g_free (orig_key);
+
+		g_debug ("Reusing pooled LDAP connection: %s", key);
+		g_source_set_callback (source, NULL, NULL, NULL);
+		realm_ldap_set_deadline (source, 0);
+		realm_ldap_set_cancellable (source, cancellable);
+	}
+
+	g_free (key);
+	return source;
+}
+
+void
+realm_ldap_pool_flush (void)
+{
+	if (ldap_pool)
+		g_hash_table_destroy (ldap_pool);
+	ldap_pool = NULL;
+}
+
 void
 realm_ldap_set_error (GError **error,
                       LDAP *ldap,
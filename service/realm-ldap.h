@@ -42,4 +42,26 @@ GSource *     realm_ldap_connect_anonymous     (GSocketAddress *address,
 void          realm_ldap_set_condition         (GSource *source,
                                                 GIOCondition cond);
 
+void          realm_ldap_set_deadline          (GSource *source,
+                                                gint64 deadline);
+
+void          realm_ldap_set_cancellable       (GSource *source,
+                                                GCancellable *cancellable);
+
+void          realm_ldap_install_tls_async     (GSource *source,
+                                                gdouble timeout,
+                                                GAsyncReadyCallback callback,
+                                                gpointer user_data);
+
+gboolean      realm_ldap_install_tls_finish    (GAsyncResult *result,
+                                                GError **error);
+
+gboolean      realm_ldap_pool_give             (GSocketAddress *address,
+                                                GSource *source);
+
+GSource *     realm_ldap_pool_take             (GSocketAddress *address,
+                                                GCancellable *cancellable);
+
+void          realm_ldap_pool_flush            (void);
+
 #endif /* __REALM_LDAP_H__ */
@@ -20,8 +20,18 @@
 typedef struct {
 	gint outstanding;
 	GList *values;
+	gboolean cached;
 } LookupClosure;
 
+/*
+ * Asking NetworkManager for the DHCP domain takes several round trips,
+ * and the answer only changes along with the network. So remember it
+ * until the network changes.
+ */
+static gboolean have_dhcp_domain = FALSE;
+static gchar *dhcp_domain = NULL;
+static gulong network_sig = 0;
+
 static void
 lookup_closure_free (gpointer data)
 {
@@ -31,6 +41,29 @@ lookup_closure_free (gpointer data)
 	g_free (lookup);
 }
 
+static void
+on_network_changed (GNetworkMonitor *monitor,
+                    gboolean available,
+                    gpointer user_data)
+{
+	g_free (dhcp_domain);
+	dhcp_domain = NULL;
+	have_dhcp_domain = FALSE;
+}
+
+static void
+store_dhcp_domain (const gchar *domain)
+{
+	if (network_sig == 0) {
+		network_sig = g_signal_connect (g_network_monitor_get_default (), "network-changed",
+		                                G_CALLBACK (on_network_changed), NULL);
+	}
+
+	g_free (dhcp_domain);
+	dhcp_domain = g_strdup (domain);
+	have_dhcp_domain = TRUE;
+}
+
 static GVariant *
 lookup_get_property_finish (GDBusConnection *connection,
                             GAsyncResult *result,
@@ -232,6 +265,13 @@ realm_network_get_dhcp_domain_async (GDBusConnection *connection,
 	lookup = g_new0 (LookupClosure, 1);
 	g_simple_async_result_set_op_res_gpointer (res, lookup, lookup_closure_free);
 
+	if (have_dhcp_domain) {
+		lookup->cached = TRUE;
+		g_simple_async_result_complete_in_idle (res);
+		g_object_unref (res);
+		return;
+	}
+
 	lookup_get_property_async (connection, "/org/freedesktop/NetworkManager",
 	                           "org.freedesktop.NetworkManager", "ActiveConnections",
 	                           on_active_connections, g_object_ref (res));
@@ -255,15 +295,35 @@ realm_network_get_dhcp_domain_finish (GAsyncResult *result,
 	res = G_SIMPLE_ASYNC_RESULT (result);
 
 	lookup = g_simple_async_result_get_op_res_gpointer (res);
+	if (lookup->cached)
+		return g_strdup (dhcp_domain);
+
 	for (l = lookup->values; l != NULL; l = g_list_next (l)) {
 		if (g_variant_lookup (l->data, "domain_name", "s", &domain)) {
-			if (domain && domain[0])
+			if (domain && domain[0]) {
+				store_dhcp_domain (domain);
 				return domain;
+			}
 			g_free (domain);
 		}
 	}
 
 	/* Only report errors if no domain was found */
-	g_simple_async_result_propagate_error (res, error);
+	if (g_simple_async_result_propagate_error (res, error))
+		return NULL;
+
+	store_dhcp_domain (NULL);
 	return NULL;
 }
+
+void
+realm_network_uninit (void)
+{
+	if (network_sig)
+		g_signal_handler_disconnect (g_network_monitor_get_default (), network_sig);
+	network_sig = 0;
+
+	g_free (dhcp_domain);
+	dhcp_domain = NULL;
+	have_dhcp_domain = FALSE;
+}
@@ -28,6 +28,8 @@ void           realm_network_get_dhcp_domain_async   (GDBusConnection *connectio
 gchar *        realm_network_get_dhcp_domain_finish  (GAsyncResult *result,
                                                       GError **error);
 
+void           realm_network_uninit                  (void);
+
 G_END_DECLS
 
 #endif /* __REALM_NETWORK_H__ */
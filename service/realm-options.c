@@ -26,6 +26,17 @@ realm_options_automatic_install (void)
 	return realm_settings_boolean ("service", "automatic-install", TRUE);
 }
 
+gboolean
+realm_options_forest (GVariant *options)
+{
+	gboolean forest;
+
+	if (!options || !g_variant_lookup (options, REALM_DBUS_OPTION_FOREST, "b", &forest))
+		forest = FALSE;
+
+	return forest;
+}
+
 gboolean
 realm_options_manage_system (GVariant *options,
                              const gchar *realm_name)
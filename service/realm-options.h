@@ -28,6 +28,8 @@ gboolean       realm_options_automatic_install        (void);
 
 gboolean       realm_options_automatic_join           (const gchar *realm_name);
 
+gboolean       realm_options_forest                   (GVariant *options);
+
 const gchar *  realm_options_computer_ou              (GVariant *options,
                                                        const gchar *realm_name);
 
@@ -21,6 +21,7 @@
 #include "realm-options.h"
 #include "realm-packages.h"
 #include "realm-settings.h"
+#include "realm-trace.h"
 
 #include <glib/gi18n.h>
 
@@ -414,12 +415,14 @@ typedef struct {
 	GDBusMethodInvocation *invocation;
 	gchar **packages;
 	gboolean automatic;
+	RealmTraceSpan *span;
 } InstallClosure;
 
 static void
 install_closure_free (gpointer data)
 {
 	InstallClosure *install = data;
+	realm_trace_end (install->span, NULL);
 	g_clear_object (&install->invocation);
 	g_clear_object (&install->connection);
 	g_strfreev (install->packages);
@@ -432,9 +435,13 @@ on_install_installed (GObject *source,
                       gpointer user_data)
 {
 	GTask *task = G_TASK (user_data);
+	InstallClosure *install = g_task_get_task_data (task);
 	GError *error = NULL;
 
 	packages_install_finish (result, &error);
+	realm_trace_end (install->span, error);
+	install->span = NULL;
+
 	if (error == NULL) {
 		g_task_return_boolean (task, TRUE);
 	} else {
@@ -461,6 +468,8 @@ on_install_resolved (GObject *source,
 	names = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
 
 	package_ids = packages_resolve_finish (result, &error);
+	realm_trace_end (install->span, error);
+	install->span = NULL;
 
 	if (error == NULL) {
 		missing = packages_to_list (package_ids);
@@ -477,6 +486,8 @@ on_install_resolved (GObject *source,
 			realm_diagnostics_info (install->invocation, "%s: %s",
 			                        _("Installing necessary packages"), missing);
 			cancellable = realm_invocation_get_cancellable (install->invocation);
+			install->span = realm_trace_begin (install->invocation, "packages",
+			                                   "Installing %s", missing);
 			packages_install_async (install->connection,
 			                        (const gchar **)package_ids, cancellable,
 			                        on_install_installed, g_object_ref (task));
@@ -644,6 +655,7 @@ realm_packages_install_async (const gchar **package_sets,
 
 	} else {
 		realm_diagnostics_info (invocation, "Resolving required packages");
+		install->span = realm_trace_begin (invocation, "packages", "Resolving packages");
 
 		cancellable = realm_invocation_get_cancellable (install->invocation);
 		packages_resolve_async (connection, (const gchar **)install->packages, cancellable,
@@ -0,0 +1,218 @@
+/* realmd -- Realm configuration service
+ *
+ * Copyright 2026 The realmd contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2 of the licence or (at
+ * your option) any later version.
+ *
+ * See the included COPYING file for more information.
+ */
+
+#include "config.h"
+
+#include "realm-daemon.h"
+#include "realm-disco-cache.h"
+#include "realm-disco-domain.h"
+#include "realm-network.h"
+#include "realm-prewarm.h"
+#include "realm-settings.h"
+
+/*
+ * The daemon exits when idle, and starts again cold. When the [discovery]
+ * prewarm setting is on, we discover the configured realms and the domain
+ * from DHCP in the background, so that the discovery cache is already
+ * filled when someone asks. This happens at startup and after the network
+ * changes, one domain at a time.
+ *
+ * The daemon is usually started by the request it then has to answer, so
+ * pre-warming only pays off on a later start. While it's on the cache is
+ * kept on disk, and the daemon is held until a run has completed.
+ */
+
+/* Let startup or a flurry of network changes settle first */
+#define PREWARM_DELAY  2 /* seconds */
+
+static RealmProvider *prewarm_provider = NULL;
+static GDBusConnection *prewarm_connection = NULL;
+static GQueue prewarm_queue = G_QUEUE_INIT;
+static gboolean prewarm_running = FALSE;
+static gboolean prewarm_again = FALSE;
+static guint prewarm_timeout_id = 0;
+static gulong network_sig = 0;
+
+static void schedule_prewarm (void);
+
+static void prewarm_next (void);
+
+static void
+queue_domain (const gchar *domain)
+{
+	gchar *key;
+
+	if (domain == NULL || domain[0] == '\0')
+		return;
+
+	key = realm_disco_cache_key (domain);
+	if (g_queue_find_custom (&prewarm_queue, key, (GCompareFunc)g_strcmp0))
+		g_free (key);
+	else
+		g_queue_push_tail (&prewarm_queue, key);
+}
+
+static void
+on_prewarm_discover (GObject *source,
+                     GAsyncResult *result,
+                     gpointer user_data)
+{
+	GError *error = NULL;
+	RealmDisco *disco;
+
+	disco = realm_disco_domain_finish (result, &error);
+	if (error != NULL) {
+		g_debug ("Couldn't pre-warm discovery: %s", error->message);
+		g_error_free (error);
+	}
+	realm_disco_unref (disco);
+
+	if (prewarm_provider)
+		prewarm_next ();
+}
+
+static void
+prewarm_next (void)
+{
+	gchar *domain;
+
+	domain = g_queue_pop_head (&prewarm_queue);
+	if (domain == NULL) {
+		prewarm_running = FALSE;
+		realm_daemon_release ("prewarm");
+		realm_daemon_poke ();
+		if (prewarm_again) {
+			prewarm_again = FALSE;
+			schedule_prewarm ();
+		}
+		return;
+	}
+
+	g_debug ("Pre-warming discovery: %s", domain);
+	realm_disco_domain_async (domain, NULL, on_prewarm_discover, NULL);
+	g_free (domain);
+}
+
+static void
+on_prewarm_dhcp (GObject *source,
+                 GAsyncResult *result,
+                 gpointer user_data)
+{
+	GError *error = NULL;
+	gchar *domain;
+
+	domain = realm_network_get_dhcp_domain_finish (result, &error);
+	if (error != NULL) {
+		g_debug ("Couldn't get default domain from DHCP: %s", error->message);
+		g_error_free (error);
+	}
+
+	if (prewarm_provider) {
+		queue_domain (domain);
+		prewarm_next ();
+	}
+
+	g_free (domain);
+}
+
+static gboolean
+on_prewarm_timeout (gpointer user_data)
+{
+	GList *realms, *l;
+	const gchar *domain;
+
+	prewarm_timeout_id = 0;
+
+	/* Go around again once the current run is done */
+	if (prewarm_running) {
+		prewarm_again = TRUE;
+		return FALSE;
+	}
+
+	prewarm_running = TRUE;
+	realm_daemon_hold ("prewarm");
+
+	realms = realm_provider_get_realms (prewarm_provider);
+	for (l = realms; l != NULL; l = g_list_next (l)) {
+		if (!realm_kerberos_is_configured (l->data))
+			continue;
+		domain = realm_kerberos_get_domain_name (l->data);
+		if (domain == NULL)
+			domain = realm_kerberos_get_name (l->data);
+		queue_domain (domain);
+	}
+	g_list_free (realms);
+
+	realm_network_get_dhcp_domain_async (prewarm_connection, on_prewarm_dhcp, NULL);
+	return FALSE;
+}
+
+static void
+schedule_prewarm (void)
+{
+	if (prewarm_timeout_id)
+		g_source_remove (prewarm_timeout_id);
+	prewarm_timeout_id = g_timeout_add_seconds_full (G_PRIORITY_LOW, PREWARM_DELAY,
+	                                                 on_prewarm_timeout, NULL, NULL);
+}
+
+static void
+on_network_changed (GNetworkMonitor *monitor,
+                    gboolean available,
+                    gpointer user_data)
+{
+	if (available)
+		schedule_prewarm ();
+}
+
+void
+realm_prewarm_start (GDBusConnection *connection,
+                     RealmProvider *provider)
+{
+	g_return_if_fail (G_IS_DBUS_CONNECTION (connection));
+	g_return_if_fail (REALM_IS_PROVIDER (provider));
+
+	if (!realm_settings_boolean ("discovery", "prewarm", FALSE))
+		return;
+
+	g_return_if_fail (prewarm_provider == NULL);
+
+	prewarm_provider = g_object_ref (provider);
+	prewarm_connection = g_object_ref (connection);
+
+	network_sig = g_signal_connect (g_network_monitor_get_default (), "network-changed",
+	                                G_CALLBACK (on_network_changed), NULL);
+
+	schedule_prewarm ();
+}
+
+void
+realm_prewarm_stop (void)
+{
+	if (network_sig)
+		g_signal_handler_disconnect (g_network_monitor_get_default (), network_sig);
+	network_sig = 0;
+
+	if (prewarm_timeout_id)
+		g_source_remove (prewarm_timeout_id);
+	prewarm_timeout_id = 0;
+
+	while (!g_queue_is_empty (&prewarm_queue))
+		g_free (g_queue_pop_head (&prewarm_queue));
+
+	g_clear_object (&prewarm_provider);
+	g_clear_object (&prewarm_connection);
+	if (prewarm_running)
+		realm_daemon_release ("prewarm");
+	prewarm_running = FALSE;
+	prewarm_again = FALSE;
+}
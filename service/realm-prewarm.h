@@ -0,0 +1,31 @@
+/* realmd -- Realm configuration service
+ *
+ * Copyright 2026 The realmd contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2 of the licence or (at
+ * your option) any later version.
+ *
+ * See the included COPYING file for more information.
+ */
+
+#include "config.h"
+
+#ifndef __REALM_PREWARM_H__
+#define __REALM_PREWARM_H__
+
+#include <gio/gio.h>
+
+#include "realm-provider.h"
+
+G_BEGIN_DECLS
+
+void           realm_prewarm_start        (GDBusConnection *connection,
+                                           RealmProvider *provider);
+
+void           realm_prewarm_stop         (void);
+
+G_END_DECLS
+
+#endif /* __REALM_PREWARM_H__ */
@@ -22,6 +22,7 @@
 #include "realm-invocation.h"
 #include "realm-kerberos.h"
 #include "realm-network.h"
+#include "realm-options.h"
 #include "realm-provider.h"
 #include "realm-settings.h"
 
@@ -32,6 +33,12 @@
 
 #define TIMEOUT_SECONDS 15
 
+/* How many discoveries DiscoverMany runs at once */
+#define DISCOVER_MANY_CONCURRENT 16
+
+/* Relevance of realms matched from our configuration, rather than discovered */
+#define CONFIGURED_RELEVANCE 20
+
 G_DEFINE_TYPE (RealmProvider, realm_provider, G_TYPE_DBUS_OBJECT_SKELETON);
 
 struct _RealmProviderPrivate {
@@ -47,6 +54,32 @@ typedef struct {
 	guint timeout_id;
 } MethodClosure;
 
+typedef struct {
+	RealmProvider *self;
+	GDBusMethodInvocation *invocation;
+	GVariant *options;
+	gchar **strings;
+	GVariant **results;
+	guint count;
+	guint next;
+	gint outstanding;
+	guint timeout_id;
+} ManyClosure;
+
+typedef struct {
+	ManyClosure *many;
+	guint index;
+} ManyItem;
+
+typedef struct {
+	RealmProvider *self;
+	gchar *hold;
+	guint timeout_id;
+} Refresh;
+
+/* Background refreshes of configured realms in progress */
+static GHashTable *refreshing = NULL;
+
 static MethodClosure *
 method_closure_new (RealmProvider *self,
                     GDBusMethodInvocation *invocation,
@@ -79,9 +112,28 @@ sort_configured_first (gconstpointer a,
 	return a_val - b_val;
 }
 
+static gboolean
+matches_software (RealmKerberos *realm,
+                  GVariant *options)
+{
+	const gchar *server_software;
+	const gchar *client_software;
+
+	if (options == NULL)
+		return TRUE;
+
+	server_software = realm_kerberos_get_detail (realm, REALM_DBUS_OPTION_SERVER_SOFTWARE);
+	client_software = realm_kerberos_get_detail (realm, REALM_DBUS_OPTION_CLIENT_SOFTWARE);
+	if (server_software == NULL || client_software == NULL)
+		return FALSE;
+
+	return realm_provider_match_software (options, server_software, client_software, NULL);
+}
+
 static GList *
 discover_configured (RealmProvider *self,
-                     const gchar *string)
+                     const gchar *string,
+                     GVariant *options)
 {
 	GList *matched = NULL;
 	GList *realms;
@@ -90,7 +142,8 @@ discover_configured (RealmProvider *self,
 	realms = realm_provider_get_realms (self);
 	for (l = realms; l != NULL; l = g_list_next (l)) {
 		if (realm_kerberos_is_configured (l->data) &&
-		    realm_kerberos_matches (l->data, string))
+		    realm_kerberos_matches (l->data, string) &&
+		    matches_software (l->data, options))
 			matched = g_list_prepend (matched, g_object_ref (l->data));
 	}
 	g_list_free (realms);
@@ -98,6 +151,159 @@ discover_configured (RealmProvider *self,
 	return matched;
 }
 
+static gint
+configured_relevance (GList *realms)
+{
+	const gchar *server_software;
+	const gchar *client_software;
+	gint relevance = 10;
+	gint value;
+	GList *l;
+
+	/* The same relevance the providers give when discovering these realms */
+	for (l = realms; l != NULL; l = g_list_next (l)) {
+		server_software = realm_kerberos_get_detail (l->data, REALM_DBUS_OPTION_SERVER_SOFTWARE);
+		client_software = realm_kerberos_get_detail (l->data, REALM_DBUS_OPTION_CLIENT_SOFTWARE);
+		if (server_software == NULL || client_software == NULL)
+			continue;
+
+		if (g_str_equal (server_software, REALM_DBUS_IDENTIFIER_IPA))
+			value = 100;
+		else if (g_str_equal (server_software, REALM_DBUS_IDENTIFIER_ACTIVE_DIRECTORY))
+			value = realm_provider_is_default (server_software, client_software) ? 100 : 50;
+		else
+			continue;
+
+		relevance = MAX (relevance, value);
+	}
+
+	return relevance;
+}
+
+static void
+refresh_release (Refresh *refresh)
+{
+	g_hash_table_remove (refreshing, refresh->hold);
+	realm_daemon_release (refresh->hold);
+	realm_daemon_poke ();
+}
+
+static gboolean
+on_refresh_timeout (gpointer user_data)
+{
+	Refresh *refresh = user_data;
+
+	/* Discovery carries on, but stop keeping the daemon alive for it */
+	g_debug ("Refreshing configured realm timed out: %s", refresh->hold);
+	refresh->timeout_id = 0;
+	refresh_release (refresh);
+
+	return FALSE;
+}
+
+static void
+on_refresh_complete (GObject *source,
+                     GAsyncResult *result,
+                     gpointer user_data)
+{
+	Refresh *refresh = user_data;
+	GError *error = NULL;
+	gint relevance;
+	GList *realms;
+
+	/* Discovery updates the realm objects, nobody waits on the result */
+	realms = realm_provider_discover_finish (refresh->self, result, &relevance, &error);
+	if (error != NULL) {
+		g_debug ("Couldn't refresh configured realm: %s", error->message);
+		g_error_free (error);
+	}
+	g_list_free_full (realms, g_object_unref);
+
+	if (refresh->timeout_id != 0) {
+		g_source_remove (refresh->timeout_id);
+		refresh->timeout_id = 0;
+		refresh_release (refresh);
+	}
+
+	g_object_unref (refresh->self);
+	g_free (refresh->hold);
+	g_free (refresh);
+}
+
+static GList *
+discover_configured_now (RealmProvider *self,
+                         const gchar *string,
+                         GVariant *options,
+                         gint *relevance)
+{
+	Refresh *refresh;
+	GList *realms;
+	gchar *hold;
+
+	/* Discovering a whole forest needs the network anyway */
+	if (realm_options_forest (options))
+		return NULL;
+
+	/* The membership software of a configured realm isn't known here */
+	if (options && g_variant_lookup (options, REALM_DBUS_OPTION_MEMBERSHIP_SOFTWARE, "&s", NULL))
+		return NULL;
+
+	realms = discover_configured (self, string, options);
+	if (realms == NULL)
+		return NULL;
+
+	*relevance = configured_relevance (realms);
+
+	/*
+	 * Answer from the configuration we've already loaded, rather than
+	 * making the caller wait on the network for a realm we're a member
+	 * of. Then discover it in the background to bring the details of
+	 * the realm up to date, once at a time for each string.
+	 */
+	hold = g_strdup_printf ("refresh:%s:%s", g_dbus_object_get_object_path (G_DBUS_OBJECT (self)), string);
+	if (refreshing == NULL)
+		refreshing = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+	if (g_hash_table_contains (refreshing, hold)) {
+		g_free (hold);
+
+	} else {
+		g_hash_table_add (refreshing, g_strdup (hold));
+		realm_daemon_hold (hold);
+
+		refresh = g_new0 (Refresh, 1);
+		refresh->self = g_object_ref (self);
+		refresh->hold = hold;
+		refresh->timeout_id = g_timeout_add_seconds (TIMEOUT_SECONDS,
+		                                             on_refresh_timeout, refresh);
+		realm_provider_discover (self, string, options, NULL, on_refresh_complete, refresh);
+	}
+
+	return realms;
+}
+
+static GVariant *
+build_realm_paths (GList *realms)
+{
+	GPtrArray *results;
+	const gchar *path;
+	GVariant *paths;
+	GList *l;
+
+	results = g_ptr_array_new ();
+	for (l = realms; l != NULL; l = g_list_next (l)) {
+		path = g_dbus_object_get_object_path (l->data);
+		g_ptr_array_add (results, g_variant_new_object_path (path));
+	}
+
+	paths = g_variant_new_array (G_VARIANT_TYPE ("o"),
+	                             (GVariant *const *)results->pdata,
+	                             results->len);
+	g_ptr_array_free (results, TRUE);
+
+	return paths;
+}
+
 static void
 return_discover_result (MethodClosure *closure,
                         GList *realms,
@@ -106,9 +312,6 @@ return_discover_result (MethodClosure *closure,
 {
 	GCancellable *cancellable;
 	GVariant *retval;
-	GPtrArray *results;
-	const gchar *path;
-	GList *l;
 
 	/* Timeout was fired, cancel means timed out */
 	if (closure->timeout_id == 0) {
@@ -127,24 +330,13 @@ return_discover_result (MethodClosure *closure,
 
 	/* If no realms were discovered, try matching configured realms */
 	if (error == NULL && realms == NULL && closure->string) {
-		realms = discover_configured (closure->self, closure->string);
-		relevance = 20;
+		realms = discover_configured (closure->self, closure->string, NULL);
+		relevance = CONFIGURED_RELEVANCE;
 	}
 
 	if (error == NULL) {
 		realms = g_list_sort (realms, sort_configured_first);
-		results = g_ptr_array_new ();
-		for (l = realms; l != NULL; l = g_list_next (l)) {
-			path = g_dbus_object_get_object_path (l->data);
-			g_ptr_array_add (results, g_variant_new_object_path (path));
-		}
-
-		retval = g_variant_new ("(i@ao)", relevance,
-		                        g_variant_new_array (G_VARIANT_TYPE ("o"),
-		                                             (GVariant *const *)results->pdata,
-		                                             results->len));
-		g_ptr_array_free (results, TRUE);
-
+		retval = g_variant_new ("(i@ao)", relevance, build_realm_paths (realms));
 		g_dbus_method_invocation_return_value (closure->invocation, retval);
 	} else {
 		if (error->domain == REALM_ERROR || error->domain == G_DBUS_ERROR) {
@@ -263,6 +455,8 @@ realm_provider_handle_discover (RealmDbusProvider *provider,
 	RealmProvider *self = REALM_PROVIDER (user_data);
 	GDBusConnection *connection;
 	MethodClosure *method;
+	gint relevance;
+	GList *realms;
 
 	method = method_closure_new (self, invocation, options);
 	method->timeout_id = g_timeout_add_seconds (TIMEOUT_SECONDS,
@@ -276,10 +470,204 @@ realm_provider_handle_discover (RealmDbusProvider *provider,
 		                                     method);
 
 	} else {
-		realm_provider_discover (self, method->string, options, invocation,
-		                         on_discover_complete, method);
+		realms = discover_configured_now (self, method->string, options, &relevance);
+		if (realms != NULL) {
+			realm_diagnostics_info (invocation, "Using configured realm: %s", method->string);
+			return_discover_result (method, realms, relevance, NULL);
+		} else {
+			realm_provider_discover (self, method->string, options, invocation,
+			                         on_discover_complete, method);
+		}
+	}
+
+	return TRUE;
+}
+
+static void
+many_closure_free (ManyClosure *many)
+{
+	guint i;
+
+	g_object_unref (many->self);
+	g_object_unref (many->invocation);
+	g_variant_unref (many->options);
+	g_strfreev (many->strings);
+	for (i = 0; i < many->count; i++) {
+		if (many->results[i])
+			g_variant_unref (many->results[i]);
+	}
+	g_free (many->results);
+	g_assert (many->timeout_id == 0);
+	g_free (many);
+}
+
+static void
+return_discover_many (ManyClosure *many)
+{
+	GCancellable *cancellable;
+	GVariantBuilder builder;
+	guint i;
+
+	/* Cancel after a timeout just means some strings weren't discovered */
+	if (many->timeout_id != 0) {
+		g_source_remove (many->timeout_id);
+		many->timeout_id = 0;
+
+		cancellable = realm_invocation_get_cancellable (many->invocation);
+		if (g_cancellable_is_cancelled (cancellable)) {
+			g_dbus_method_invocation_return_error (many->invocation, REALM_ERROR, REALM_ERROR_CANCELLED,
+			                                       _("Operation was cancelled."));
+			many_closure_free (many);
+			return;
+		}
+	}
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(siaos)"));
+	for (i = 0; i < many->count; i++) {
+		if (many->results[i])
+			g_variant_builder_add_value (&builder, many->results[i]);
+		else
+			g_variant_builder_add (&builder, "(si@aos)", many->strings[i], -1,
+			                       g_variant_new_array (G_VARIANT_TYPE ("o"), NULL, 0),
+			                       _("Discovery timed out"));
+	}
+
+	g_dbus_method_invocation_return_value (many->invocation,
+	                                       g_variant_new ("(a(siaos))", &builder));
+	many_closure_free (many);
+}
+
+static void  step_discover_many  (ManyClosure *many);
+
+static void
+set_discover_many_result (ManyClosure *many,
+                          guint index,
+                          GList *realms,
+                          gint relevance,
+                          const gchar *message)
+{
+	realms = g_list_sort (realms, sort_configured_first);
+	many->results[index] = g_variant_ref_sink (g_variant_new ("(si@aos)", many->strings[index], relevance,
+	                                                          build_realm_paths (realms),
+	                                                          message ? message : ""));
+	g_list_free_full (realms, g_object_unref);
+}
+
+static void
+on_discover_many_complete (GObject *source,
+                           GAsyncResult *result,
+                           gpointer user_data)
+{
+	ManyItem *item = user_data;
+	ManyClosure *many = item->many;
+	const gchar *string;
+	GError *error = NULL;
+	gint relevance;
+	GList *realms;
+
+	string = many->strings[item->index];
+	realms = realm_provider_discover_finish (many->self, result, &relevance, &error);
+
+	if (error != NULL) {
+		if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+			set_discover_many_result (many, item->index, NULL, -1, _("Discovery timed out"));
+		} else {
+			realm_diagnostics_error (many->invocation, error, "Failed to discover realm: %s", string);
+			g_dbus_error_strip_remote_error (error);
+			set_discover_many_result (many, item->index, NULL, -1, error->message);
+		}
+		g_error_free (error);
+
+	} else {
+		/* Same as Discover, try matching configured realms */
+		if (realms == NULL) {
+			realms = discover_configured (many->self, string, NULL);
+			relevance = CONFIGURED_RELEVANCE;
+		}
+		set_discover_many_result (many, item->index, realms, relevance, NULL);
+	}
+
+	many->outstanding--;
+	g_free (item);
+
+	step_discover_many (many);
+}
+
+static void
+step_discover_many (ManyClosure *many)
+{
+	ManyItem *item;
+	gint relevance;
+	GList *realms;
+
+	while (many->next < many->count && many->outstanding < DISCOVER_MANY_CONCURRENT) {
+		realms = discover_configured_now (many->self, many->strings[many->next], many->options, &relevance);
+		if (realms != NULL) {
+			set_discover_many_result (many, many->next++, realms, relevance, NULL);
+			continue;
+		}
+
+		item = g_new0 (ManyItem, 1);
+		item->many = many;
+		item->index = many->next++;
+		many->outstanding++;
+
+		realm_provider_discover (many->self, many->strings[item->index],
+		                         many->options, many->invocation,
+		                         on_discover_many_complete, item);
+	}
+
+	if (many->outstanding == 0)
+		return_discover_many (many);
+}
+
+static gboolean
+on_discover_many_timeout (gpointer user_data)
+{
+	ManyClosure *many = user_data;
+	many->timeout_id = 0;
+
+	realm_diagnostics_error (many->invocation, NULL,
+	                         "Discovery timed out after %d seconds",
+	                         TIMEOUT_SECONDS * (1 + many->count / DISCOVER_MANY_CONCURRENT));
+	g_cancellable_cancel (realm_invocation_get_cancellable (many->invocation));
+	return FALSE;
+}
+
+static gboolean
+realm_provider_handle_discover_many (RealmDbusProvider *provider,
+                                     GDBusMethodInvocation *invocation,
+                                     const gchar *const *strings,
+                                     GVariant *options,
+                                     gpointer user_data)
+{
+	RealmProvider *self = REALM_PROVIDER (user_data);
+	ManyClosure *many;
+	guint i;
+
+	many = g_new0 (ManyClosure, 1);
+	many->self = g_object_ref (self);
+	many->invocation = g_object_ref (invocation);
+	many->options = g_variant_ref (options);
+	many->strings = g_strdupv ((gchar **)strings);
+	many->count = g_strv_length (many->strings);
+	many->results = g_new0 (GVariant *, many->count);
+
+	for (i = 0; i < many->count; i++) {
+		g_strstrip (many->strings[i]);
+		if (g_str_equal (many->strings[i], "")) {
+			g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS,
+			                                       "Cannot discover an empty string with DiscoverMany");
+			many_closure_free (many);
+			return TRUE;
+		}
 	}
 
+	/* Each batch of concurrent discoveries gets the usual timeout */
+	many->timeout_id = g_timeout_add_seconds (TIMEOUT_SECONDS * (1 + many->count / DISCOVER_MANY_CONCURRENT),
+	                                          on_discover_many_timeout, many);
+
+	step_discover_many (many);
 	return TRUE;
 }
 
@@ -316,6 +704,8 @@ realm_provider_init (RealmProvider *self)
 	self->pv->provider_iface = realm_dbus_provider_skeleton_new ();
 	g_signal_connect (self->pv->provider_iface, "handle-discover",
 	                  G_CALLBACK (realm_provider_handle_discover), self);
+	g_signal_connect (self->pv->provider_iface, "handle-discover-many",
+	                  G_CALLBACK (realm_provider_handle_discover_many), self);
 	g_dbus_object_skeleton_add_interface (G_DBUS_OBJECT_SKELETON (self),
 	                                      G_DBUS_INTERFACE_SKELETON (self->pv->provider_iface));
 }
@@ -46,6 +46,7 @@ typedef struct {
 	RealmIniConfig *config;
 	gchar *custom_smb_conf;
 	gchar *envvar;
+	const gchar *server;
 } JoinClosure;
 
 static void
@@ -144,6 +145,16 @@ join_closure_init (GTask *task,
 	join->invocation = invocation ? g_object_ref (invocation) : NULL;
 	g_task_set_task_data (task, join, join_closure_free);
 
+	/*
+	 * Join against the domain controller discovery chose, usually in our
+	 * site, and extract the keytab from that same one, before the new
+	 * account has replicated. Otherwise let net choose.
+	 */
+	if (disco->explicit_server)
+		join->server = disco->explicit_server;
+	else if (do_join)
+		join->server = disco->server_name;
+
 	explicit_computer_name = realm_options_computer_name (options, disco->domain_name);
 	/* Set netbios name to explicit or truncated name if available */
 	if (explicit_computer_name != NULL)
@@ -193,6 +204,7 @@ join_closure_init (GTask *task,
 	if (fqdn != NULL && join->disco->domain_name != NULL
 	                 && (fqdn_dom = strchr (fqdn, '.')) != NULL
 	                 && g_ascii_strcasecmp (fqdn_dom + 1, join->disco->domain_name) != 0 ) {
+		g_free (disco->dns_fqdn);
 		disco->dns_fqdn = g_strdup (fqdn);
 		realm_ini_config_set (join->config, REALM_SAMBA_CONFIG_GLOBAL,
 		                      "additional dns hostnames", disco->dns_fqdn, NULL);
@@ -264,9 +276,9 @@ begin_net_process (JoinClosure *join,
 		g_ptr_array_add (args, join->custom_smb_conf);
 	}
 
-	if (join->disco->explicit_server) {
+	if (join->server) {
 		g_ptr_array_add (args, "-S");
-		g_ptr_array_add (args, join->disco->explicit_server);
+		g_ptr_array_add (args, (gpointer)join->server);
 	}
 
 	va_start (va, user_data);
@@ -19,8 +19,10 @@
 #include "realm-dbus-constants.h"
 #include "realm-diagnostics.h"
 #include "realm-disco-domain.h"
+#include "realm-disco-forest.h"
 #include "realm-errors.h"
 #include "realm-kerberos.h"
+#include "realm-options.h"
 #include "realm-packages.h"
 #include "realm-samba.h"
 #include "realm-samba-config.h"
@@ -97,8 +99,27 @@ on_ad_discover (GObject *source,
 	disco = realm_disco_domain_finish (result, &error);
 	if (error)
 		g_task_return_error (task, error);
+	else if (disco)
+		g_task_return_pointer (task, g_list_append (NULL, disco), realm_disco_forest_free);
 	else
-		g_task_return_pointer (task, disco, realm_disco_unref);
+		g_task_return_pointer (task, NULL, NULL);
+	g_object_unref (task);
+}
+
+static void
+on_ad_forest_discover (GObject *source,
+                       GAsyncResult *result,
+                       gpointer user_data)
+{
+	GTask *task = G_TASK (user_data);
+	GError *error = NULL;
+	GList *discos;
+
+	discos = realm_disco_forest_finish (result, &error);
+	if (error)
+		g_task_return_error (task, error);
+	else
+		g_task_return_pointer (task, discos, realm_disco_forest_free);
 	g_object_unref (task);
 }
 
@@ -120,6 +141,10 @@ realm_samba_provider_discover_async (RealmProvider *provider,
 	                                    REALM_DBUS_IDENTIFIER_SAMBA)) {
 		g_task_return_pointer (task, NULL, NULL);
 
+	} else if (realm_options_forest (options)) {
+		realm_disco_forest_async (string, invocation,
+		                          on_ad_forest_discover, g_object_ref (task));
+
 	} else {
 		realm_disco_domain_async (string, invocation,
 		                          on_ad_discover, g_object_ref (task));
@@ -134,27 +159,35 @@ realm_samba_provider_discover_finish (RealmProvider *provider,
                                       gint *relevance,
                                       GError **error)
 {
-	RealmKerberos *realm = NULL;
+	RealmKerberos *realm;
+	GList *realms = NULL;
 	RealmDisco *disco;
+	GList *discos;
+	GList *l;
 
-	disco = g_task_propagate_pointer (G_TASK (result), error);
-	if (disco == NULL)
+	discos = g_task_propagate_pointer (G_TASK (result), error);
+	if (discos == NULL)
 		return NULL;
 
-	if (g_strcmp0 (disco->server_software, REALM_DBUS_IDENTIFIER_ACTIVE_DIRECTORY) == 0) {
-		realm = realm_provider_lookup_or_register_realm (provider,
-		                                                 REALM_TYPE_SAMBA,
-		                                                 disco->domain_name, disco);
+	/* More than one when discovering a whole forest */
+	for (l = discos; l != NULL; l = g_list_next (l)) {
+		disco = l->data;
+		if (g_strcmp0 (disco->server_software, REALM_DBUS_IDENTIFIER_ACTIVE_DIRECTORY) == 0) {
+			realm = realm_provider_lookup_or_register_realm (provider,
+			                                                 REALM_TYPE_SAMBA,
+			                                                 disco->domain_name, disco);
+			realms = g_list_prepend (realms, g_object_ref (realm));
+		}
 	}
 
-	realm_disco_unref (disco);
+	realm_disco_forest_free (discos);
 
-	if (realm == NULL)
+	if (realms == NULL)
 		return NULL;
 
 	/* Return a higher priority if we're the default */
 	*relevance = realm_provider_is_default (REALM_DBUS_IDENTIFIER_ACTIVE_DIRECTORY, REALM_DBUS_IDENTIFIER_WINBIND) ? 100 : 50;
-	return g_list_append (NULL, g_object_ref (realm));
+	return g_list_reverse (realms);
 }
 
 static void
@@ -24,6 +24,8 @@
 #include "realm-samba-enroll.h"
 #include "realm-settings.h"
 #include "realm-service.h"
+#include "realm-steps.h"
+#include "realm-trace.h"
 #include "dbus/realm-dbus-constants.h"
 
 #include <glib/gstdio.h>
@@ -31,43 +33,65 @@
 #include <errno.h>
 
 static void
-on_nss_complete (GObject *source,
-                 GAsyncResult *result,
-                 gpointer user_data)
+begin_known_command (gpointer data,
+                     GDBusMethodInvocation *invocation,
+                     GAsyncReadyCallback callback,
+                     gpointer user_data)
 {
-	GTask *task = G_TASK (user_data);
-	GError *error = NULL;
+	realm_command_run_known_async (data, NULL, invocation, callback, user_data);
+}
+
+static gboolean
+finish_enable_logins (GAsyncResult *result,
+                      GError **error)
+{
+	GError *err = NULL;
 	gint status;
 
-	status = realm_command_run_finish (result, NULL, &error);
-	if (error == NULL && status != 0)
-		g_set_error (&error, REALM_ERROR, REALM_ERROR_INTERNAL,
+	status = realm_command_run_finish (result, NULL, &err);
+	if (err == NULL && status != 0)
+		g_set_error (&err, REALM_ERROR, REALM_ERROR_INTERNAL,
 		             "Enabling winbind in nsswitch.conf and pam failed");
-	if (error != NULL)
-		g_task_return_error (task, error);
-	else
-		g_task_return_boolean (task, TRUE);
-	g_object_unref (task);
+	if (err != NULL) {
+		g_propagate_error (error, err);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static gboolean
+finish_disable_logins (GAsyncResult *result,
+                       GError **error)
+{
+	GError *err = NULL;
+	gint status;
+
+	status = realm_command_run_finish (result, NULL, &err);
+	if (err == NULL && status != 0)
+		g_set_error (&err, REALM_ERROR, REALM_ERROR_INTERNAL,
+		             "Disabling winbind in /etc/nsswitch.conf failed");
+	if (err != NULL) {
+		g_propagate_error (error, err);
+		return FALSE;
+	}
+
+	return TRUE;
 }
 
 static void
-on_enable_do_nss (GObject *source,
-                  GAsyncResult *result,
-                  gpointer user_data)
+on_steps_complete (GObject *source,
+                   GAsyncResult *result,
+                   gpointer user_data)
 {
 	GTask *task = G_TASK (user_data);
-	GDBusMethodInvocation *invocation = g_task_get_task_data (task);
 	GError *error = NULL;
 
-	realm_service_enable_and_restart_finish (result, &error);
-	if (error == NULL) {
-		realm_command_run_known_async ("winbind-enable-logins", NULL, invocation,
-		                               on_nss_complete, g_object_ref (task));
-
-	} else {
+	realm_steps_run_finish (result, &error);
+	if (error != NULL)
 		g_task_return_error (task, error);
-	}
-
+	else
+		g_task_return_boolean (task, TRUE);
 	g_object_unref (task);
 }
 
@@ -80,6 +104,9 @@ realm_samba_winbind_configure_async (RealmIniConfig *config,
                                      gpointer user_data)
 {
 	RealmIniConfig *pwc;
+	RealmTraceSpan *span;
+	RealmSteps *steps;
+	guint enable, restart, logins;
 	GTask *task;
 	GError *error = NULL;
 	gchar *workgroup = NULL;
@@ -91,11 +118,10 @@ realm_samba_winbind_configure_async (RealmIniConfig *config,
 	g_return_if_fail (invocation != NULL || G_IS_DBUS_METHOD_INVOCATION (invocation));
 
 	task = g_task_new (NULL, NULL, callback, user_data);
-	if (invocation != NULL)
-		g_task_set_task_data (task, g_object_ref (invocation), g_object_unref);
 
 	/* TODO: need to use autorid mapping */
 
+	span = realm_trace_begin (invocation, "config", "Configuring winbind");
 	if (realm_ini_config_begin_change(config, &error)) {
 		realm_ini_config_set (config, REALM_SAMBA_CONFIG_GLOBAL,
 		                      "winbind enum users", "no",
@@ -168,9 +194,23 @@ realm_samba_winbind_configure_async (RealmIniConfig *config,
 		g_object_unref (pwc);
 	}
 
+	realm_trace_end (span, error);
+
+	/*
+	 * Enabling reloads the service manager, so restart after it. Only
+	 * let users log in through winbind once it's running.
+	 */
 	if (error == NULL) {
-		realm_service_enable_and_restart ("winbind", invocation,
-		                                  on_enable_do_nss, g_object_ref (task));
+		steps = realm_steps_new (invocation);
+		enable = realm_steps_add (steps, "enable winbind", realm_service_enable_step,
+		                          realm_service_enable_finish, "winbind", NULL);
+		restart = realm_steps_add (steps, "restart winbind", realm_service_restart_step,
+		                           realm_service_restart_finish, "winbind", NULL);
+		logins = realm_steps_add (steps, "enable winbind logins", begin_known_command,
+		                          finish_enable_logins, "winbind-enable-logins", NULL);
+		realm_steps_after (steps, restart, enable);
+		realm_steps_after (steps, logins, restart);
+		realm_steps_run_async (steps, on_steps_complete, g_object_ref (task));
 	} else {
 		g_task_return_error (task, error);
 	}
@@ -186,63 +226,32 @@ realm_samba_winbind_configure_finish (GAsyncResult *result,
 	return g_task_propagate_boolean (G_TASK (result), error);
 }
 
-static void
-on_disable_complete (GObject *source,
-                     GAsyncResult *result,
-                     gpointer user_data)
-{
-	GTask *task = G_TASK (user_data);
-	GError *error = NULL;
-
-	realm_service_disable_and_stop_finish (result, &error);
-	if (error != NULL)
-		g_task_return_error (task, error);
-	else
-		g_task_return_boolean (task, TRUE);
-	g_object_unref (task);
-}
-
-static void
-on_nss_do_disable (GObject *source,
-                   GAsyncResult *result,
-                   gpointer user_data)
-{
-	GTask *task = G_TASK (user_data);
-	GDBusMethodInvocation *invocation = g_task_get_task_data (task);
-	GError *error = NULL;
-	gint status;
-
-	status = realm_command_run_finish (result, NULL, &error);
-	if (error == NULL && status != 0)
-		g_set_error (&error, REALM_ERROR, REALM_ERROR_INTERNAL,
-		             "Disabling winbind in /etc/nsswitch.conf failed");
-	if (error == NULL) {
-		realm_service_disable_and_stop ("winbind", invocation,
-		                                on_disable_complete, g_object_ref (task));
-	} else {
-		g_task_return_error (task, error);
-	}
-
-	g_object_unref (task);
-}
-
 void
 realm_samba_winbind_deconfigure_async (RealmIniConfig *config,
                                        GDBusMethodInvocation *invocation,
                                        GAsyncReadyCallback callback,
                                        gpointer user_data)
 {
+	RealmSteps *steps;
+	guint logins, disable, stop;
 	GTask *task;
 
 	g_return_if_fail (config != NULL);
 	g_return_if_fail (invocation != NULL || G_IS_DBUS_METHOD_INVOCATION (invocation));
 
 	task = g_task_new (NULL, NULL, callback, user_data);
-	if (invocation != NULL)
-		g_task_set_task_data (task, g_object_ref (invocation), g_object_unref);
 
-	realm_command_run_known_async ("winbind-disable-logins", NULL, invocation,
-	                               on_nss_do_disable, g_object_ref (task));
+	/* Stop users logging in through winbind before it goes away */
+	steps = realm_steps_new (invocation);
+	logins = realm_steps_add (steps, "disable winbind logins", begin_known_command,
+	                          finish_disable_logins, "winbind-disable-logins", NULL);
+	disable = realm_steps_add (steps, "disable winbind", realm_service_disable_step,
+	                           realm_service_disable_finish, "winbind", NULL);
+	stop = realm_steps_add (steps, "stop winbind", realm_service_stop_step,
+	                        realm_service_stop_finish, "winbind", NULL);
+	realm_steps_after (steps, disable, logins);
+	realm_steps_after (steps, stop, disable);
+	realm_steps_run_async (steps, on_steps_complete, g_object_ref (task));
 
 	g_object_unref (task);
 }
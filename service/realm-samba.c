@@ -30,6 +30,7 @@
 #include "realm-samba-enroll.h"
 #include "realm-samba-winbind.h"
 #include "realm-settings.h"
+#include "realm-trace.h"
 
 #include <glib/gstdio.h>
 #include <glib/gi18n.h>
@@ -180,6 +181,7 @@ on_join_do_winbind (GObject *source,
 	GTask *task = G_TASK (user_data);
 	EnrollClosure *enroll = g_task_get_task_data (task);
 	RealmSamba *self = g_task_get_source_object (task);
+	RealmTraceSpan *span = NULL;
 	GError *error = NULL;
 	const gchar *name;
 	const gchar *computer_name;
@@ -192,6 +194,7 @@ on_join_do_winbind (GObject *source,
 
 	realm_samba_enroll_join_finish (result, &error);
 	if (error == NULL) {
+		span = realm_trace_begin (enroll->invocation, "config", "Configuring smb.conf");
 		realm_ini_config_change (self->config, REALM_SAMBA_CONFIG_GLOBAL, &error,
 		                         "security", "ads",
 		                         "realm", enroll->disco->kerberos_realm,
@@ -210,6 +213,8 @@ on_join_do_winbind (GObject *source,
 		                         NULL);
 	}
 
+	realm_trace_end (span, error);
+
 	if (error == NULL) {
 		name = realm_kerberos_get_name (REALM_KERBEROS (self));
 		realm_samba_winbind_configure_async (self->config, name, enroll->options,
@@ -352,6 +357,7 @@ leave_deconfigure_begin (RealmSamba *self,
                          GTask *task)
 {
 	LeaveClosure *leave;
+	RealmTraceSpan *span;
 	GError *error = NULL;
 
 	leave = g_task_get_task_data (task);
@@ -366,12 +372,15 @@ leave_deconfigure_begin (RealmSamba *self,
 
 	/* Deconfigure smb.conf */
 	realm_diagnostics_info (leave->invocation, "Updating smb.conf file");
-	if (!realm_ini_config_change (self->config, REALM_SAMBA_CONFIG_GLOBAL, &error,
-	                              "workgroup", NULL,
-	                              "realm", NULL,
-	                              "additional dns hostnames", NULL,
-	                              "security", "user",
-	                              NULL)) {
+	span = realm_trace_begin (leave->invocation, "config", "Configuring smb.conf");
+	realm_ini_config_change (self->config, REALM_SAMBA_CONFIG_GLOBAL, &error,
+	                         "workgroup", NULL,
+	                         "realm", NULL,
+	                         "additional dns hostnames", NULL,
+	                         "security", "user",
+	                         NULL);
+	realm_trace_end (span, error);
+	if (error != NULL) {
 		g_task_return_error (task, error);
 		return;
 	}
@@ -18,9 +18,30 @@
 #include "realm-daemon.h"
 #include "realm-service.h"
 #include "realm-settings.h"
+#include "realm-steps.h"
+#include "realm-trace.h"
 
 #include <glib/gi18n.h>
 
+static void
+on_service_command (GObject *source,
+                    GAsyncResult *result,
+                    gpointer user_data)
+{
+	GTask *task = G_TASK (user_data);
+	RealmTraceSpan *span = g_task_get_task_data (task);
+	GError *error = NULL;
+
+	realm_command_run_finish (result, NULL, &error);
+	realm_trace_end (span, error);
+
+	if (error != NULL)
+		g_task_return_error (task, error);
+	else
+		g_task_return_boolean (task, TRUE);
+	g_object_unref (task);
+}
+
 static void
 begin_service_command (const gchar *command,
                        gboolean skip_in_install_mode,
@@ -28,30 +49,32 @@ begin_service_command (const gchar *command,
                        GAsyncReadyCallback callback,
                        gpointer user_data)
 {
+	RealmTraceSpan *span;
 	GTask *task;
 
+	task = g_task_new (NULL, NULL, callback, user_data);
+	g_task_set_source_tag (task, begin_service_command);
+
 	/* If install mode, don't do certain service stuff */
 	if (skip_in_install_mode && realm_daemon_is_install_mode ()) {
 		g_debug ("skipping %s command in install mode", command);
-		task = g_task_new (NULL, NULL, callback, user_data);
-		g_task_set_source_tag (task, begin_service_command);
 		g_task_return_boolean (task, TRUE);
-		g_object_unref (task);
 	} else {
-		realm_command_run_known_async (command, NULL, invocation, callback, user_data);
+		span = realm_trace_begin (invocation, "service", "%s", command);
+		g_task_set_task_data (task, span, NULL);
+		realm_command_run_known_async (command, NULL, invocation,
+		                               on_service_command, g_object_ref (task));
 	}
+
+	g_object_unref (task);
 }
 
 static gboolean
 finish_service_command (GAsyncResult *result,
                         GError **error)
 {
-	if (g_task_is_valid (result, NULL) &&
-	    g_task_get_source_tag (G_TASK (result)) == begin_service_command) {
-		return g_task_propagate_boolean (G_TASK (result), error);
-	}
-
-	return realm_command_run_finish (result, NULL, error) != -1;
+	g_return_val_if_fail (g_task_is_valid (result, NULL), FALSE);
+	return g_task_propagate_boolean (G_TASK (result), error);
 }
 
 void
@@ -134,55 +157,42 @@ realm_service_stop_finish (GAsyncResult *result,
 	return finish_service_command (result, error);
 }
 
-typedef struct {
-	gchar *service_name;
-	GDBusMethodInvocation *invocation;
-} CallClosure;
+/* The same calls, in the shape of a RealmStepAsync with the service name as data */
 
-static void
-call_closure_free (gpointer data)
+void
+realm_service_enable_step (gpointer service_name,
+                           GDBusMethodInvocation *invocation,
+                           GAsyncReadyCallback callback,
+                           gpointer user_data)
 {
-	CallClosure *call = data;
-	g_free (call->service_name);
-	g_clear_object (&call->invocation);
-	g_free (call);
+	realm_service_enable (service_name, invocation, callback, user_data);
 }
 
-static void
-on_enable_restarted (GObject *source,
-                     GAsyncResult *result,
-                     gpointer user_data)
+void
+realm_service_disable_step (gpointer service_name,
+                            GDBusMethodInvocation *invocation,
+                            GAsyncReadyCallback callback,
+                            gpointer user_data)
 {
-	GTask *task = G_TASK (user_data);
-	GError *error = NULL;
-
-	realm_service_restart_finish (result, &error);
-	if (error != NULL)
-		g_task_return_error (task, error);
-	else
-		g_task_return_boolean (task, TRUE);
-	g_object_unref (task);
+	realm_service_disable (service_name, invocation, callback, user_data);
 }
 
-
-static void
-on_enable_enabled (GObject *source,
-                   GAsyncResult *result,
-                   gpointer user_data)
+void
+realm_service_restart_step (gpointer service_name,
+                            GDBusMethodInvocation *invocation,
+                            GAsyncReadyCallback callback,
+                            gpointer user_data)
 {
-	GTask *task = G_TASK (user_data);
-	CallClosure *call = g_task_get_task_data (task);
-	GError *error = NULL;
-
-	realm_service_enable_finish (result, &error);
-	if (error == NULL) {
-		realm_service_restart (call->service_name, call->invocation,
-		                       on_enable_restarted, g_object_ref (task));
-	} else {
-		g_task_return_error (task, error);
-	}
+	realm_service_restart (service_name, invocation, callback, user_data);
+}
 
-	g_object_unref (task);
+void
+realm_service_stop_step (gpointer service_name,
+                         GDBusMethodInvocation *invocation,
+                         GAsyncReadyCallback callback,
+                         gpointer user_data)
+{
+	realm_service_stop (service_name, invocation, callback, user_data);
 }
 
 void
@@ -191,65 +201,31 @@ realm_service_enable_and_restart (const gchar *service_name,
                                   GAsyncReadyCallback callback,
                                   gpointer user_data)
 {
-	GTask *task;
-	CallClosure *call;
-
-	task = g_task_new (NULL, NULL, callback, user_data);
-	call = g_new0 (CallClosure, 1);
-	call->service_name = g_strdup (service_name);
-	call->invocation = invocation ? g_object_ref (invocation) : invocation;
-	g_task_set_task_data (task, call, call_closure_free);
-
-	realm_service_enable (call->service_name, call->invocation,
-	                      on_enable_enabled, g_object_ref (task));
-
-	g_object_unref (task);
+	RealmSteps *steps;
+	guint enable, restart;
+	gchar *name;
+
+	/* Enabling reloads the service manager, so restart only after it succeeds */
+	steps = realm_steps_new (invocation);
+	name = g_strdup_printf ("enable %s", service_name);
+	enable = realm_steps_add (steps, name, realm_service_enable_step,
+	                          realm_service_enable_finish, g_strdup (service_name), g_free);
+	g_free (name);
+	name = g_strdup_printf ("restart %s", service_name);
+	restart = realm_steps_add (steps, name, realm_service_restart_step,
+	                           realm_service_restart_finish, g_strdup (service_name), g_free);
+	g_free (name);
+	realm_steps_after (steps, restart, enable);
+
+	realm_steps_run_async (steps, callback, user_data);
 }
 
 gboolean
 realm_service_enable_and_restart_finish (GAsyncResult *result,
                                          GError **error)
 {
-	g_return_val_if_fail (g_task_is_valid (result, NULL), FALSE);
 	g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
-	return g_task_propagate_boolean (G_TASK (result), error);
-}
-
-static void
-on_disable_stopped (GObject *source,
-                    GAsyncResult *result,
-                    gpointer user_data)
-{
-	GTask *task = G_TASK (user_data);
-	GError *error = NULL;
-
-	realm_service_stop_finish (result, &error);
-	if (error != NULL)
-		g_task_return_error (task, error);
-	else
-		g_task_return_boolean (task, TRUE);
-	g_object_unref (task);
-}
-
-
-static void
-on_disable_disabled (GObject *source,
-                     GAsyncResult *result,
-                     gpointer user_data)
-{
-	GTask *task = G_TASK (user_data);
-	CallClosure *call = g_task_get_task_data (task);
-	GError *error = NULL;
-
-	realm_service_disable_finish (result, &error);
-	if (error == NULL) {
-		realm_service_stop (call->service_name, call->invocation,
-		                    on_disable_stopped, g_object_ref (task));
-	} else {
-		g_task_return_error (task, error);
-	}
-
-	g_object_unref (task);
+	return realm_steps_run_finish (result, error);
 }
 
 void
@@ -258,26 +234,28 @@ realm_service_disable_and_stop (const gchar *service_name,
                                 GAsyncReadyCallback callback,
                                 gpointer user_data)
 {
-	GTask *task;
-	CallClosure *call;
-
-	task = g_task_new (NULL, NULL, callback, user_data);
-	call = g_new0 (CallClosure, 1);
-	call->service_name = g_strdup (service_name);
-	call->invocation = invocation ? g_object_ref (invocation) : invocation;
-	g_task_set_task_data (task, call, call_closure_free);
-
-	realm_service_disable (call->service_name, call->invocation,
-	                       on_disable_disabled, g_object_ref (task));
-
-	g_object_unref (task);
+	RealmSteps *steps;
+	guint disable, stop;
+	gchar *name;
+
+	steps = realm_steps_new (invocation);
+	name = g_strdup_printf ("disable %s", service_name);
+	disable = realm_steps_add (steps, name, realm_service_disable_step,
+	                           realm_service_disable_finish, g_strdup (service_name), g_free);
+	g_free (name);
+	name = g_strdup_printf ("stop %s", service_name);
+	stop = realm_steps_add (steps, name, realm_service_stop_step,
+	                        realm_service_stop_finish, g_strdup (service_name), g_free);
+	g_free (name);
+	realm_steps_after (steps, stop, disable);
+
+	realm_steps_run_async (steps, callback, user_data);
 }
 
 gboolean
 realm_service_disable_and_stop_finish (GAsyncResult *result,
                                        GError **error)
 {
-	g_return_val_if_fail (g_task_is_valid (result, NULL), FALSE);
 	g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
-	return g_task_propagate_boolean (G_TASK (result), error);
+	return realm_steps_run_finish (result, error);
 }
@@ -53,6 +53,26 @@ void             realm_service_restart                    (const gchar *service_
 gboolean         realm_service_restart_finish             (GAsyncResult *result,
                                                            GError **error);
 
+void             realm_service_enable_step                (gpointer service_name,
+                                                           GDBusMethodInvocation *invocation,
+                                                           GAsyncReadyCallback callback,
+                                                           gpointer user_data);
+
+void             realm_service_disable_step               (gpointer service_name,
+                                                           GDBusMethodInvocation *invocation,
+                                                           GAsyncReadyCallback callback,
+                                                           gpointer user_data);
+
+void             realm_service_restart_step               (gpointer service_name,
+                                                           GDBusMethodInvocation *invocation,
+                                                           GAsyncReadyCallback callback,
+                                                           gpointer user_data);
+
+void             realm_service_stop_step                  (gpointer service_name,
+                                                           GDBusMethodInvocation *invocation,
+                                                           GAsyncReadyCallback callback,
+                                                           gpointer user_data);
+
 void             realm_service_enable_and_restart         (const gchar *service_name,
                                                            GDBusMethodInvocation *invocation,
                                                            GAsyncReadyCallback callback,
@@ -28,6 +28,7 @@
 #include "realm-sssd.h"
 #include "realm-sssd-ad.h"
 #include "realm-sssd-config.h"
+#include "realm-trace.h"
 
 #include <glib/gstdio.h>
 #include <glib/gi18n.h>
@@ -236,6 +237,7 @@ on_join_do_sssd (GObject *source,
 	GTask *task = G_TASK (user_data);
 	JoinClosure *join = g_task_get_task_data (task);
 	RealmSssd *sssd = g_task_get_source_object (task);
+	RealmTraceSpan *span;
 	GError *error = NULL;
 
 	if (join->use_adcli) {
@@ -252,8 +254,10 @@ on_join_do_sssd (GObject *source,
 	}
 
 	if (error == NULL) {
+		span = realm_trace_begin (join->invocation, "config", "Configuring sssd.conf");
 		configure_sssd_for_domain (realm_sssd_get_config (sssd), join->disco,
 		                           join->options, join->use_adcli, &error);
+		realm_trace_end (span, error);
 	}
 
 	if (error == NULL) {
@@ -29,6 +29,7 @@
 #include "realm-sssd.h"
 #include "realm-sssd-ipa.h"
 #include "realm-sssd-config.h"
+#include "realm-trace.h"
 
 #include <glib/gi18n.h>
 #include <glib/gstdio.h>
@@ -141,6 +142,7 @@ on_ipa_client_do_restart (GObject *source,
 	RealmKerberos *realm = REALM_KERBEROS (sssd);
 	const gchar *access_provider;
 	const gchar *realmd_tags;
+	RealmTraceSpan *span;
 	GError *error = NULL;
 	GString *output = NULL;
 	RealmIniConfig *config;
@@ -172,8 +174,10 @@ on_ipa_client_do_restart (GObject *source,
 	domain = realm_kerberos_get_name (realm);
 	config = realm_sssd_get_config (sssd);
 	shell = realm_settings_string ("users", "default-shell");
+	span = NULL;
 
 	if (error == NULL) {
+		span = realm_trace_begin (enroll->invocation, "config", "Configuring sssd.conf");
 		home = realm_sssd_build_default_home (realm_settings_string ("users", "default-home"));
 		realmd_tags = realm_options_manage_system (enroll->options, domain) ? "manages-system" : "";
 
@@ -202,6 +206,8 @@ on_ipa_client_do_restart (GObject *source,
 		free (section);
 	}
 
+	realm_trace_end (span, error);
+
 	if (error == NULL) {
 		realm_service_enable_and_restart ("sssd", enroll->invocation,
 		                                  on_restart_done, g_object_ref (task));
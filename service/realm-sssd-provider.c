@@ -19,8 +19,10 @@
 #include "realm-dbus-constants.h"
 #include "realm-diagnostics.h"
 #include "realm-disco-domain.h"
+#include "realm-disco-forest.h"
 #include "realm-errors.h"
 #include "realm-kerberos.h"
+#include "realm-options.h"
 #include "realm-packages.h"
 #include "realm-sssd-ad.h"
 #include "realm-sssd-ipa.h"
@@ -103,8 +105,27 @@ on_kerberos_discover (GObject *source,
 	disco = realm_disco_domain_finish (result, &error);
 	if (error)
 		g_task_return_error (task, error);
+	else if (disco)
+		g_task_return_pointer (task, g_list_append (NULL, disco), realm_disco_forest_free);
 	else
-		g_task_return_pointer (task, disco, realm_disco_unref);
+		g_task_return_pointer (task, NULL, NULL);
+	g_object_unref (task);
+}
+
+static void
+on_forest_discover (GObject *source,
+                    GAsyncResult *result,
+                    gpointer user_data)
+{
+	GTask *task = G_TASK (user_data);
+	GError *error = NULL;
+	GList *discos;
+
+	discos = realm_disco_forest_finish (result, &error);
+	if (error)
+		g_task_return_error (task, error);
+	else
+		g_task_return_pointer (task, discos, realm_disco_forest_free);
 	g_object_unref (task);
 }
 
@@ -139,6 +160,10 @@ realm_sssd_provider_discover_async (RealmProvider *provider,
 	                                    REALM_DBUS_IDENTIFIER_IPA)) {
 		g_task_return_pointer (task, NULL, NULL);
 
+	} else if (realm_options_forest (options)) {
+		realm_disco_forest_async (string, invocation, on_forest_discover,
+		                          g_object_ref (task));
+
 	} else {
 		realm_disco_domain_async (string, invocation, on_kerberos_discover,
 		                          g_object_ref (task));
@@ -147,22 +172,13 @@ realm_sssd_provider_discover_async (RealmProvider *provider,
 	g_object_unref (task);
 }
 
-static GList *
-realm_sssd_provider_discover_finish (RealmProvider *provider,
-                                     GAsyncResult *result,
-                                     gint *relevance,
-                                     GError **error)
+static RealmKerberos *
+register_discovered (RealmProvider *provider,
+                     GVariant *options,
+                     RealmDisco *disco,
+                     gint *priority)
 {
 	RealmKerberos *realm = NULL;
-	RealmDisco *disco;
-	GVariant *options;
-	gint priority;
-
-	disco = g_task_propagate_pointer (G_TASK (result), error);
-	if (disco == NULL)
-		return NULL;
-
-	options = g_task_get_task_data (G_TASK (result));
 
 	if (disco->server_software == NULL ||
 	    !realm_provider_match_software (options, disco->server_software,
@@ -173,23 +189,51 @@ realm_sssd_provider_discover_finish (RealmProvider *provider,
 		realm = realm_provider_lookup_or_register_realm (provider,
 		                                                 REALM_TYPE_SSSD_AD,
 		                                                 disco->domain_name, disco);
-		priority = realm_provider_is_default (REALM_DBUS_IDENTIFIER_ACTIVE_DIRECTORY, REALM_DBUS_IDENTIFIER_SSSD) ? 100 : 50;
+		*priority = realm_provider_is_default (REALM_DBUS_IDENTIFIER_ACTIVE_DIRECTORY, REALM_DBUS_IDENTIFIER_SSSD) ? 100 : 50;
 
 	} else if (g_str_equal (disco->server_software, REALM_DBUS_IDENTIFIER_IPA)) {
 		realm = realm_provider_lookup_or_register_realm (provider,
 		                                                 REALM_TYPE_SSSD_IPA,
 		                                                 disco->domain_name, disco);
-		priority = 100;
+		*priority = 100;
 	}
 
-	realm_disco_unref (disco);
+	return realm;
+}
 
-	if (realm == NULL)
+static GList *
+realm_sssd_provider_discover_finish (RealmProvider *provider,
+                                     GAsyncResult *result,
+                                     gint *relevance,
+                                     GError **error)
+{
+	RealmKerberos *realm;
+	GList *realms = NULL;
+	GVariant *options;
+	GList *discos;
+	gint priority = 0;
+	GList *l;
+
+	discos = g_task_propagate_pointer (G_TASK (result), error);
+	if (discos == NULL)
 		return NULL;
 
-	/* Return a higher priority if we're the default */
-	*relevance = priority;
-	return g_list_append (NULL, g_object_ref (realm));
+	options = g_task_get_task_data (G_TASK (result));
+
+	/* More than one when discovering a whole forest */
+	for (l = discos; l != NULL; l = g_list_next (l)) {
+		realm = register_discovered (provider, options, l->data, &priority);
+		if (realm == NULL)
+			continue;
+
+		/* Return a higher priority if we're the default */
+		if (realms == NULL)
+			*relevance = priority;
+		realms = g_list_prepend (realms, g_object_ref (realm));
+	}
+
+	realm_disco_forest_free (discos);
+	return g_list_reverse (realms);
 }
 
 static void
@@ -24,6 +24,7 @@
 #include "realm-service.h"
 #include "realm-sssd.h"
 #include "realm-sssd-config.h"
+#include "realm-trace.h"
 #include "safe-format-string.h"
 
 #include <glib/gstdio.h>
@@ -149,6 +150,7 @@ realm_sssd_logins_async (RealmKerberos *realm,
 	RealmSssdClass *sssd_class = REALM_SSSD_GET_CLASS (realm);
 	RealmSssd *self = REALM_SSSD (realm);
 	gboolean names_are_groups = FALSE;
+	RealmTraceSpan *span;
 	GTask *task;
 	gchar **remove_names = NULL;
 	gchar **add_names = NULL;
@@ -201,12 +203,14 @@ realm_sssd_logins_async (RealmKerberos *realm,
 		sssd_config_check_login_list (remove, &error);
 
 	if (error == NULL) {
+		span = realm_trace_begin (invocation, "config", "Configuring sssd.conf");
 		realm_sssd_set_login_policy (self->pv->config,
 		                             self->pv->section,
 		                             access_provider,
 		                             add, remove,
 		                             names_are_groups,
 		                             &error);
+		realm_trace_end (span, error);
 	}
 
 	if (error == NULL) {
@@ -678,6 +682,7 @@ on_sssd_clear_cache (GObject *source,
                      gpointer user_data)
 {
 	DeconfClosure *deconf = user_data;
+	RealmTraceSpan *span;
 	GError *error = NULL;
 	gchar **domains;
 	gint status;
@@ -692,7 +697,10 @@ on_sssd_clear_cache (GObject *source,
 	/* Deconfigure sssd.conf, may have already been done, if so NULL */
 	if (deconf->domain) {
 		realm_diagnostics_info (deconf->invocation, "Removing domain configuration from sssd.conf");
-		if (!realm_sssd_config_remove_domain (deconf->config, deconf->domain, &error)) {
+		span = realm_trace_begin (deconf->invocation, "config", "Configuring sssd.conf");
+		realm_sssd_config_remove_domain (deconf->config, deconf->domain, &error);
+		realm_trace_end (span, error);
+		if (error != NULL) {
 			g_task_return_error (deconf->task, error);
 			deconfigure_closure_free (deconf);
 			return;
@@ -0,0 +1,227 @@
+/* realmd -- Realm configuration service
+ *
+ * Copyright 2026 The realmd contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2 of the licence or (at
+ * your option) any later version.
+ *
+ * See the included COPYING file for more information.
+ */
+
+#include "config.h"
+
+#include "realm-steps.h"
+#include "realm-trace.h"
+
+/*
+ * Runs the steps of an operation, such as enabling and restarting a
+ * service, each as soon as the steps it depends on have completed.
+ * Steps that don't depend on each other run at the same time.
+ *
+ * A step can only depend on steps added before it, so there are no
+ * cycles. Once a step fails no more are started, and the operation
+ * fails with that error once the steps already running complete.
+ */
+
+typedef struct {
+	RealmSteps *steps;
+	gchar *name;
+	RealmStepAsync async;
+	RealmStepFinish finish;
+	gpointer data;
+	GDestroyNotify destroy;
+	guint waiting;
+	GArray *dependents;
+	gboolean started;
+	RealmTraceSpan *span;
+} Step;
+
+struct _RealmSteps {
+	GPtrArray *steps;
+	GDBusMethodInvocation *invocation;
+	GTask *task;
+	gint running;
+	gboolean completed;
+	GError *error;
+};
+
+static void
+step_free (gpointer data)
+{
+	Step *step = data;
+
+	g_assert (step->span == NULL);
+	if (step->destroy)
+		(step->destroy) (step->data);
+	g_array_free (step->dependents, TRUE);
+	g_free (step->name);
+	g_free (step);
+}
+
+static void
+realm_steps_free (gpointer data)
+{
+	RealmSteps *steps = data;
+
+	g_assert (steps->running == 0);
+	g_ptr_array_free (steps->steps, TRUE);
+	g_clear_object (&steps->invocation);
+	g_clear_error (&steps->error);
+	g_free (steps);
+}
+
+RealmSteps *
+realm_steps_new (GDBusMethodInvocation *invocation)
+{
+	RealmSteps *steps;
+
+	g_return_val_if_fail (invocation == NULL || G_IS_DBUS_METHOD_INVOCATION (invocation), NULL);
+
+	steps = g_new0 (RealmSteps, 1);
+	steps->steps = g_ptr_array_new_with_free_func (step_free);
+	steps->invocation = invocation ? g_object_ref (invocation) : NULL;
+	return steps;
+}
+
+guint
+realm_steps_add (RealmSteps *steps,
+                 const gchar *name,
+                 RealmStepAsync async,
+                 RealmStepFinish finish,
+                 gpointer data,
+                 GDestroyNotify destroy)
+{
+	Step *step;
+
+	g_return_val_if_fail (steps != NULL, 0);
+	g_return_val_if_fail (name != NULL, 0);
+	g_return_val_if_fail (async != NULL, 0);
+	g_return_val_if_fail (finish != NULL, 0);
+	g_return_val_if_fail (steps->task == NULL, 0);
+
+	step = g_new0 (Step, 1);
+	step->steps = steps;
+	step->name = g_strdup (name);
+	step->async = async;
+	step->finish = finish;
+	step->data = data;
+	step->destroy = destroy;
+	step->dependents = g_array_new (FALSE, FALSE, sizeof (guint));
+
+	g_ptr_array_add (steps->steps, step);
+	return steps->steps->len - 1;
+}
+
+void
+realm_steps_after (RealmSteps *steps,
+                   guint step,
+                   guint before)
+{
+	Step *first;
+	Step *then;
+
+	g_return_if_fail (steps != NULL);
+	g_return_if_fail (step < steps->steps->len);
+	g_return_if_fail (before < step);
+	g_return_if_fail (steps->task == NULL);
+
+	first = steps->steps->pdata[before];
+	then = steps->steps->pdata[step];
+
+	g_array_append_val (first->dependents, step);
+	then->waiting++;
+}
+
+static void  start_ready  (RealmSteps *steps);
+
+static void
+on_step_complete (GObject *source,
+                  GAsyncResult *result,
+                  gpointer user_data)
+{
+	Step *step = user_data;
+	RealmSteps *steps = step->steps;
+	GTask *task = steps->task;
+	GError *error = NULL;
+	Step *then;
+	guint i;
+
+	(step->finish) (result, &error);
+	realm_trace_end (step->span, error);
+	step->span = NULL;
+	steps->running--;
+
+	if (error != NULL) {
+		g_debug ("step failed: %s: %s", step->name, error->message);
+		if (steps->error == NULL)
+			steps->error = error;
+		else
+			g_error_free (error);
+
+	} else {
+		for (i = 0; i < step->dependents->len; i++) {
+			then = steps->steps->pdata[g_array_index (step->dependents, guint, i)];
+			then->waiting--;
+		}
+	}
+
+	start_ready (steps);
+	g_object_unref (task);
+}
+
+static void
+start_ready (RealmSteps *steps)
+{
+	Step *step;
+	guint i;
+
+	for (i = 0; steps->error == NULL && i < steps->steps->len; i++) {
+		step = steps->steps->pdata[i];
+		if (step->started || step->waiting > 0)
+			continue;
+
+		step->started = TRUE;
+		step->span = realm_trace_begin (steps->invocation, "step", "%s", step->name);
+		steps->running++;
+		g_object_ref (steps->task);
+		(step->async) (step->data, steps->invocation,
+		               on_step_complete, step);
+	}
+
+	/* Steps only wait on earlier ones, so all are done unless one failed */
+	if (steps->running == 0 && !steps->completed) {
+		steps->completed = TRUE;
+		if (steps->error) {
+			g_task_return_error (steps->task, steps->error);
+			steps->error = NULL;
+		} else {
+			g_task_return_boolean (steps->task, TRUE);
+		}
+	}
+}
+
+void
+realm_steps_run_async (RealmSteps *steps,
+                       GAsyncReadyCallback callback,
+                       gpointer user_data)
+{
+	g_return_if_fail (steps != NULL);
+	g_return_if_fail (steps->task == NULL);
+
+	steps->task = g_task_new (NULL, NULL, callback, user_data);
+	g_task_set_source_tag (steps->task, realm_steps_run_async);
+	g_task_set_task_data (steps->task, steps, realm_steps_free);
+
+	start_ready (steps);
+	g_object_unref (steps->task);
+}
+
+gboolean
+realm_steps_run_finish (GAsyncResult *result,
+                        GError **error)
+{
+	g_return_val_if_fail (g_task_is_valid (result, NULL), FALSE);
+	return g_task_propagate_boolean (G_TASK (result), error);
+}
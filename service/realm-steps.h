@@ -0,0 +1,54 @@
+/* realmd -- Realm configuration service
+ *
+ * Copyright 2026 The realmd contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2 of the licence or (at
+ * your option) any later version.
+ *
+ * See the included COPYING file for more information.
+ */
+
+#include "config.h"
+
+#ifndef __REALM_STEPS_H__
+#define __REALM_STEPS_H__
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+typedef struct _RealmSteps RealmSteps;
+
+typedef void       (* RealmStepAsync)       (gpointer data,
+                                             GDBusMethodInvocation *invocation,
+                                             GAsyncReadyCallback callback,
+                                             gpointer user_data);
+
+typedef gboolean   (* RealmStepFinish)      (GAsyncResult *result,
+                                             GError **error);
+
+RealmSteps *       realm_steps_new          (GDBusMethodInvocation *invocation);
+
+guint              realm_steps_add          (RealmSteps *steps,
+                                             const gchar *name,
+                                             RealmStepAsync async,
+                                             RealmStepFinish finish,
+                                             gpointer data,
+                                             GDestroyNotify destroy);
+
+void               realm_steps_after        (RealmSteps *steps,
+                                             guint step,
+                                             guint before);
+
+void               realm_steps_run_async    (RealmSteps *steps,
+                                             GAsyncReadyCallback callback,
+                                             gpointer user_data);
+
+gboolean           realm_steps_run_finish   (GAsyncResult *result,
+                                             GError **error);
+
+G_END_DECLS
+
+#endif /* __REALM_STEPS_H__ */
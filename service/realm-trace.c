@@ -0,0 +1,219 @@
+/* realmd -- Realm configuration service
+ *
+ * Copyright 2026 The realmd contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2 of the licence or (at
+ * your option) any later version.
+ *
+ * See the included COPYING file for more information.
+ */
+
+#include "config.h"
+
+#include "realm-invocation.h"
+#include "realm-settings.h"
+#include "realm-trace.h"
+
+#include <glib/gstdio.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#ifdef WITH_JOURNAL
+#include <systemd/sd-journal.h>
+#endif
+
+/*
+ * A span times one phase of an operation: a DNS lookup, an LDAP request,
+ * a spawned command and so on. When it ends it's logged with structured
+ * fields next to the REALMD_OPERATION diagnostics, and if the [service]
+ * trace-file setting is set, appended there as a Chrome trace event.
+ * Load that file in chrome://tracing or Perfetto to see where a join
+ * spent its time, with one row per operation.
+ */
+
+struct _RealmTraceSpan {
+	gchar *operation;
+	gchar *category;
+	gchar *name;
+	gint64 started;
+	gint64 wall;
+};
+
+static FILE *trace_file = NULL;
+static gboolean trace_failed = FALSE;
+static gboolean trace_first = TRUE;
+
+RealmTraceSpan *
+realm_trace_begin (GDBusMethodInvocation *invocation,
+                   const gchar *category,
+                   const gchar *format,
+                   ...)
+{
+	RealmTraceSpan *span;
+	const gchar *operation;
+	va_list va;
+
+	g_return_val_if_fail (category != NULL, NULL);
+	g_return_val_if_fail (format != NULL, NULL);
+
+	/* Background work isn't part of any operation */
+	if (invocation == NULL)
+		return NULL;
+
+	operation = realm_invocation_get_operation (invocation);
+
+	span = g_new0 (RealmTraceSpan, 1);
+	span->operation = g_strdup (operation ? operation : "");
+	span->category = g_strdup (category);
+
+	va_start (va, format);
+	span->name = g_strdup_vprintf (format, va);
+	va_end (va);
+
+	span->wall = g_get_real_time ();
+	span->started = g_get_monotonic_time ();
+	return span;
+}
+
+static void
+append_json_string (GString *out,
+                    const gchar *string)
+{
+	const gchar *at;
+
+	g_string_append_c (out, '"');
+	for (at = string; *at != '\0'; at++) {
+		if (*at == '"' || *at == '\\')
+			g_string_append_printf (out, "\\%c", *at);
+		else if ((guchar)*at < 0x20)
+			g_string_append_printf (out, "\\u%04x", (guint)(guchar)*at);
+		else
+			g_string_append_c (out, *at);
+	}
+	g_string_append_c (out, '"');
+}
+
+static FILE *
+open_trace_file (void)
+{
+	const gchar *path;
+
+	if (trace_file || trace_failed)
+		return trace_file;
+
+	path = realm_settings_value ("service", "trace-file");
+	if (path == NULL || path[0] == '\0') {
+		trace_failed = TRUE;
+		return NULL;
+	}
+
+	trace_file = g_fopen (path, "a");
+	if (trace_file == NULL) {
+		g_warning ("couldn't open trace file: %s: %s", path, g_strerror (errno));
+		trace_failed = TRUE;
+		return NULL;
+	}
+
+	/*
+	 * Each run of the daemon adds to the events already there. The
+	 * closing bracket is optional, so it's never written, and the file
+	 * is usable even if we crash.
+	 */
+	fseek (trace_file, 0, SEEK_END);
+	trace_first = (ftell (trace_file) == 0);
+	if (trace_first)
+		fputs ("[", trace_file);
+	return trace_file;
+}
+
+static void
+write_trace_event (RealmTraceSpan *span,
+                   gint64 duration,
+                   const gchar *result)
+{
+	GString *event;
+	FILE *file;
+
+	file = open_trace_file ();
+	if (file == NULL)
+		return;
+
+	/* A complete event, one row per operation */
+	event = g_string_new (trace_first ? "\n" : ",\n");
+	g_string_append (event, "{\"name\":");
+	append_json_string (event, span->name);
+	g_string_append (event, ",\"cat\":");
+	append_json_string (event, span->category);
+	g_string_append_printf (event, ",\"ph\":\"X\",\"ts\":%" G_GINT64_FORMAT
+	                        ",\"dur\":%" G_GINT64_FORMAT ",\"pid\":%d,\"tid\":%u",
+	                        span->wall, duration, (int)getpid (),
+	                        g_str_hash (span->operation) & 0xffff);
+	g_string_append (event, ",\"args\":{\"operation\":");
+	append_json_string (event, span->operation);
+	g_string_append (event, ",\"result\":");
+	append_json_string (event, result);
+	g_string_append (event, "}}");
+
+	fputs (event->str, file);
+	fflush (file);
+	trace_first = FALSE;
+
+	g_string_free (event, TRUE);
+}
+
+void
+realm_trace_end (RealmTraceSpan *span,
+                 const GError *error)
+{
+	const gchar *result;
+	gint64 duration;
+
+	if (span == NULL)
+		return;
+
+	duration = g_get_monotonic_time () - span->started;
+	result = error ? error->message : "ok";
+
+#ifdef WITH_JOURNAL
+	sd_journal_send ("MESSAGE=%s: %s took %" G_GINT64_FORMAT " ms",
+	                 span->category, span->name, duration / 1000,
+	                 "REALMD_OPERATION=%s", span->operation,
+	                 "REALMD_SPAN_CATEGORY=%s", span->category,
+	                 "REALMD_SPAN_NAME=%s", span->name,
+	                 "REALMD_SPAN_START_USEC=%" G_GINT64_FORMAT, span->wall,
+	                 "REALMD_SPAN_DURATION_USEC=%" G_GINT64_FORMAT, duration,
+	                 "REALMD_SPAN_RESULT=%s", result,
+	                 "PRIORITY=%i", LOG_DEBUG,
+	                 "SYSLOG_FACILITY=%i", LOG_FAC (LOG_AUTH),
+	                 "SYSLOG_IDENTIFIER=realmd",
+	                 NULL);
+#endif
+
+	g_debug ("%s: %s took %" G_GINT64_FORMAT " ms: %s",
+	         span->category, span->name, duration / 1000, result);
+
+	write_trace_event (span, duration, result);
+
+	g_free (span->operation);
+	g_free (span->category);
+	g_free (span->name);
+	g_free (span);
+}
+
+void
+realm_trace_uninit (void)
+{
+	if (trace_file) {
+		fputs ("\n", trace_file);
+		fclose (trace_file);
+	}
+
+	trace_file = NULL;
+	trace_failed = FALSE;
+	trace_first = TRUE;
+}
@@ -0,0 +1,36 @@
+/* realmd -- Realm configuration service
+ *
+ * Copyright 2026 The realmd contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2 of the licence or (at
+ * your option) any later version.
+ *
+ * See the included COPYING file for more information.
+ */
+
+#include "config.h"
+
+#ifndef __REALM_TRACE_H__
+#define __REALM_TRACE_H__
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+typedef struct _RealmTraceSpan RealmTraceSpan;
+
+RealmTraceSpan *   realm_trace_begin            (GDBusMethodInvocation *invocation,
+                                                 const gchar *category,
+                                                 const gchar *format,
+                                                 ...) G_GNUC_PRINTF (3, 4);
+
+void               realm_trace_end              (RealmTraceSpan *span,
+                                                 const GError *error);
+
+void               realm_trace_uninit           (void);
+
+G_END_DECLS
+
+#endif /* __REALM_TRACE_H__ */
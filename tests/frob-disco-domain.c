@@ -0,0 +1,1151 @@
+/* realmd -- Realm configuration service
+ *
+ * Copyright 2026 The realmd contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2 of the licence or (at
+ * your option) any later version.
+ *
+ * See the included COPYING file for more information.
+ */
+
+/*
+ * Benchmarks domain discovery without a network. Stand-in domain
+ * controllers answer LDAP over TCP and CLDAP over UDP on loopback
+ * addresses, and a fake resolver answers the DNS lookups for them.
+ * Each server can be given its own latency and packet loss.
+ */
+
+#include "config.h"
+
+#include "service/realm-diagnostics.h"
+#include "service/realm-disco-cache.h"
+#include "service/realm-disco-domain.h"
+#include "service/realm-disco-score.h"
+#include "service/realm-invocation.h"
+#include "service/realm-ldap.h"
+#include "service/realm-settings.h"
+#include "service/realm-trace.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define DOMAIN          "bench.test"
+#define NAMING_CONTEXT  "DC=bench,DC=test"
+#define NETBIOS_DOMAIN  "BENCH"
+#define SITE            "Default-First-Site-Name"
+
+/* Delay added by a lost TCP segment: the initial retransmit timeout */
+#define TCP_RETRANSMIT  1000
+
+/* Delay added by a lost DNS packet: the default resolv.conf timeout */
+#define DNS_RETRY       5000
+
+#define BER_SEQUENCE         0x30
+#define BER_SET              0x31
+#define BER_INTEGER          0x02
+#define BER_OCTET_STRING     0x04
+#define BER_ENUMERATED       0x0a
+#define LDAP_SEARCH_REQUEST  0x63
+#define LDAP_SEARCH_ENTRY    0x64
+#define LDAP_SEARCH_DONE     0x65
+
+typedef struct {
+	gchar *hostname;
+	GSocketAddress *address;
+	GSocketService *service;
+	GSocket *udp;
+	GSource *udp_source;
+	GByteArray *netlogon;
+	guint latency;
+	gdouble loss;
+	gboolean dead;
+} Server;
+
+typedef struct {
+	gint refs;
+	Server *server;
+	GSocketConnection *connection;
+	GByteArray *buffer;
+	guchar chunk[4096];
+	gint64 due;
+	gboolean closed;
+} Peer;
+
+typedef struct {
+	Peer *peer;
+	Server *server;
+	GSocketAddress *to;
+	GByteArray *data;
+} Reply;
+
+typedef struct {
+	GTask *task;
+	gpointer result;
+	GDestroyNotify destroy;
+	GError *error;
+	guint timeout_id;
+	GSource *cancel_source;
+} Answer;
+
+static GPtrArray *servers;
+static gint n_servers = 3;
+static gint n_dead = 0;
+static gchar *latency = NULL;
+static gchar *loss = NULL;
+static gboolean legacy = FALSE;
+static gint dns_latency = 1;
+static gdouble dns_loss = 0.0;
+static gint iterations = 100;
+static gboolean warm = FALSE;
+static gchar **settings = NULL;
+static gboolean verbose = FALSE;
+
+static GOptionEntry entries[] = {
+	{ "servers", 'n', 0, G_OPTION_ARG_INT, &n_servers,
+	  "Number of domain controllers", "N" },
+	{ "latency", 'l', 0, G_OPTION_ARG_STRING, &latency,
+	  "Server latency in milliseconds, one per server", "MS,..." },
+	{ "loss", 0, 0, G_OPTION_ARG_STRING, &loss,
+	  "Server packet loss between 0 and 1, one per server", "P,..." },
+	{ "dead", 0, 0, G_OPTION_ARG_INT, &n_dead,
+	  "Number of servers, listed first, that never answer", "N" },
+	{ "legacy", 0, 0, G_OPTION_ARG_NONE, &legacy,
+	  "Servers only answer NetLogon over CLDAP", NULL },
+	{ "dns-latency", 0, 0, G_OPTION_ARG_INT, &dns_latency,
+	  "DNS latency in milliseconds", "MS" },
+	{ "dns-loss", 0, 0, G_OPTION_ARG_DOUBLE, &dns_loss,
+	  "DNS packet loss between 0 and 1", "P" },
+	{ "iterations", 'i', 0, G_OPTION_ARG_INT, &iterations,
+	  "Number of discoveries to time", "N" },
+	{ "warm", 0, 0, G_OPTION_ARG_NONE, &warm,
+	  "Keep server scores and pooled connections between runs", NULL },
+	{ "set", 's', 0, G_OPTION_ARG_STRING_ARRAY, &settings,
+	  "Override a [discovery] setting", "KEY=VALUE" },
+	{ "verbose", 'v', 0, G_OPTION_ARG_NONE, &verbose,
+	  "Show discovery diagnostics", NULL },
+	{ NULL }
+};
+
+/*
+ * Minimal BER, just enough to answer the searches that discovery sends
+ */
+
+static gboolean
+ber_read (const guchar **at,
+          const guchar *end,
+          guchar tag,
+          const guchar **value,
+          gsize *length)
+{
+	const guchar *p = *at;
+	gsize len;
+	gint n;
+
+	if (end - p < 2 || p[0] != tag)
+		return FALSE;
+
+	len = p[1];
+	p += 2;
+
+	if (len & 0x80) {
+		n = len & 0x7f;
+		if (n == 0 || n > 4 || end - p < n)
+			return FALSE;
+		for (len = 0; n > 0; n--)
+			len = (len << 8) | *(p++);
+	}
+
+	if (len > (gsize)(end - p))
+		return FALSE;
+
+	*value = p;
+	*length = len;
+	*at = p + len;
+	return TRUE;
+}
+
+static gsize
+ber_frame (const guchar *data,
+           gsize length)
+{
+	gsize header = 2;
+	gsize len;
+	gint n;
+
+	/* Returns the size of the first complete element, or zero */
+	if (length < 2)
+		return 0;
+
+	len = data[1];
+	if (len & 0x80) {
+		n = len & 0x7f;
+		if (length < 2 + (gsize)n)
+			return 0;
+		for (len = 0; n > 0; n--)
+			len = (len << 8) | data[header++];
+	}
+
+	return header + len <= length ? header + len : 0;
+}
+
+static void
+ber_append (GByteArray *out,
+            guchar tag,
+            gconstpointer data,
+            gsize length)
+{
+	guchar header[4];
+	guint n = 0;
+
+	header[n++] = tag;
+	if (length < 0x80) {
+		header[n++] = length;
+	} else if (length <= 0xff) {
+		header[n++] = 0x81;
+		header[n++] = length;
+	} else {
+		g_assert (length <= 0xffff);
+		header[n++] = 0x82;
+		header[n++] = (length >> 8) & 0xff;
+		header[n++] = length & 0xff;
+	}
+
+	g_byte_array_append (out, header, n);
+	g_byte_array_append (out, data, length);
+}
+
+static void
+ber_wrap (GByteArray *out,
+          guchar tag,
+          GByteArray *inner)
+{
+	ber_append (out, tag, inner->data, inner->len);
+	g_byte_array_free (inner, TRUE);
+}
+
+static void
+ber_string (GByteArray *out,
+            const gchar *string)
+{
+	ber_append (out, BER_OCTET_STRING, string, strlen (string));
+}
+
+static void
+add_attribute (GByteArray *attrs,
+               const gchar *type,
+               GByteArray *values)
+{
+	GByteArray *attr;
+
+	attr = g_byte_array_new ();
+	ber_string (attr, type);
+	ber_wrap (attr, BER_SET, values);
+	ber_wrap (attrs, BER_SEQUENCE, attr);
+}
+
+static void
+add_message (GByteArray *out,
+             const guchar *msgid,
+             gsize n_msgid,
+             guchar tag,
+             GByteArray *op)
+{
+	GByteArray *message;
+
+	message = g_byte_array_new ();
+	ber_append (message, BER_INTEGER, msgid, n_msgid);
+	ber_wrap (message, tag, op);
+	ber_wrap (out, BER_SEQUENCE, message);
+}
+
+static void
+add_entry (GByteArray *out,
+           const guchar *msgid,
+           gsize n_msgid,
+           GByteArray *attrs)
+{
+	GByteArray *op;
+
+	op = g_byte_array_new ();
+	ber_string (op, "");
+	ber_wrap (op, BER_SEQUENCE, attrs);
+	add_message (out, msgid, n_msgid, LDAP_SEARCH_ENTRY, op);
+}
+
+static void
+add_done (GByteArray *out,
+          const guchar *msgid,
+          gsize n_msgid)
+{
+	GByteArray *op;
+
+	op = g_byte_array_new ();
+	ber_append (op, BER_ENUMERATED, "\0", 1);
+	ber_string (op, "");
+	ber_string (op, "");
+	add_message (out, msgid, n_msgid, LDAP_SEARCH_DONE, op);
+}
+
+static void
+add_netlogon_entry (GByteArray *out,
+                    Server *server,
+                    const guchar *msgid,
+                    gsize n_msgid)
+{
+	GByteArray *attrs;
+	GByteArray *values;
+
+	attrs = g_byte_array_new ();
+	values = g_byte_array_new ();
+	ber_append (values, BER_OCTET_STRING, server->netlogon->data, server->netlogon->len);
+	add_attribute (attrs, "NetLogon", values);
+	add_entry (out, msgid, n_msgid, attrs);
+}
+
+static void
+add_root_dse_entry (GByteArray *out,
+                    const guchar *msgid,
+                    gsize n_msgid)
+{
+	GByteArray *attrs;
+	GByteArray *values;
+
+	attrs = g_byte_array_new ();
+
+	values = g_byte_array_new ();
+	ber_string (values, NAMING_CONTEXT);
+	add_attribute (attrs, "defaultNamingContext", values);
+
+	/* Active Directory, and Windows 2003+ unless we're pretending otherwise */
+	values = g_byte_array_new ();
+	ber_string (values, "1.2.840.113556.1.4.800");
+	if (!legacy)
+		ber_string (values, "1.2.840.113556.1.4.1670");
+	add_attribute (attrs, "supportedCapabilities", values);
+
+	add_entry (out, msgid, n_msgid, attrs);
+}
+
+static gboolean
+parse_request (const guchar *data,
+               gsize length,
+               const guchar **msgid,
+               gsize *n_msgid,
+               guchar *op)
+{
+	const guchar *at = data;
+	const guchar *end = data + length;
+	const guchar *message;
+	gsize n_message;
+
+	if (!ber_read (&at, end, BER_SEQUENCE, &message, &n_message))
+		return FALSE;
+
+	at = message;
+	end = message + n_message;
+	if (!ber_read (&at, end, BER_INTEGER, msgid, n_msgid) || at >= end)
+		return FALSE;
+
+	*op = at[0];
+	return TRUE;
+}
+
+static gboolean
+contains (const guchar *data,
+          gsize length,
+          const gchar *needle)
+{
+	gsize n_needle = strlen (needle);
+	gsize i;
+
+	for (i = 0; i + n_needle <= length; i++) {
+		if (memcmp (data + i, needle, n_needle) == 0)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+static void
+append_name (GByteArray *data,
+             const gchar *name)
+{
+	gchar **labels;
+	guint8 len;
+	gint i;
+
+	/* Uncompressed, which the decoder has to handle as well */
+	labels = g_strsplit (name, ".", -1);
+	for (i = 0; labels[i] != NULL; i++) {
+		len = strlen (labels[i]);
+		if (len == 0)
+			continue;
+		g_byte_array_append (data, &len, 1);
+		g_byte_array_append (data, (guchar *)labels[i], len);
+	}
+	g_strfreev (labels);
+
+	g_byte_array_append (data, (guchar *)"", 1);
+}
+
+static GByteArray *
+build_netlogon (const gchar *hostname,
+                guint index)
+{
+	static const guchar header[] = {
+		0x17, 0x00, 0x00, 0x00,                          /* opcode, sbz */
+		0xfd, 0x01, 0x00, 0x00,                          /* flags */
+		0x4d, 0x6f, 0x2a, 0x11, 0x9c, 0x3e, 0x45, 0x47,  /* domain guid */
+		0xa1, 0x52, 0x0c, 0x7a, 0x61, 0x90, 0x2f, 0x05,
+	};
+	static const guchar trailer[] = {
+		0x05, 0x00, 0x00, 0x00,                          /* nt version */
+		0xff, 0xff, 0xff, 0xff,                          /* lm tokens */
+	};
+	GByteArray *data;
+	gchar *netbios;
+
+	data = g_byte_array_new ();
+	g_byte_array_append (data, header, sizeof (header));
+	append_name (data, DOMAIN);
+	append_name (data, DOMAIN);
+	append_name (data, hostname);
+	append_name (data, NETBIOS_DOMAIN);
+	netbios = g_strdup_printf ("DC%u", index);
+	append_name (data, netbios);
+	g_free (netbios);
+	append_name (data, "");
+	append_name (data, SITE);
+	append_name (data, SITE);
+	g_byte_array_append (data, trailer, sizeof (trailer));
+
+	return data;
+}
+
+/*
+ * The stand-in domain controllers
+ */
+
+static gboolean
+is_lost (gdouble loss)
+{
+	return loss > 0.0 && g_random_double () < loss;
+}
+
+static Peer *
+peer_ref (Peer *peer)
+{
+	peer->refs++;
+	return peer;
+}
+
+static void
+peer_close (Peer *peer)
+{
+	if (!peer->closed)
+		g_io_stream_close (G_IO_STREAM (peer->connection), NULL, NULL);
+	peer->closed = TRUE;
+}
+
+static void
+peer_unref (gpointer data)
+{
+	Peer *peer = data;
+
+	if (--peer->refs > 0)
+		return;
+
+	peer_close (peer);
+	g_object_unref (peer->connection);
+	g_byte_array_free (peer->buffer, TRUE);
+	g_free (peer);
+}
+
+static void
+reply_free (gpointer data)
+{
+	Reply *reply = data;
+
+	if (reply->peer)
+		peer_unref (reply->peer);
+	if (reply->to)
+		g_object_unref (reply->to);
+	g_byte_array_free (reply->data, TRUE);
+	g_free (reply);
+}
+
+static gboolean
+on_reply_tcp (gpointer user_data)
+{
+	Reply *reply = user_data;
+	GOutputStream *output;
+
+	/* The client may well have hung up, that's fine */
+	if (!reply->peer->closed) {
+		output = g_io_stream_get_output_stream (G_IO_STREAM (reply->peer->connection));
+		g_output_stream_write_all (output, reply->data->data, reply->data->len,
+		                           NULL, NULL, NULL);
+	}
+
+	return FALSE;
+}
+
+static void
+handle_tcp_request (Peer *peer,
+                    const guchar *data,
+                    gsize length)
+{
+	Server *server = peer->server;
+	const guchar *msgid;
+	gsize n_msgid;
+	Reply *reply;
+	gint64 now;
+	guchar op;
+
+	if (!parse_request (data, length, &msgid, &n_msgid, &op)) {
+		peer_close (peer);
+		return;
+	}
+
+	/* Unbind, abandon, and anything else we don't care about */
+	if (server->dead || op != LDAP_SEARCH_REQUEST)
+		return;
+
+	reply = g_new0 (Reply, 1);
+	reply->peer = peer_ref (peer);
+	reply->data = g_byte_array_new ();
+
+	if (contains (data, length, "NetLogon"))
+		add_netlogon_entry (reply->data, server, msgid, n_msgid);
+	else
+		add_root_dse_entry (reply->data, msgid, n_msgid);
+	add_done (reply->data, msgid, n_msgid);
+
+	/* A lost segment holds up everything behind it on the stream */
+	now = g_get_monotonic_time () / 1000;
+	peer->due = MAX (peer->due, now + server->latency);
+	if (is_lost (server->loss))
+		peer->due += TCP_RETRANSMIT;
+
+	g_timeout_add_full (G_PRIORITY_DEFAULT, peer->due - now,
+	                    on_reply_tcp, reply, reply_free);
+}
+
+static void
+read_next (Peer *peer);
+
+static void
+on_peer_read (GObject *source,
+              GAsyncResult *result,
+              gpointer user_data)
+{
+	Peer *peer = user_data;
+	gssize count;
+	gsize length;
+
+	count = g_input_stream_read_finish (G_INPUT_STREAM (source), result, NULL);
+	if (count <= 0 || peer->closed) {
+		peer_unref (peer);
+		return;
+	}
+
+	g_byte_array_append (peer->buffer, peer->chunk, count);
+
+	while (!peer->closed && peer->buffer->len > 0) {
+		if (peer->buffer->data[0] != BER_SEQUENCE) {
+			peer_close (peer);
+			break;
+		}
+		length = ber_frame (peer->buffer->data, peer->buffer->len);
+		if (length == 0)
+			break;
+		handle_tcp_request (peer, peer->buffer->data, length);
+		g_byte_array_remove_range (peer->buffer, 0, length);
+	}
+
+	if (peer->closed)
+		peer_unref (peer);
+	else
+		read_next (peer);
+}
+
+static void
+read_next (Peer *peer)
+{
+	GInputStream *input;
+
+	input = g_io_stream_get_input_stream (G_IO_STREAM (peer->connection));
+	g_input_stream_read_async (input, peer->chunk, sizeof (peer->chunk),
+	                           G_PRIORITY_DEFAULT, NULL, on_peer_read, peer);
+}
+
+static gboolean
+on_incoming (GSocketService *service,
+             GSocketConnection *connection,
+             GObject *source_object,
+             gpointer user_data)
+{
+	Peer *peer;
+
+	peer = g_new0 (Peer, 1);
+	peer->refs = 1;
+	peer->server = user_data;
+	peer->connection = g_object_ref (connection);
+	peer->buffer = g_byte_array_new ();
+
+	read_next (peer);
+	return TRUE;
+}
+
+static gboolean
+on_reply_udp (gpointer user_data)
+{
+	Reply *reply = user_data;
+
+	g_socket_send_to (reply->server->udp, reply->to, (gchar *)reply->data->data,
+	                  reply->data->len, NULL, NULL);
+	return FALSE;
+}
+
+static gboolean
+on_udp_readable (GSocket *socket,
+                 GIOCondition cond,
+                 gpointer user_data)
+{
+	Server *server = user_data;
+	GSocketAddress *from = NULL;
+	const guchar *msgid;
+	guchar buffer[4096];
+	gsize n_msgid;
+	Reply *reply;
+	gssize count;
+	guchar op;
+
+	count = g_socket_receive_from (socket, &from, (gchar *)buffer, sizeof (buffer), NULL, NULL);
+	if (count <= 0) {
+		g_clear_object (&from);
+		return TRUE;
+	}
+
+	/* A lost request or response looks the same to the client */
+	if (server->dead || is_lost (server->loss) ||
+	    !parse_request (buffer, count, &msgid, &n_msgid, &op) ||
+	    op != LDAP_SEARCH_REQUEST) {
+		g_object_unref (from);
+		return TRUE;
+	}
+
+	reply = g_new0 (Reply, 1);
+	reply->server = server;
+	reply->to = from;
+	reply->data = g_byte_array_new ();
+	add_netlogon_entry (reply->data, server, msgid, n_msgid);
+	add_done (reply->data, msgid, n_msgid);
+
+	g_timeout_add_full (G_PRIORITY_DEFAULT, server->latency,
+	                    on_reply_udp, reply, reply_free);
+	return TRUE;
+}
+
+static Server *
+server_new (guint index)
+{
+	GSocketAddress *effective = NULL;
+	GInetAddress *inet;
+	GSocketAddress *address;
+	GError *error = NULL;
+	Server *server;
+	gchar *string;
+
+	server = g_new0 (Server, 1);
+	server->hostname = g_strdup_printf ("dc%u.%s", index, DOMAIN);
+	server->netlogon = build_netlogon (server->hostname, index);
+
+	/* Each server on its own address, since that's how they're scored */
+	string = g_strdup_printf ("127.0.0.%u", 10 + index);
+	inet = g_inet_address_new_from_string (string);
+	address = g_inet_socket_address_new (inet, 0);
+	g_object_unref (inet);
+	g_free (string);
+
+	server->service = g_socket_service_new ();
+	if (!g_socket_listener_add_address (G_SOCKET_LISTENER (server->service), address,
+	                                    G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_TCP,
+	                                    NULL, &effective, &error))
+		g_error ("couldn't listen on stand-in LDAP server: %s", error->message);
+	g_signal_connect (server->service, "incoming", G_CALLBACK (on_incoming), server);
+	g_socket_service_start (server->service);
+	g_object_unref (address);
+
+	/* CLDAP goes to the same port as LDAP */
+	server->address = effective;
+	server->udp = g_socket_new (G_SOCKET_FAMILY_IPV4, G_SOCKET_TYPE_DATAGRAM,
+	                            G_SOCKET_PROTOCOL_UDP, &error);
+	if (server->udp == NULL || !g_socket_bind (server->udp, server->address, TRUE, &error))
+		g_error ("couldn't bind stand-in CLDAP server: %s", error->message);
+
+	server->udp_source = g_socket_create_source (server->udp, G_IO_IN, NULL);
+	g_source_set_callback (server->udp_source, (GSourceFunc)on_udp_readable, server, NULL);
+	g_source_attach (server->udp_source, NULL);
+
+	return server;
+}
+
+static void
+server_free (gpointer data)
+{
+	Server *server = data;
+
+	g_socket_service_stop (server->service);
+	g_socket_listener_close (G_SOCKET_LISTENER (server->service));
+	g_object_unref (server->service);
+	g_source_destroy (server->udp_source);
+	g_source_unref (server->udp_source);
+	g_object_unref (server->udp);
+	g_object_unref (server->address);
+	g_byte_array_free (server->netlogon, TRUE);
+	g_free (server->hostname);
+	g_free (server);
+}
+
+/*
+ * A resolver that knows only about the stand-in servers
+ */
+
+#define FROB_TYPE_RESOLVER  (frob_resolver_get_type ())
+
+typedef struct {
+	GResolver parent;
+} FrobResolver;
+
+typedef struct {
+	GResolverClass parent_class;
+} FrobResolverClass;
+
+GType frob_resolver_get_type (void) G_GNUC_CONST;
+
+G_DEFINE_TYPE (FrobResolver, frob_resolver, G_TYPE_RESOLVER);
+
+static void
+answer_complete (Answer *answer)
+{
+	if (answer->timeout_id)
+		g_source_remove (answer->timeout_id);
+	if (answer->cancel_source) {
+		g_source_destroy (answer->cancel_source);
+		g_source_unref (answer->cancel_source);
+	}
+
+	if (g_task_return_error_if_cancelled (answer->task)) {
+		if (answer->destroy && answer->result)
+			(answer->destroy) (answer->result);
+		g_clear_error (&answer->error);
+	} else if (answer->error) {
+		g_task_return_error (answer->task, answer->error);
+	} else {
+		g_task_return_pointer (answer->task, answer->result, answer->destroy);
+	}
+
+	g_object_unref (answer->task);
+	g_free (answer);
+}
+
+static gboolean
+on_answer_timeout (gpointer user_data)
+{
+	Answer *answer = user_data;
+	answer->timeout_id = 0;
+	answer_complete (answer);
+	return FALSE;
+}
+
+static gboolean
+on_answer_cancelled (GCancellable *cancellable,
+                     gpointer user_data)
+{
+	answer_complete (user_data);
+	return FALSE;
+}
+
+static void
+answer_later (GTask *task,
+              gpointer result,
+              GDestroyNotify destroy,
+              GError *error)
+{
+	GCancellable *cancellable;
+	Answer *answer;
+	guint delay;
+
+	delay = dns_latency;
+	if (is_lost (dns_loss))
+		delay += DNS_RETRY;
+
+	answer = g_new0 (Answer, 1);
+	answer->task = task;
+	answer->result = result;
+	answer->destroy = destroy;
+	answer->error = error;
+	answer->timeout_id = g_timeout_add (delay, on_answer_timeout, answer);
+
+	cancellable = g_task_get_cancellable (task);
+	if (cancellable) {
+		answer->cancel_source = g_cancellable_source_new (cancellable);
+		g_source_set_callback (answer->cancel_source, (GSourceFunc)on_answer_cancelled,
+		                       answer, NULL);
+		g_source_attach (answer->cancel_source, NULL);
+	}
+}
+
+static void
+frob_resolver_lookup_by_name_async (GResolver *resolver,
+                                    const gchar *hostname,
+                                    GCancellable *cancellable,
+                                    GAsyncReadyCallback callback,
+                                    gpointer user_data)
+{
+	GList *addresses = NULL;
+	GInetSocketAddress *inet;
+	Server *server;
+	GTask *task;
+	guint i;
+
+	task = g_task_new (resolver, cancellable, callback, user_data);
+
+	for (i = 0; i < servers->len; i++) {
+		server = servers->pdata[i];
+		if (g_ascii_strcasecmp (hostname, server->hostname) == 0) {
+			inet = G_INET_SOCKET_ADDRESS (server->address);
+			addresses = g_list_append (addresses,
+			                           g_object_ref (g_inet_socket_address_get_address (inet)));
+		}
+	}
+
+	if (addresses) {
+		answer_later (task, addresses, (GDestroyNotify)g_resolver_free_addresses, NULL);
+	} else {
+		answer_later (task, NULL, NULL,
+		              g_error_new (G_RESOLVER_ERROR, G_RESOLVER_ERROR_NOT_FOUND,
+		                           "No such host: %s", hostname));
+	}
+}
+
+static void
+frob_resolver_lookup_service_async (GResolver *resolver,
+                                    const gchar *rrname,
+                                    GCancellable *cancellable,
+                                    GAsyncReadyCallback callback,
+                                    gpointer user_data)
+{
+	GList *targets = NULL;
+	Server *server;
+	GTask *task;
+	guint i;
+
+	task = g_task_new (resolver, cancellable, callback, user_data);
+
+	/* Every server is in every site */
+	if (g_str_has_prefix (rrname, "_ldap._tcp.") && g_str_has_suffix (rrname, DOMAIN)) {
+		for (i = 0; i < servers->len; i++) {
+			server = servers->pdata[i];
+			targets = g_list_append (targets, g_srv_target_new (server->hostname,
+			                         g_inet_socket_address_get_port (G_INET_SOCKET_ADDRESS (server->address)),
+			                         0, 100));
+		}
+	}
+
+	if (targets) {
+		answer_later (task, targets, (GDestroyNotify)g_resolver_free_targets, NULL);
+	} else {
+		answer_later (task, NULL, NULL,
+		              g_error_new (G_RESOLVER_ERROR, G_RESOLVER_ERROR_NOT_FOUND,
+		                           "No such service: %s", rrname));
+	}
+}
+
+static void
+frob_resolver_lookup_records_async (GResolver *resolver,
+                                    const gchar *rrname,
+                                    GResolverRecordType record_type,
+                                    GCancellable *cancellable,
+                                    GAsyncReadyCallback callback,
+                                    gpointer user_data)
+{
+	GTask *task;
+
+	task = g_task_new (resolver, cancellable, callback, user_data);
+	answer_later (task, NULL, NULL,
+	              g_error_new (G_RESOLVER_ERROR, G_RESOLVER_ERROR_NOT_FOUND,
+	                           "No such record: %s", rrname));
+}
+
+static GList *
+frob_resolver_lookup_finish (GResolver *resolver,
+                             GAsyncResult *result,
+                             GError **error)
+{
+	return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+static void
+frob_resolver_init (FrobResolver *self)
+{
+
+}
+
+static void
+frob_resolver_class_init (FrobResolverClass *klass)
+{
+	GResolverClass *resolver_class = G_RESOLVER_CLASS (klass);
+
+	resolver_class->lookup_by_name_async = frob_resolver_lookup_by_name_async;
+	resolver_class->lookup_by_name_finish = frob_resolver_lookup_finish;
+	resolver_class->lookup_service_async = frob_resolver_lookup_service_async;
+	resolver_class->lookup_service_finish = frob_resolver_lookup_finish;
+	resolver_class->lookup_records_async = frob_resolver_lookup_records_async;
+	resolver_class->lookup_records_finish = frob_resolver_lookup_finish;
+}
+
+/*
+ * The benchmark itself
+ */
+
+static gdouble
+value_for_server (const gchar *list,
+                  guint index)
+{
+	gchar **values;
+	gdouble value;
+	guint len;
+
+	/* A comma separated list, the last value repeats */
+	values = g_strsplit (list, ",", -1);
+	len = g_strv_length (values);
+	value = len == 0 ? 0.0 : g_ascii_strtod (values[MIN (index, len - 1)], NULL);
+	g_strfreev (values);
+
+	return value;
+}
+
+static void
+on_ready_get_result (GObject *source,
+                     GAsyncResult *result,
+                     gpointer user_data)
+{
+	GAsyncResult **place = (GAsyncResult **)user_data;
+	*place = g_object_ref (result);
+}
+
+static gint64
+discover_once (gboolean *success)
+{
+	GAsyncResult *result = NULL;
+	GError *error = NULL;
+	RealmDisco *disco;
+	gint64 started;
+	gint64 elapsed;
+
+	started = g_get_monotonic_time ();
+	realm_disco_domain_async (DOMAIN, NULL, on_ready_get_result, &result);
+	while (result == NULL)
+		g_main_context_iteration (NULL, TRUE);
+	elapsed = g_get_monotonic_time () - started;
+
+	disco = realm_disco_domain_finish (result, &error);
+	g_object_unref (result);
+
+	if (error != NULL) {
+		g_printerr ("discovery failed: %s\n", error->message);
+		g_error_free (error);
+	} else if (disco == NULL) {
+		g_printerr ("discovery found nothing\n");
+	} else if (verbose) {
+		g_printerr ("discovered %s on %s\n", disco->domain_name, disco->server_name);
+	}
+
+	*success = (disco != NULL);
+	if (disco)
+		realm_disco_unref (disco);
+	return elapsed;
+}
+
+static int
+compare_times (gconstpointer a,
+               gconstpointer b)
+{
+	gint64 ta = *(gint64 *)a;
+	gint64 tb = *(gint64 *)b;
+	return ta < tb ? -1 : (ta > tb ? 1 : 0);
+}
+
+static void
+print_percentile (const gchar *label,
+                  GArray *times,
+                  guint percent)
+{
+	gint64 value;
+
+	value = g_array_index (times, gint64, (times->len - 1) * percent / 100);
+	g_print ("%-4s %10.1f ms\n", label, value / 1000.0);
+}
+
+int
+main (int argc,
+      char *argv[])
+{
+	GOptionContext *context;
+	GResolver *resolver;
+	GError *error = NULL;
+	GArray *times;
+	gboolean success;
+	guint failures = 0;
+	Server *server;
+	gint64 elapsed;
+	gchar **parts;
+	gint i;
+
+#if !GLIB_CHECK_VERSION(2, 36, 0)
+	g_type_init ();
+#endif
+
+	context = g_option_context_new ("- benchmark domain discovery");
+	g_option_context_add_main_entries (context, entries, NULL);
+	if (!g_option_context_parse (context, &argc, &argv, &error)) {
+		g_printerr ("%s\n", error->message);
+		g_error_free (error);
+		return 2;
+	}
+	g_option_context_free (context);
+
+	if (n_servers < 1 || n_servers > 200 || iterations < 1) {
+		g_printerr ("invalid number of servers or iterations\n");
+		return 2;
+	}
+
+	realm_settings_init ();
+
+	/* SRV queries have to go through our stand-in GResolver */
+	realm_settings_add ("discovery", "direct-srv", "no");
+
+	for (i = 0; settings && settings[i]; i++) {
+		parts = g_strsplit (settings[i], "=", 2);
+		if (parts[0] && parts[1])
+			realm_settings_add ("discovery", g_strstrip (parts[0]), g_strstrip (parts[1]));
+		g_strfreev (parts);
+	}
+
+	servers = g_ptr_array_new_with_free_func (server_free);
+	for (i = 0; i < n_servers; i++) {
+		server = server_new (i);
+		server->latency = latency ? value_for_server (latency, i) : 5;
+		server->loss = loss ? value_for_server (loss, i) : 0.0;
+		server->dead = (i < n_dead);
+		g_ptr_array_add (servers, server);
+	}
+
+	resolver = g_object_new (FROB_TYPE_RESOLVER, NULL);
+	g_resolver_set_default (resolver);
+	g_object_unref (resolver);
+
+	times = g_array_new (FALSE, FALSE, sizeof (gint64));
+	for (i = 0; i < iterations; i++) {
+		realm_disco_cache_flush ();
+		if (!warm) {
+			realm_disco_score_uninit ();
+			realm_ldap_pool_flush ();
+		}
+
+		elapsed = discover_once (&success);
+		if (success)
+			g_array_append_val (times, elapsed);
+		else
+			failures++;
+
+		/* Let cancelled probes wind down before the next run */
+		while (g_main_context_iteration (NULL, FALSE));
+	}
+
+	g_print ("%u discoveries, %u failed\n", times->len, failures);
+	if (times->len > 0) {
+		g_array_sort (times, compare_times);
+		print_percentile ("p50", times, 50);
+		print_percentile ("p90", times, 90);
+		print_percentile ("p99", times, 99);
+		print_percentile ("max", times, 100);
+	}
+
+	g_array_free (times, TRUE);
+	realm_ldap_pool_flush ();
+	realm_disco_cache_uninit ();
+	realm_disco_score_uninit ();
+	g_ptr_array_free (servers, TRUE);
+	realm_settings_uninit ();
+	g_strfreev (settings);
+	g_free (latency);
+	g_free (loss);
+
+	return failures > 0 ? 1 : 0;
+}
+
+/* Dummy functions */
+
+GCancellable *
+realm_invocation_get_cancellable (GDBusMethodInvocation *invocation)
+{
+	return NULL;
+}
+
+RealmTraceSpan *
+realm_trace_begin (GDBusMethodInvocation *invocation,
+                   const gchar *category,
+                   const gchar *format,
+                   ...)
+{
+	return NULL;
+}
+
+void
+realm_trace_end (RealmTraceSpan *span,
+                 const GError *error)
+{
+
+}
+
+void
+realm_diagnostics_info (GDBusMethodInvocation *invocation,
+                        const gchar *format,
+                        ...)
+{
+	va_list va;
+
+	if (!verbose)
+		return;
+
+	va_start (va, format);
+	vfprintf (stderr, format, va);
+	fputc ('\n', stderr);
+	va_end (va);
+}
+
+void
+realm_diagnostics_error (GDBusMethodInvocation *invocation,
+                         GError *error,
+                         const gchar *format,
+                         ...)
+{
+	va_list va;
+
+	if (!verbose)
+		return;
+
+	if (format) {
+		va_start (va, format);
+		vfprintf (stderr, format, va);
+		fputs (": ", stderr);
+		va_end (va);
+	}
+
+	fprintf (stderr, "%s\n", error ? error->message : "");
+}
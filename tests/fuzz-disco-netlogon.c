@@ -0,0 +1,79 @@
+/* realmd -- Realm configuration service
+ *
+ * Copyright 2026 The realmd contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2 of the licence or (at
+ * your option) any later version.
+ *
+ * See the included COPYING file for more information.
+ */
+
+#include "config.h"
+
+#include "service/realm-disco-netlogon.h"
+
+#include <glib.h>
+
+#include <string.h>
+
+/*
+ * Fuzz target for the NetLogon decoder. Build with a fuzzing engine:
+ *
+ *   make fuzz-disco-netlogon CC=clang \
+ *       CFLAGS="-g -fsanitize=fuzzer,address -DFUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION"
+ *
+ * Without an engine it runs the files given on the command line through
+ * the decoder, which is useful for reproducing a crash.
+ */
+
+int LLVMFuzzerTestOneInput (const guint8 *data, size_t size);
+
+int
+LLVMFuzzerTestOneInput (const guint8 *data,
+                        size_t size)
+{
+	gchar buffer[REALM_NETLOGON_MAX_NAME];
+	RealmNetlogon netlogon;
+	gssize len;
+	gint i;
+
+	if (!realm_disco_netlogon_decode (data, size, &netlogon))
+		return 0;
+
+	for (i = 0; i < REALM_NETLOGON_N_NAMES; i++) {
+		len = realm_disco_netlogon_name (&netlogon, i, buffer, sizeof (buffer));
+		if (len >= 0)
+			g_assert_cmpint (len, ==, strlen (buffer));
+	}
+
+	return 0;
+}
+
+#ifndef FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION
+
+int
+main (int argc,
+      char **argv)
+{
+	GError *error = NULL;
+	gchar *contents;
+	gsize length;
+	gint i;
+
+	for (i = 1; i < argc; i++) {
+		if (!g_file_get_contents (argv[i], &contents, &length, &error)) {
+			g_printerr ("fuzz-disco-netlogon: %s\n", error->message);
+			g_clear_error (&error);
+			return 1;
+		}
+
+		LLVMFuzzerTestOneInput ((guint8 *)contents, length);
+		g_free (contents);
+	}
+
+	return 0;
+}
+
+#endif /* FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION */
@@ -0,0 +1,185 @@
+/* realmd -- Realm configuration service
+ *
+ * Copyright 2026 The realmd contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2 of the licence or (at
+ * your option) any later version.
+ *
+ * See the included COPYING file for more information.
+ */
+
+#include "config.h"
+
+#include "service/realm-disco-cache.h"
+#include "service/realm-settings.h"
+
+#include <glib-object.h>
+#include <glib/gstdio.h>
+
+#include <string.h>
+
+static void
+remove_cache_file (void)
+{
+	int ret;
+
+	ret = g_mkdir_with_parents (CACHEDIR, 0700);
+	g_assert (ret >= 0);
+	g_unlink (CACHEDIR "/discovery-cache");
+}
+
+static RealmDisco *
+build_disco (const gchar *domain)
+{
+	RealmDisco *disco;
+	GInetAddress *inet;
+
+	disco = realm_disco_new (domain);
+	disco->kerberos_realm = g_ascii_strup (domain, -1);
+	disco->workgroup = g_strdup ("EXAMPLE");
+	disco->server_software = "active-directory";
+	disco->server_name = g_strdup ("dc1.example.com");
+	disco->client_site = g_strdup ("Branch");
+	disco->server_flags = 0x1fd;
+
+	inet = g_inet_address_new_from_string ("192.0.2.7");
+	disco->server_address = g_inet_socket_address_new (inet, 389);
+	g_object_unref (inet);
+
+	return disco;
+}
+
+static void
+test_key (void)
+{
+	gchar *key;
+
+	key = realm_disco_cache_key (" Example.COM ");
+	g_assert_cmpstr (key, ==, "example.com");
+	g_free (key);
+
+	key = realm_disco_cache_key ("example.com.");
+	g_assert_cmpstr (key, ==, "example.com");
+	g_free (key);
+
+	key = realm_disco_cache_key ("192.0.2.7");
+	g_assert_cmpstr (key, ==, "192.0.2.7");
+	g_free (key);
+}
+
+static void
+test_store_lookup (void)
+{
+	RealmDisco *disco;
+	RealmDisco *check;
+
+	remove_cache_file ();
+	realm_settings_init ();
+	realm_settings_add ("discovery", "cache-ttl", "300");
+
+	g_assert (realm_disco_cache_lookup ("example.com") == NULL);
+
+	disco = build_disco ("example.com");
+	realm_disco_cache_store ("Example.com", disco);
+
+	check = realm_disco_cache_lookup ("EXAMPLE.COM.");
+	g_assert (check != NULL);
+	g_assert (check != disco);
+	g_assert_cmpstr (check->domain_name, ==, disco->domain_name);
+
+	/* Changes made by callers don't end up in the cache */
+	g_free (check->workgroup);
+	check->workgroup = g_strdup ("GUESSED");
+	realm_disco_unref (check);
+	check = realm_disco_cache_lookup ("example.com");
+	g_assert_cmpstr (check->workgroup, ==, disco->workgroup);
+	realm_disco_unref (check);
+
+	realm_disco_cache_flush ();
+	g_assert (realm_disco_cache_lookup ("example.com") == NULL);
+
+	realm_disco_unref (disco);
+	realm_disco_cache_uninit ();
+	realm_settings_uninit ();
+}
+
+static void
+test_disabled (void)
+{
+	RealmDisco *disco;
+
+	remove_cache_file ();
+	realm_settings_init ();
+	realm_settings_add ("discovery", "cache-ttl", "0");
+
+	disco = build_disco ("example.com");
+	realm_disco_cache_store ("example.com", disco);
+	g_assert (realm_disco_cache_lookup ("example.com") == NULL);
+	realm_disco_unref (disco);
+
+	realm_disco_cache_uninit ();
+	realm_settings_uninit ();
+}
+
+static void
+test_persist (void)
+{
+	GInetSocketAddress *inet;
+	RealmDisco *disco;
+	gchar *address;
+
+	remove_cache_file ();
+	realm_settings_init ();
+	realm_settings_add ("discovery", "cache-ttl", "300");
+	realm_settings_add ("discovery", "cache-persist", "yes");
+
+	disco = build_disco ("example.com");
+	realm_disco_cache_store ("example.com", disco);
+	realm_disco_unref (disco);
+
+	/* Throw away the memory cache, and load from disk */
+	realm_disco_cache_uninit ();
+
+	disco = realm_disco_cache_lookup ("example.com");
+	g_assert (disco != NULL);
+	g_assert_cmpstr (disco->domain_name, ==, "example.com");
+	g_assert_cmpstr (disco->kerberos_realm, ==, "EXAMPLE.COM");
+	g_assert_cmpstr (disco->workgroup, ==, "EXAMPLE");
+	g_assert_cmpstr (disco->server_software, ==, "active-directory");
+	g_assert_cmpstr (disco->server_name, ==, "dc1.example.com");
+	g_assert_cmpstr (disco->server_site, ==, NULL);
+	g_assert_cmpstr (disco->client_site, ==, "Branch");
+	g_assert_cmpuint (disco->server_flags, ==, 0x1fd);
+
+	g_assert (G_IS_INET_SOCKET_ADDRESS (disco->server_address));
+	inet = G_INET_SOCKET_ADDRESS (disco->server_address);
+	address = g_inet_address_to_string (g_inet_socket_address_get_address (inet));
+	g_assert_cmpstr (address, ==, "192.0.2.7");
+	g_assert_cmpuint (g_inet_socket_address_get_port (inet), ==, 389);
+	g_free (address);
+
+	realm_disco_unref (disco);
+	realm_disco_cache_uninit ();
+	realm_settings_uninit ();
+}
+
+int
+main (int argc,
+      char **argv)
+{
+#if !GLIB_CHECK_VERSION(2, 36, 0)
+	g_type_init ();
+#endif
+
+	g_test_init (&argc, &argv, NULL);
+	g_set_prgname ("test-disco-cache");
+
+	g_test_add_func ("/realmd/disco-cache/key", test_key);
+	g_test_add_func ("/realmd/disco-cache/store-lookup", test_store_lookup);
+	g_test_add_func ("/realmd/disco-cache/disabled", test_disabled);
+	g_test_add_func ("/realmd/disco-cache/persist", test_persist);
+
+	return g_test_run ();
+}
@@ -0,0 +1,123 @@
+/* realmd -- Realm configuration service
+ *
+ * Copyright 2026 The realmd contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2 of the licence or (at
+ * your option) any later version.
+ *
+ * See the included COPYING file for more information.
+ */
+
+#include "config.h"
+
+#include "service/realm-disco-list.h"
+#include "service/realm-settings.h"
+
+#include <glib.h>
+
+static gchar *
+address_string (GSocketAddress *address)
+{
+	GInetSocketAddress *inet = G_INET_SOCKET_ADDRESS (address);
+	gchar *host;
+	gchar *string;
+
+	host = g_inet_address_to_string (g_inet_socket_address_get_address (inet));
+	string = g_strdup_printf ("%s/%u", host, (guint)g_inet_socket_address_get_port (inet));
+	g_free (host);
+
+	return string;
+}
+
+static void
+test_parse (void)
+{
+	GList *addresses;
+	gchar *string;
+
+	addresses = realm_disco_list_parse ("192.0.2.10, 192.0.2.11:3268\t[2001:db8::10]:636 2001:db8::11");
+	g_assert_cmpuint (g_list_length (addresses), ==, 4);
+
+	string = address_string (g_list_nth_data (addresses, 0));
+	g_assert_cmpstr (string, ==, "192.0.2.10/389");
+	g_free (string);
+	string = address_string (g_list_nth_data (addresses, 1));
+	g_assert_cmpstr (string, ==, "192.0.2.11/3268");
+	g_free (string);
+	string = address_string (g_list_nth_data (addresses, 2));
+	g_assert_cmpstr (string, ==, "2001:db8::10/636");
+	g_free (string);
+	string = address_string (g_list_nth_data (addresses, 3));
+	g_assert_cmpstr (string, ==, "2001:db8::11/389");
+	g_free (string);
+
+	g_list_free_full (addresses, g_object_unref);
+}
+
+static void
+test_parse_invalid (void)
+{
+	GList *addresses;
+	gchar *string;
+
+	/* Host names would need DNS, and are skipped along with garbage */
+	addresses = realm_disco_list_parse ("dc1.example.com [192.0.2.10 192.0.2.12");
+	g_assert_cmpuint (g_list_length (addresses), ==, 1);
+	string = address_string (addresses->data);
+	g_assert_cmpstr (string, ==, "192.0.2.12/389");
+	g_free (string);
+	g_list_free_full (addresses, g_object_unref);
+
+	g_assert (realm_disco_list_parse ("") == NULL);
+}
+
+static void
+test_enumerate (void)
+{
+	GSocketAddressEnumerator *enumerator;
+	GSocketAddress *address;
+	guint count = 0;
+
+	realm_settings_init ();
+	realm_settings_add ("domain.example.com", "domain-controllers", "192.0.2.10 192.0.2.11");
+
+	/* The section is named after the domain in lower case */
+	enumerator = realm_disco_list_enumerate_servers ("DOMAIN.Example.com.");
+	g_assert (enumerator != NULL);
+
+	for (;;) {
+		address = g_socket_address_enumerator_next (enumerator, NULL, NULL);
+		if (address == NULL)
+			break;
+		g_object_unref (address);
+		count++;
+	}
+
+	g_assert_cmpuint (count, ==, 2);
+	g_object_unref (enumerator);
+
+	/* Nothing configured, the caller goes to DNS */
+	g_assert (realm_disco_list_enumerate_servers ("other.example.com") == NULL);
+
+	realm_settings_uninit ();
+}
+
+int
+main (int argc,
+      char **argv)
+{
+#if !GLIB_CHECK_VERSION(2, 36, 0)
+	g_type_init ();
+#endif
+
+	g_test_init (&argc, &argv, NULL);
+	g_set_prgname ("test-disco-list");
+
+	g_test_add_func ("/realmd/disco-list/parse", test_parse);
+	g_test_add_func ("/realmd/disco-list/parse-invalid", test_parse_invalid);
+	g_test_add_func ("/realmd/disco-list/enumerate", test_enumerate);
+
+	return g_test_run ();
+}
@@ -0,0 +1,230 @@
+/* realmd -- Realm configuration service
+ *
+ * Copyright 2026 The realmd contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2 of the licence or (at
+ * your option) any later version.
+ *
+ * See the included COPYING file for more information.
+ */
+
+#include "config.h"
+
+#include "service/realm-disco-netlogon.h"
+
+#include <glib.h>
+
+#include <string.h>
+
+/* A NetLogon response from an Active Directory domain controller */
+static const guchar netlogon_response[] = {
+	0x17, 0x00, 0x00, 0x00,                          /* opcode, sbz */
+	0xfd, 0x01, 0x00, 0x00,                          /* flags */
+	0x4d, 0x6f, 0x2a, 0x11, 0x9c, 0x3e, 0x45, 0x47,  /* domain guid */
+	0xa1, 0x52, 0x0c, 0x7a, 0x61, 0x90, 0x2f, 0x05,
+	0x02, 'a', 'd', 0x07, 'e', 'x', 'a', 'm', 'p', 'l', 'e',
+	0x03, 'c', 'o', 'm', 0x00,                       /* forest at 24 */
+	0xc0, 0x18,                                      /* dns domain */
+	0x03, 'd', 'c', '1', 0xc0, 0x18,                 /* dns host */
+	0x02, 'A', 'D', 0x00,                            /* netbios domain */
+	0x03, 'D', 'C', '1', 0x00,                       /* netbios host */
+	0x00,                                            /* user */
+	0x17, 'D', 'e', 'f', 'a', 'u', 'l', 't', '-', 'F', 'i', 'r', 's',
+	't', '-', 'S', 'i', 't', 'e', '-', 'N', 'a', 'm', 'e',
+	0x00,                                            /* server site at 58 */
+	0xc0, 0x3a,                                      /* client site */
+	0x05, 0x00, 0x00, 0x00,                          /* nt version */
+	0xff, 0xff, 0xff, 0xff,                          /* lm tokens */
+};
+
+static void
+assert_name (RealmNetlogon *netlogon,
+             RealmNetlogonName name,
+             const gchar *expected)
+{
+	gchar buffer[REALM_NETLOGON_MAX_NAME];
+	gssize len;
+
+	len = realm_disco_netlogon_name (netlogon, name, buffer, sizeof (buffer));
+	g_assert_cmpint (len, ==, strlen (expected));
+	g_assert_cmpstr (buffer, ==, expected);
+}
+
+static void
+test_decode (void)
+{
+	RealmNetlogon netlogon;
+	gchar buffer[4];
+
+	if (!realm_disco_netlogon_decode (netlogon_response, sizeof (netlogon_response), &netlogon))
+		g_assert_not_reached ();
+
+	g_assert_cmpuint (netlogon.opcode, ==, REALM_NETLOGON_LOGON_SAM_LOGON_RESPONSE_EX);
+	g_assert_cmpuint (netlogon.flags, ==, 0x1fd);
+	g_assert (memcmp (netlogon.domain_guid, netlogon_response + 8, 16) == 0);
+	g_assert_cmpuint (netlogon.nt_version, ==, 5);
+	g_assert_cmpuint (netlogon.lm_nt_token, ==, 0xffff);
+	g_assert_cmpuint (netlogon.lm_20_token, ==, 0xffff);
+	g_assert (netlogon.sockaddr == NULL);
+
+	assert_name (&netlogon, REALM_NETLOGON_FOREST, "ad.example.com");
+	assert_name (&netlogon, REALM_NETLOGON_DNS_DOMAIN, "ad.example.com");
+	assert_name (&netlogon, REALM_NETLOGON_DNS_HOST, "dc1.ad.example.com");
+	assert_name (&netlogon, REALM_NETLOGON_NETBIOS_DOMAIN, "AD");
+	assert_name (&netlogon, REALM_NETLOGON_NETBIOS_HOST, "DC1");
+	assert_name (&netlogon, REALM_NETLOGON_USER, "");
+	assert_name (&netlogon, REALM_NETLOGON_SERVER_SITE, "Default-First-Site-Name");
+	assert_name (&netlogon, REALM_NETLOGON_CLIENT_SITE, "Default-First-Site-Name");
+
+	/* Not present in this response */
+	g_assert_cmpint (realm_disco_netlogon_name (&netlogon, REALM_NETLOGON_NEXT_CLOSEST_SITE,
+	                                            buffer, sizeof (buffer)), ==, -1);
+
+	/* Doesn't fit */
+	g_assert_cmpint (realm_disco_netlogon_name (&netlogon, REALM_NETLOGON_FOREST,
+	                                            buffer, sizeof (buffer)), ==, -1);
+}
+
+static void
+test_optional (void)
+{
+	static const guchar sockaddr[] = {
+		0x02, 0x00, 0x00, 0x00, 0xc0, 0x00, 0x02, 0x01,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	};
+	RealmNetlogon netlogon;
+	GByteArray *data;
+
+	/* Everything up to the nt version */
+	data = g_byte_array_new ();
+	g_byte_array_append (data, netlogon_response, sizeof (netlogon_response) - 8);
+	g_byte_array_append (data, (guchar *)"\x10", 1);
+	g_byte_array_append (data, sockaddr, sizeof (sockaddr));
+	g_byte_array_append (data, (guchar *)"\xc0\x3a", 2);
+	g_byte_array_append (data, (guchar *)"\x1d\x00\x00\x00\xff\xff\xff\xff", 8);
+
+	if (!realm_disco_netlogon_decode (data->data, data->len, &netlogon))
+		g_assert_not_reached ();
+
+	g_assert_cmpuint (netlogon.nt_version, ==, 0x1d);
+	g_assert_cmpuint (netlogon.sockaddr_size, ==, sizeof (sockaddr));
+	g_assert (memcmp (netlogon.sockaddr, sockaddr, sizeof (sockaddr)) == 0);
+	assert_name (&netlogon, REALM_NETLOGON_NEXT_CLOSEST_SITE, "Default-First-Site-Name");
+
+	g_byte_array_free (data, TRUE);
+}
+
+static void
+test_invalid (void)
+{
+	RealmNetlogon netlogon;
+	guchar data[sizeof (netlogon_response)];
+	gsize i;
+
+	/* Any truncated response is invalid */
+	for (i = 0; i < sizeof (netlogon_response); i++)
+		g_assert (!realm_disco_netlogon_decode (netlogon_response, i, &netlogon));
+
+	g_assert (!realm_disco_netlogon_decode (NULL, 0, &netlogon));
+
+	/* Wrong opcode */
+	memcpy (data, netlogon_response, sizeof (data));
+	data[0] = 19;
+	g_assert (!realm_disco_netlogon_decode (data, sizeof (data), &netlogon));
+
+	/* Compression pointer to itself */
+	memcpy (data, netlogon_response, sizeof (data));
+	data[41] = 40;
+	g_assert (!realm_disco_netlogon_decode (data, sizeof (data), &netlogon));
+
+	/* Compression pointer forwards */
+	memcpy (data, netlogon_response, sizeof (data));
+	data[41] = 58;
+	g_assert (!realm_disco_netlogon_decode (data, sizeof (data), &netlogon));
+
+	/* Reserved label type */
+	memcpy (data, netlogon_response, sizeof (data));
+	data[48] = 0x42;
+	g_assert (!realm_disco_netlogon_decode (data, sizeof (data), &netlogon));
+
+	/* A nul inside a label */
+	memcpy (data, netlogon_response, sizeof (data));
+	data[50] = 0x00;
+	g_assert (!realm_disco_netlogon_decode (data, sizeof (data), &netlogon));
+}
+
+static void
+test_fuzz (void)
+{
+	gchar buffer[REALM_NETLOGON_MAX_NAME];
+	guchar data[sizeof (netlogon_response)];
+	RealmNetlogon netlogon;
+	gsize length;
+	gssize len;
+	gint i, j, n;
+
+	/* Random corruption must never read out of bounds or overflow */
+	for (i = 0; i < 100000; i++) {
+		memcpy (data, netlogon_response, sizeof (data));
+		n = g_test_rand_int_range (1, 8);
+		for (j = 0; j < n; j++)
+			data[g_test_rand_int_range (0, sizeof (data))] = g_test_rand_int_range (0, 256);
+		length = g_test_rand_int_range (0, 4) == 0 ?
+		         g_test_rand_int_range (0, sizeof (data)) : sizeof (data);
+
+		if (!realm_disco_netlogon_decode (data, length, &netlogon))
+			continue;
+
+		for (j = 0; j < REALM_NETLOGON_N_NAMES; j++) {
+			len = realm_disco_netlogon_name (&netlogon, j, buffer, sizeof (buffer));
+			if (len >= 0)
+				g_assert_cmpint (len, ==, strlen (buffer));
+		}
+	}
+}
+
+static void
+test_benchmark (void)
+{
+	gchar buffer[REALM_NETLOGON_MAX_NAME];
+	RealmNetlogon netlogon;
+	gdouble elapsed;
+	gint i, count;
+
+	if (!g_test_perf ())
+		return;
+
+	count = 5000000;
+	g_test_timer_start ();
+
+	/* The names realmd actually uses from each response */
+	for (i = 0; i < count; i++) {
+		if (!realm_disco_netlogon_decode (netlogon_response, sizeof (netlogon_response), &netlogon) ||
+		    realm_disco_netlogon_name (&netlogon, REALM_NETLOGON_DNS_DOMAIN, buffer, sizeof (buffer)) < 0 ||
+		    realm_disco_netlogon_name (&netlogon, REALM_NETLOGON_DNS_HOST, buffer, sizeof (buffer)) < 0 ||
+		    realm_disco_netlogon_name (&netlogon, REALM_NETLOGON_CLIENT_SITE, buffer, sizeof (buffer)) < 0)
+			g_assert_not_reached ();
+	}
+
+	elapsed = g_test_timer_elapsed ();
+	g_test_maximized_result (count / elapsed, "%.0f responses decoded per second",
+	                         count / elapsed);
+}
+
+int
+main (int argc,
+      char **argv)
+{
+	g_test_init (&argc, &argv, NULL);
+	g_set_prgname ("test-disco-netlogon");
+
+	g_test_add_func ("/realmd/disco-netlogon/decode", test_decode);
+	g_test_add_func ("/realmd/disco-netlogon/optional", test_optional);
+	g_test_add_func ("/realmd/disco-netlogon/invalid", test_invalid);
+	g_test_add_func ("/realmd/disco-netlogon/fuzz", test_fuzz);
+	g_test_add_func ("/realmd/disco-netlogon/benchmark", test_benchmark);
+
+	return g_test_run ();
+}
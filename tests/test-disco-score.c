@@ -0,0 +1,189 @@
+/* realmd -- Realm configuration service
+ *
+ * Copyright 2026 The realmd contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2 of the licence or (at
+ * your option) any later version.
+ *
+ * See the included COPYING file for more information.
+ */
+
+#include "config.h"
+
+#include "service/realm-disco-score.h"
+
+#include <glib-object.h>
+
+static GSocketAddress *
+build_address (const gchar *string)
+{
+	GSocketAddress *address;
+	GInetAddress *inet;
+
+	inet = g_inet_address_new_from_string (string);
+	address = g_inet_socket_address_new (inet, 389);
+	g_object_unref (inet);
+
+	return address;
+}
+
+static RealmDisco *
+build_disco (guint32 flags)
+{
+	RealmDisco *disco;
+
+	disco = realm_disco_new ("Example.com");
+	disco->server_flags = flags;
+	return disco;
+}
+
+static void
+test_order (void)
+{
+	GSocketAddress *fast, *slow, *failing, *unknown, *other;
+	RealmDisco *disco;
+	GList *addresses;
+
+	fast = build_address ("192.0.2.1");
+	slow = build_address ("192.0.2.2");
+	failing = build_address ("192.0.2.3");
+	unknown = build_address ("192.0.2.4");
+	other = build_address ("192.0.2.5");
+
+	disco = build_disco (0);
+	realm_disco_score_success (slow, disco, 900000);
+	realm_disco_score_success (fast, disco, 20000);
+	realm_disco_score_success (failing, disco, 10000);
+	realm_disco_score_failure (failing);
+	realm_disco_unref (disco);
+
+	g_assert (realm_disco_score_is_failing (failing));
+	g_assert (!realm_disco_score_is_failing (fast));
+	g_assert (!realm_disco_score_is_failing (unknown));
+
+	/* Unknown servers keep the order they were given in */
+	addresses = g_list_append (NULL, failing);
+	addresses = g_list_append (addresses, unknown);
+	addresses = g_list_append (addresses, slow);
+	addresses = g_list_append (addresses, other);
+	addresses = g_list_append (addresses, fast);
+	addresses = realm_disco_score_order (addresses);
+
+	g_assert (g_list_nth_data (addresses, 0) == fast);
+	g_assert (g_list_nth_data (addresses, 1) == slow);
+	g_assert (g_list_nth_data (addresses, 2) == unknown);
+	g_assert (g_list_nth_data (addresses, 3) == other);
+	g_assert (g_list_nth_data (addresses, 4) == failing);
+	g_list_free (addresses);
+
+	g_object_unref (fast);
+	g_object_unref (slow);
+	g_object_unref (failing);
+	g_object_unref (unknown);
+	g_object_unref (other);
+	realm_disco_score_uninit ();
+}
+
+static void
+test_best (void)
+{
+	GSocketAddress *remote, *local, *readonly;
+	RealmDisco *disco;
+	gchar *best;
+
+	remote = build_address ("192.0.2.1");
+	local = build_address ("192.0.2.2");
+	readonly = build_address ("192.0.2.3");
+
+	g_assert (realm_disco_score_best ("example.com") == NULL);
+
+	disco = build_disco (REALM_DISCO_DS_WRITABLE);
+	realm_disco_score_success (remote, disco, 10000);
+	realm_disco_unref (disco);
+
+	disco = build_disco (REALM_DISCO_DS_WRITABLE | REALM_DISCO_DS_CLOSEST);
+	realm_disco_score_success (local, disco, 50000);
+	realm_disco_unref (disco);
+
+	disco = build_disco (REALM_DISCO_DS_CLOSEST);
+	realm_disco_score_success (readonly, disco, 1000);
+	realm_disco_unref (disco);
+
+	/* Writable servers in our site win over faster ones */
+	best = realm_disco_score_best ("EXAMPLE.COM");
+	g_assert_cmpstr (best, ==, "192.0.2.2");
+	g_free (best);
+
+	realm_disco_score_failure (local);
+	best = realm_disco_score_best ("example.com");
+	g_assert_cmpstr (best, ==, "192.0.2.1");
+	g_free (best);
+
+	g_assert (realm_disco_score_best ("other.example.com") == NULL);
+
+	g_object_unref (remote);
+	g_object_unref (local);
+	g_object_unref (readonly);
+	realm_disco_score_uninit ();
+}
+
+static void
+test_dump (void)
+{
+	GSocketAddress *address;
+	RealmDisco *disco;
+	GVariant *dump;
+	const gchar *domain;
+	const gchar *string;
+	guint successes;
+	guint failures;
+	gint64 rtt;
+	gint64 seen;
+
+	address = build_address ("192.0.2.1");
+	disco = build_disco (0);
+	realm_disco_score_success (address, disco, 1000);
+	realm_disco_score_success (address, disco, 9000);
+	realm_disco_score_failure (address);
+	realm_disco_unref (disco);
+
+	dump = realm_disco_score_dump ("other.example.com");
+	g_assert_cmpuint (g_variant_n_children (dump), ==, 0);
+	g_variant_unref (g_variant_ref_sink (dump));
+
+	dump = realm_disco_score_dump ("");
+	g_variant_ref_sink (dump);
+	g_assert_cmpuint (g_variant_n_children (dump), ==, 1);
+	g_variant_get_child (dump, 0, "(&s&sxuux)", &domain, &string,
+	                     &rtt, &successes, &failures, &seen);
+	g_assert_cmpstr (domain, ==, "example.com");
+	g_assert_cmpstr (string, ==, "192.0.2.1");
+	g_assert_cmpint (rtt, ==, 2000);
+	g_assert_cmpuint (successes, ==, 2);
+	g_assert_cmpuint (failures, ==, 1);
+	g_assert_cmpint (seen, >, 0);
+	g_variant_unref (dump);
+
+	g_object_unref (address);
+	realm_disco_score_uninit ();
+}
+
+int
+main (int argc,
+      char **argv)
+{
+#if !GLIB_CHECK_VERSION(2, 36, 0)
+	g_type_init ();
+#endif
+
+	g_test_init (&argc, &argv, NULL);
+	g_set_prgname ("test-disco-score");
+
+	g_test_add_func ("/realmd/disco-score/order", test_order);
+	g_test_add_func ("/realmd/disco-score/best", test_best);
+	g_test_add_func ("/realmd/disco-score/dump", test_dump);
+
+	return g_test_run ();
+}
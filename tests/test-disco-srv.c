@@ -0,0 +1,193 @@
+/* realmd -- Realm configuration service
+ *
+ * Copyright 2026 The realmd contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2 of the licence or (at
+ * your option) any later version.
+ *
+ * See the included COPYING file for more information.
+ */
+
+#include "config.h"
+
+#include "service/realm-disco-srv.h"
+
+#include <glib.h>
+
+#include <string.h>
+
+/* An SRV response with the addresses of the targets in the additional section */
+static const guchar srv_response[] = {
+	0x12, 0x34, 0x85, 0x80,                          /* id, flags */
+	0x00, 0x01, 0x00, 0x02, 0x00, 0x00, 0x00, 0x03,  /* counts */
+	0x05, '_', 'l', 'd', 'a', 'p',                   /* question at 12 */
+	0x04, '_', 't', 'c', 'p',
+	0x02, 'a', 'd',                                  /* ad.example.com at 23 */
+	0x07, 'e', 'x', 'a', 'm', 'p', 'l', 'e',
+	0x03, 'c', 'o', 'm', 0x00,
+	0x00, 0x21, 0x00, 0x01,
+
+	0xc0, 0x0c, 0x00, 0x21, 0x00, 0x01,              /* answer at 43 */
+	0x00, 0x00, 0x02, 0x58, 0x00, 0x0c,
+	0x00, 0x0a, 0x00, 0x32, 0x01, 0x85,              /* priority 10 */
+	0x03, 'd', 'c', '2', 0xc0, 0x17,                 /* dc2 at 61 */
+
+	0xc0, 0x0c, 0x00, 0x21, 0x00, 0x01,              /* answer at 67 */
+	0x00, 0x00, 0x02, 0x58, 0x00, 0x0c,
+	0x00, 0x00, 0x00, 0x64, 0x01, 0x85,              /* priority 0 */
+	0x03, 'd', 'c', '1', 0xc0, 0x17,                 /* dc1 at 85 */
+
+	0xc0, 0x55, 0x00, 0x01, 0x00, 0x01,              /* A for dc1 */
+	0x00, 0x00, 0x02, 0x58, 0x00, 0x04,
+	192, 0, 2, 1,
+
+	0xc0, 0x55, 0x00, 0x1c, 0x00, 0x01,              /* AAAA for dc1 */
+	0x00, 0x00, 0x02, 0x58, 0x00, 0x10,
+	0x20, 0x01, 0x0d, 0xb8, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01,
+
+	0xc0, 0x3d, 0x00, 0x01, 0x00, 0x01,              /* A for dc2 */
+	0x00, 0x00, 0x02, 0x58, 0x00, 0x04,
+	192, 0, 2, 2,
+};
+
+/* Length of the header and question */
+#define QUESTION_END 43
+
+static gchar *
+address_string (GList *addresses,
+                guint index)
+{
+	return g_inet_address_to_string (g_list_nth_data (addresses, index));
+}
+
+static void
+test_parse (void)
+{
+	GHashTable *glue = NULL;
+	GError *error = NULL;
+	GList *addresses;
+	GList *targets;
+	gchar *string;
+
+	targets = realm_disco_srv_parse (srv_response, sizeof (srv_response),
+	                                 "_ldap._tcp.ad.example.com", &glue, &error);
+	g_assert_no_error (error);
+	g_assert (glue != NULL);
+
+	/* Sorted by priority */
+	g_assert_cmpuint (g_list_length (targets), ==, 2);
+	g_assert_cmpstr (g_srv_target_get_hostname (targets->data), ==, "dc1.ad.example.com");
+	g_assert_cmpuint (g_srv_target_get_port (targets->data), ==, 389);
+	g_assert_cmpuint (g_srv_target_get_priority (targets->data), ==, 0);
+	g_assert_cmpstr (g_srv_target_get_hostname (targets->next->data), ==, "dc2.ad.example.com");
+	g_assert_cmpuint (g_srv_target_get_priority (targets->next->data), ==, 10);
+
+	addresses = realm_disco_srv_glue_lookup (glue, "dc1.ad.example.com");
+	g_assert_cmpuint (g_list_length (addresses), ==, 2);
+	string = address_string (addresses, 0);
+	g_assert_cmpstr (string, ==, "192.0.2.1");
+	g_free (string);
+	string = address_string (addresses, 1);
+	g_assert_cmpstr (string, ==, "2001:db8::1");
+	g_free (string);
+	g_resolver_free_addresses (addresses);
+
+	/* Host names are not case sensitive */
+	addresses = realm_disco_srv_glue_lookup (glue, "DC2.AD.example.com");
+	g_assert_cmpuint (g_list_length (addresses), ==, 1);
+	string = address_string (addresses, 0);
+	g_assert_cmpstr (string, ==, "192.0.2.2");
+	g_free (string);
+	g_resolver_free_addresses (addresses);
+
+	g_assert (realm_disco_srv_glue_lookup (glue, "dc3.ad.example.com") == NULL);
+	g_assert (realm_disco_srv_glue_lookup (NULL, "dc1.ad.example.com") == NULL);
+
+	g_hash_table_unref (glue);
+	g_list_free_full (targets, (GDestroyNotify)g_srv_target_free);
+}
+
+static void
+test_no_glue (void)
+{
+	GError *error = NULL;
+	GList *targets;
+
+	targets = realm_disco_srv_parse (srv_response, sizeof (srv_response),
+	                                 "_ldap._tcp.ad.example.com", NULL, &error);
+	g_assert_no_error (error);
+	g_assert_cmpuint (g_list_length (targets), ==, 2);
+	g_list_free_full (targets, (GDestroyNotify)g_srv_target_free);
+}
+
+static void
+test_rcode (void)
+{
+	guchar response[QUESTION_END];
+	GHashTable *glue = NULL;
+	GError *error = NULL;
+
+	/* Just the question, with no answers or glue */
+	memcpy (response, srv_response, sizeof (response));
+	response[7] = 0x00;
+	response[11] = 0x00;
+
+	/* No such name */
+	response[3] = 0x83;
+	g_assert (realm_disco_srv_parse (response, sizeof (response), "_ldap._tcp.ad.example.com",
+	                                 &glue, &error) == NULL);
+	g_assert_error (error, G_RESOLVER_ERROR, G_RESOLVER_ERROR_NOT_FOUND);
+	g_assert (glue == NULL);
+	g_clear_error (&error);
+
+	/* Server failure */
+	response[3] = 0x82;
+	g_assert (realm_disco_srv_parse (response, sizeof (response), "_ldap._tcp.ad.example.com",
+	                                 &glue, &error) == NULL);
+	g_assert_error (error, G_RESOLVER_ERROR, G_RESOLVER_ERROR_TEMPORARY_FAILURE);
+	g_clear_error (&error);
+
+	/* The name exists but has no SRV records */
+	response[3] = 0x80;
+	g_assert (realm_disco_srv_parse (response, sizeof (response), "_ldap._tcp.ad.example.com",
+	                                 &glue, &error) == NULL);
+	g_assert_error (error, G_RESOLVER_ERROR, G_RESOLVER_ERROR_NOT_FOUND);
+	g_clear_error (&error);
+}
+
+static void
+test_invalid (void)
+{
+	GError *error = NULL;
+	gsize length;
+
+	/* Every truncation of the response is rejected, not misread */
+	for (length = 0; length < QUESTION_END + 12; length++) {
+		g_assert (realm_disco_srv_parse (srv_response, length, "_ldap._tcp.ad.example.com",
+		                                 NULL, &error) == NULL);
+		g_assert (error != NULL);
+		g_clear_error (&error);
+	}
+}
+
+int
+main (int argc,
+      char **argv)
+{
+#if !GLIB_CHECK_VERSION(2, 36, 0)
+	g_type_init ();
+#endif
+
+	g_test_init (&argc, &argv, NULL);
+	g_set_prgname ("test-disco-srv");
+
+	g_test_add_func ("/realmd/disco-srv/parse", test_parse);
+	g_test_add_func ("/realmd/disco-srv/no-glue", test_no_glue);
+	g_test_add_func ("/realmd/disco-srv/rcode", test_rcode);
+	g_test_add_func ("/realmd/disco-srv/invalid", test_invalid);
+
+	return g_test_run ();
+}
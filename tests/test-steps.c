@@ -0,0 +1,234 @@
+/* realmd -- Realm configuration service
+ *
+ * Copyright 2026 The realmd contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2 of the licence or (at
+ * your option) any later version.
+ *
+ * See the included COPYING file for more information.
+ */
+
+#include "config.h"
+
+#include "service/realm-steps.h"
+#include "service/realm-trace.h"
+
+#include <glib.h>
+
+typedef struct {
+	GString *log;
+	GAsyncResult *result;
+} Test;
+
+typedef struct {
+	Test *test;
+	const gchar *name;
+	gboolean fail;
+} Step;
+
+static void
+setup (Test *test,
+       gconstpointer unused)
+{
+	test->log = g_string_new ("");
+}
+
+static void
+teardown (Test *test,
+          gconstpointer unused)
+{
+	g_string_free (test->log, TRUE);
+	g_clear_object (&test->result);
+}
+
+static gboolean
+on_idle_step_done (gpointer user_data)
+{
+	GTask *task = G_TASK (user_data);
+	Step *step = g_task_get_task_data (task);
+
+	g_string_append_printf (step->test->log, "-%s", step->name);
+	if (step->fail)
+		g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_FAILED, "%s failed", step->name);
+	else
+		g_task_return_boolean (task, TRUE);
+
+	return FALSE;
+}
+
+static void
+begin_step (gpointer data,
+            GDBusMethodInvocation *invocation,
+            GAsyncReadyCallback callback,
+            gpointer user_data)
+{
+	Step *step = data;
+	GTask *task;
+
+	g_string_append_printf (step->test->log, "+%s", step->name);
+
+	task = g_task_new (NULL, NULL, callback, user_data);
+	g_task_set_task_data (task, step, NULL);
+	g_idle_add_full (G_PRIORITY_DEFAULT, on_idle_step_done, task, g_object_unref);
+}
+
+static gboolean
+finish_step (GAsyncResult *result,
+             GError **error)
+{
+	return g_task_propagate_boolean (G_TASK (result), error);
+}
+
+static guint
+add_step (RealmSteps *steps,
+          Test *test,
+          const gchar *name,
+          gboolean fail)
+{
+	Step *step;
+
+	step = g_new0 (Step, 1);
+	step->test = test;
+	step->name = name;
+	step->fail = fail;
+
+	return realm_steps_add (steps, name, begin_step, finish_step, step, g_free);
+}
+
+static void
+on_complete_get_result (GObject *source,
+                        GAsyncResult *result,
+                        gpointer user_data)
+{
+	Test *test = user_data;
+	g_assert (test->result == NULL);
+	test->result = g_object_ref (result);
+}
+
+static gboolean
+run_steps (Test *test,
+           RealmSteps *steps,
+           GError **error)
+{
+	realm_steps_run_async (steps, on_complete_get_result, test);
+	while (test->result == NULL)
+		g_main_context_iteration (NULL, TRUE);
+
+	return realm_steps_run_finish (test->result, error);
+}
+
+static void
+test_concurrent (Test *test,
+                 gconstpointer unused)
+{
+	GError *error = NULL;
+	RealmSteps *steps;
+	guint one, two, three;
+
+	steps = realm_steps_new (NULL);
+	one = add_step (steps, test, "one", FALSE);
+	two = add_step (steps, test, "two", FALSE);
+	three = add_step (steps, test, "three", FALSE);
+	realm_steps_after (steps, three, one);
+	realm_steps_after (steps, three, two);
+
+	g_assert (run_steps (test, steps, &error));
+	g_assert_no_error (error);
+
+	/* The first two run at the same time, the last waits on both */
+	g_assert_cmpstr (test->log->str, ==, "+one+two-one-two+three-three");
+}
+
+static void
+test_chain (Test *test,
+            gconstpointer unused)
+{
+	GError *error = NULL;
+	RealmSteps *steps;
+	guint one, two, three;
+
+	steps = realm_steps_new (NULL);
+	one = add_step (steps, test, "one", FALSE);
+	two = add_step (steps, test, "two", FALSE);
+	three = add_step (steps, test, "three", FALSE);
+	realm_steps_after (steps, two, one);
+	realm_steps_after (steps, three, one);
+
+	g_assert (run_steps (test, steps, &error));
+	g_assert_no_error (error);
+	g_assert_cmpstr (test->log->str, ==, "+one-one+two+three-two-three");
+}
+
+static void
+test_failure (Test *test,
+              gconstpointer unused)
+{
+	GError *error = NULL;
+	RealmSteps *steps;
+	guint one, three;
+
+	steps = realm_steps_new (NULL);
+	one = add_step (steps, test, "one", TRUE);
+	add_step (steps, test, "two", FALSE);
+	three = add_step (steps, test, "three", FALSE);
+	realm_steps_after (steps, three, one);
+
+	/* Steps already running complete, but no more are started */
+	g_assert (!run_steps (test, steps, &error));
+	g_assert_error (error, G_IO_ERROR, G_IO_ERROR_FAILED);
+	g_assert_cmpstr (error->message, ==, "one failed");
+	g_assert_cmpstr (test->log->str, ==, "+one+two-one-two");
+	g_error_free (error);
+}
+
+static void
+test_empty (Test *test,
+            gconstpointer unused)
+{
+	GError *error = NULL;
+	RealmSteps *steps;
+
+	steps = realm_steps_new (NULL);
+	g_assert (run_steps (test, steps, &error));
+	g_assert_no_error (error);
+	g_assert_cmpstr (test->log->str, ==, "");
+}
+
+/* Tracing isn't under test here */
+
+RealmTraceSpan *
+realm_trace_begin (GDBusMethodInvocation *invocation,
+                   const gchar *category,
+                   const gchar *format,
+                   ...)
+{
+	return NULL;
+}
+
+void
+realm_trace_end (RealmTraceSpan *span,
+                 const GError *error)
+{
+
+}
+
+int
+main (int argc,
+      char **argv)
+{
+#if !GLIB_CHECK_VERSION(2, 36, 0)
+	g_type_init ();
+#endif
+
+	g_test_init (&argc, &argv, NULL);
+	g_set_prgname ("test-steps");
+
+	g_test_add ("/realmd/steps/concurrent", Test, NULL, setup, test_concurrent, teardown);
+	g_test_add ("/realmd/steps/chain", Test, NULL, setup, test_chain, teardown);
+	g_test_add ("/realmd/steps/failure", Test, NULL, setup, test_failure, teardown);
+	g_test_add ("/realmd/steps/empty", Test, NULL, setup, test_empty, teardown);
+
+	return g_test_run ();
+}
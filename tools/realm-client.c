@@ -350,25 +350,51 @@ realm_client_get_provider (RealmClient *self)
 	return self->provider;
 }
 
+static GList *
+lookup_realm_paths (RealmClient *self,
+                    const gchar *const *realm_paths,
+                    const gchar *dbus_interface,
+                    gboolean *had_mismatched)
+{
+	GDBusObjectManager *manager;
+	GDBusInterface *iface;
+	GList *realms = NULL;
+	gint i;
+
+	manager = G_DBUS_OBJECT_MANAGER (self);
+
+	for (i = 0; realm_paths[i] != NULL; i++) {
+		iface = g_dbus_object_manager_get_interface (manager, realm_paths[i],
+		                                             dbus_interface);
+		if (iface == NULL) {
+			if (had_mismatched)
+				*had_mismatched = TRUE;
+		} else {
+			g_dbus_proxy_set_default_timeout (G_DBUS_PROXY (iface), G_MAXINT);
+			realms = g_list_prepend (realms, iface);
+		}
+	}
+
+	return g_list_reverse (realms);
+}
+
 GList *
 realm_client_discover (RealmClient *self,
                        const gchar *string,
                        const gchar *client_software,
                        const gchar *server_software,
                        const gchar *membership_software,
+                       gboolean forest,
                        const gchar *dbus_interface,
                        gboolean *had_mismatched,
                        GError **error)
 {
-	GDBusObjectManager *manager;
-	GDBusInterface *iface;
 	GVariant *options;
 	SyncClosure sync;
 	gchar **realm_paths;
 	gint relevance;
 	GList *realms;
 	gboolean ret;
-	gint i;
 
 	g_return_val_if_fail (REALM_IS_CLIENT (self), NULL);
 
@@ -381,6 +407,7 @@ realm_client_discover (RealmClient *self,
 	options = realm_build_options (REALM_DBUS_OPTION_CLIENT_SOFTWARE, client_software,
 	                               REALM_DBUS_OPTION_SERVER_SOFTWARE, server_software,
 	                               REALM_DBUS_OPTION_MEMBERSHIP_SOFTWARE, membership_software,
+	                               REALM_DBUS_OPTION_FOREST, forest,
 	                               NULL);
 
 	/* Start actual operation */
@@ -399,23 +426,100 @@ realm_client_discover (RealmClient *self,
 	if (!ret)
 		return FALSE;
 
-	realms = NULL;
-	manager = G_DBUS_OBJECT_MANAGER (self);
+	realms = lookup_realm_paths (self, (const gchar *const *)realm_paths,
+	                             dbus_interface, had_mismatched);
 
-	for (i = 0; realm_paths[i] != NULL; i++) {
-		iface = g_dbus_object_manager_get_interface (manager, realm_paths[i],
-		                                             dbus_interface);
-		if (iface == NULL) {
-			if (had_mismatched)
-				*had_mismatched = TRUE;
-		} else {
-			g_dbus_proxy_set_default_timeout (G_DBUS_PROXY (iface), G_MAXINT);
-			realms = g_list_prepend (realms, iface);
+	g_strfreev (realm_paths);
+	return realms;
+}
+
+GList **
+realm_client_discover_many (RealmClient *self,
+                            const gchar **strings,
+                            const gchar *client_software,
+                            const gchar *server_software,
+                            const gchar *membership_software,
+                            gboolean forest,
+                            const gchar *dbus_interface,
+                            GError ***failures,
+                            GError **error)
+{
+	GVariant *options;
+	GVariant *results;
+	const gchar **realm_paths;
+	const gchar *string;
+	const gchar *message;
+	SyncClosure sync;
+	GError *sub_error = NULL;
+	GVariantIter iter;
+	GList **realms;
+	gint relevance;
+	guint count;
+	guint i;
+
+	g_return_val_if_fail (REALM_IS_CLIENT (self), NULL);
+	g_return_val_if_fail (strings != NULL, NULL);
+	g_return_val_if_fail (failures != NULL, NULL);
+
+	count = g_strv_length ((gchar **)strings);
+
+	sync.result = NULL;
+	sync.loop = g_main_loop_new (NULL, FALSE);
+
+	options = realm_build_options (REALM_DBUS_OPTION_CLIENT_SOFTWARE, client_software,
+	                               REALM_DBUS_OPTION_SERVER_SOFTWARE, server_software,
+	                               REALM_DBUS_OPTION_MEMBERSHIP_SOFTWARE, membership_software,
+	                               REALM_DBUS_OPTION_FOREST, forest,
+	                               NULL);
+
+	/* Start actual operation */
+	realm_dbus_provider_call_discover_many (self->provider, strings, options,
+	                                        NULL, on_complete_get_result, &sync);
+
+	/* This mainloop is quit by on_complete_get_result */
+	g_main_loop_run (sync.loop);
+
+	realm_dbus_provider_call_discover_many_finish (self->provider, &results,
+	                                               sync.result, &sub_error);
+
+	g_object_unref (sync.result);
+	g_main_loop_unref (sync.loop);
+
+	if (sub_error != NULL &&
+	    !g_error_matches (sub_error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD)) {
+		g_propagate_error (error, sub_error);
+		return NULL;
+	}
+
+	realms = g_new0 (GList *, count + 1);
+	*failures = g_new0 (GError *, count + 1);
+
+	/* An older realmd, do them one by one */
+	if (sub_error != NULL) {
+		g_clear_error (&sub_error);
+		for (i = 0; i < count; i++) {
+			realms[i] = realm_client_discover (self, strings[i], client_software,
+			                                   server_software, membership_software,
+			                                   forest, dbus_interface, NULL, &(*failures)[i]);
 		}
+
+	} else {
+		i = 0;
+		g_variant_iter_init (&iter, results);
+		while (g_variant_iter_next (&iter, "(&si^a&o&s)", &string, &relevance, &realm_paths, &message)) {
+			if (i < count) {
+				if (relevance < 0)
+					(*failures)[i] = g_error_new_literal (G_IO_ERROR, G_IO_ERROR_FAILED, message);
+				else
+					realms[i] = lookup_realm_paths (self, realm_paths, dbus_interface, NULL);
+				i++;
+			}
+			g_free (realm_paths);
+		}
+		g_variant_unref (results);
 	}
 
-	g_strfreev (realm_paths);
-	return g_list_reverse (realms);
+	return realms;
 }
 
 RealmDbusRealm *
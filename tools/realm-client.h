@@ -43,10 +43,21 @@ GList *                        realm_client_discover                 (RealmClien
                                                                       const gchar *client_software,
                                                                       const gchar *server_software,
                                                                       const gchar *membership_software,
+                                                                      gboolean forest,
                                                                       const gchar *dbus_interface,
                                                                       gboolean *had_mismatched,
                                                                       GError **error);
 
+GList **                       realm_client_discover_many            (RealmClient *self,
+                                                                      const gchar **strings,
+                                                                      const gchar *client_software,
+                                                                      const gchar *server_software,
+                                                                      const gchar *membership_software,
+                                                                      gboolean forest,
+                                                                      const gchar *dbus_interface,
+                                                                      GError ***failures,
+                                                                      GError **error);
+
 RealmDbusRealm *               realm_client_get_realm                (RealmClient *self,
                                                                       const gchar *object_path);
 
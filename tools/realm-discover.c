@@ -112,30 +112,17 @@ print_realm_info (RealmClient *client,
 }
 
 static int
-perform_discover (RealmClient *client,
+print_discovered (RealmClient *client,
                   const gchar *string,
+                  GList *realms,
                   gboolean all,
-                  gboolean name_only,
-                  const gchar *server_software,
-                  const gchar *client_software,
-                  const gchar *membership_software)
+                  gboolean name_only)
 {
 	GHashTable *seen;
 	gboolean found = FALSE;
-	GError *error = NULL;
 	const gchar *name;
-	GList *realms;
 	GList *l;
 
-	realms = realm_client_discover (client, string, client_software,
-	                                server_software, membership_software,
-	                                REALM_DBUS_REALM_INTERFACE, NULL, &error);
-
-	if (error != NULL) {
-		realm_handle_error (error, _("Couldn't discover realms"));
-		return 1;
-	}
-
 	seen = g_hash_table_new (g_str_hash, g_str_equal);
 
 	for (l = realms; l != NULL; l = g_list_next (l)) {
@@ -148,7 +135,6 @@ perform_discover (RealmClient *client,
 	}
 
 	g_hash_table_destroy (seen);
-	g_list_free_full (realms, g_object_unref);
 
 	if (!found) {
 		if (string == NULL)
@@ -161,6 +147,80 @@ perform_discover (RealmClient *client,
 	return 0;
 }
 
+static int
+perform_discover (RealmClient *client,
+                  const gchar *string,
+                  gboolean all,
+                  gboolean name_only,
+                  const gchar *server_software,
+                  const gchar *client_software,
+                  const gchar *membership_software,
+                  gboolean forest)
+{
+	GError *error = NULL;
+	GList *realms;
+	int ret;
+
+	realms = realm_client_discover (client, string, client_software,
+	                                server_software, membership_software,
+	                                forest, REALM_DBUS_REALM_INTERFACE, NULL, &error);
+
+	if (error != NULL) {
+		realm_handle_error (error, _("Couldn't discover realms"));
+		return 1;
+	}
+
+	ret = print_discovered (client, string, realms, all, name_only);
+	g_list_free_full (realms, g_object_unref);
+	return ret;
+}
+
+static int
+perform_discover_many (RealmClient *client,
+                       const gchar **strings,
+                       gboolean all,
+                       gboolean name_only,
+                       const gchar *server_software,
+                       const gchar *client_software,
+                       const gchar *membership_software,
+                       gboolean forest)
+{
+	GError **failures = NULL;
+	GError *error = NULL;
+	GList **realms;
+	gint result = 0;
+	gint ret;
+	gint i;
+
+	/* The daemon discovers these concurrently */
+	realms = realm_client_discover_many (client, strings, client_software,
+	                                     server_software, membership_software,
+	                                     forest, REALM_DBUS_REALM_INTERFACE,
+	                                     &failures, &error);
+
+	if (error != NULL) {
+		realm_handle_error (error, _("Couldn't discover realms"));
+		return 1;
+	}
+
+	/* Report each failure, but still show what was discovered */
+	for (i = 0; strings[i] != NULL; i++) {
+		if (failures[i] != NULL) {
+			realm_handle_error (failures[i], _("Couldn't discover realm: %s"), strings[i]);
+			ret = 1;
+		} else {
+			ret = print_discovered (client, strings[i], realms[i], all, name_only);
+		}
+		if (ret != 0)
+			result = ret;
+		g_list_free_full (realms[i], g_object_unref);
+	}
+
+	g_free (failures);
+	g_free (realms);
+	return result;
+}
+
 int
 realm_discover (RealmClient *client,
                 int argc,
@@ -173,8 +233,9 @@ realm_discover (RealmClient *client,
 	GError *error = NULL;
 	gboolean arg_all = FALSE;
 	gboolean arg_name_only = FALSE;
+	gboolean arg_forest = FALSE;
+	const gchar **strings;
 	gint result = 0;
-	gint ret;
 	gint i;
 
 	GOptionEntry option_entries[] = {
@@ -183,6 +244,7 @@ realm_discover (RealmClient *client,
 		{ "client-software", 0, 0, G_OPTION_ARG_STRING, &arg_client_software, N_("Use specific client software"), NULL },
 		{ "membership-software", 0, 0, G_OPTION_ARG_STRING, &arg_membership_software, N_("Use specific membership software"), NULL },
 		{ "server-software", 0, 0, G_OPTION_ARG_STRING, &arg_server_software, N_("Use specific server software"), NULL },
+		{ "forest", 0, 0, G_OPTION_ARG_NONE, &arg_forest, N_("Also discover the other domains in the forest"), NULL },
 		{ NULL, }
 	};
 
@@ -202,19 +264,30 @@ realm_discover (RealmClient *client,
 		                           arg_name_only,
 		                           arg_server_software,
 		                           arg_client_software,
-		                           arg_membership_software);
+		                           arg_membership_software,
+		                           arg_forest);
 
-	/* Specific realms */
+	/* A specific realm */
+	} else if (argc == 2) {
+		result = perform_discover (client, argv[1], arg_all,
+		                           arg_name_only,
+		                           arg_server_software,
+		                           arg_client_software,
+		                           arg_membership_software,
+		                           arg_forest);
+
+	/* Several realms at once */
 	} else {
-		for (i = 1; i < argc; i++) {
-			ret = perform_discover (client, argv[i], arg_all,
-			                        arg_name_only,
-			                        arg_server_software,
-			                        arg_client_software,
-			                        arg_membership_software);
-			if (ret != 0)
-				result = ret;
-		}
+		strings = g_new0 (const gchar *, argc);
+		for (i = 1; i < argc; i++)
+			strings[i - 1] = argv[i];
+		result = perform_discover_many (client, strings,
+		                                arg_all, arg_name_only,
+		                                arg_server_software,
+		                                arg_client_software,
+		                                arg_membership_software,
+		                                arg_forest);
+		g_free (strings);
 	}
 
 	g_free (arg_server_software);
@@ -220,7 +220,7 @@ perform_join (RealmClient *client,
 
 	realms = realm_client_discover (client, string, args->client_software,
 	                                args->server_software, args->membership_software,
-	                                REALM_DBUS_KERBEROS_MEMBERSHIP_INTERFACE,
+	                                FALSE, REALM_DBUS_KERBEROS_MEMBERSHIP_INTERFACE,
 	                                &had_mismatched, &error);
 
 	if (error != NULL) {
@@ -128,7 +128,8 @@ realm_build_options (const gchar *first,
 	while (first != NULL) {
 		option = NULL;
 		if (g_str_equal (first, "groups") ||
-		    g_str_equal (first, REALM_DBUS_OPTION_AUTOMATIC_ID_MAPPING)) {
+		    g_str_equal (first, REALM_DBUS_OPTION_AUTOMATIC_ID_MAPPING) ||
+		    g_str_equal (first, REALM_DBUS_OPTION_FOREST)) {
 			bvalue = va_arg (va, gboolean);
 			option = g_variant_new ("{sv}", first, g_variant_new_boolean (bvalue));
 		} else {